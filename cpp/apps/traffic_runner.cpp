@@ -0,0 +1,432 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "paced_runner.h"
+#include "traffic_model.h"
+
+/*
+ * Headless scenario runner for batch jobs, without Python.
+ *
+ * Usage: traffic_runner <scenario file> [--output-dir directory]
+ *
+ * A scenario file holds one Command:args line per setting, like the network and demand files. Times are in hours,
+ * input files are relative to the scenario file and output files relative to the output directory (default: the
+ * working directory). Blank lines and lines starting with # are skipped.
+ *   Network:file                    required
+ *   RouteCache:directory            where the routes of the network are cached, or off, default next to the
+ *                                   network file, see RouteCache
+ *   Demand:file                     see TrafficModel::loadDemand
+ *   OdMatrix:file                   see TrafficModel::loadOdMatrix
+ *   TripList:file                   scheduled trips instead of the demand, see TrafficModel::loadTripList
+ *   DeltaTime:s                     default 0.5
+ *   Scale:factor                    default 1
+ *   Seed:number                     default 1
+ *   Threads:n                       default 1
+ *   Start:hours,End:hours           simulated period, default 0 to 24
+ *   WarmStart:hours                 populate the network at Start, after a relaxation of the given length,
+ *                                   instead of starting empty, see TrafficModel::warmStart
+ *   Summary:file                    key value pairs of the whole run
+ *   Trips:file                      one row per completed trip
+ *   EdgeStats:file,interval s       mean cars, mean speed and exits per edge and interval
+ *   Detector:name,edge label,m      a loop detector at a position along an edge
+ *   Detectors:file,interval s       cars passing and their mean speed per detector and interval
+ *   Trajectories:file               see TrafficModel::startRecording
+ *   Pace:speed-up[,max lag s]       in real time, speed-up s of simulated time per s, see PacedRunner. Edges with
+ *                                   detectors are high priority.
+ */
+
+namespace {
+    struct Detector
+    {
+        std::string name;
+        int edge;
+        float position; // in m along the edge, at least one step of driving before its end
+        long nPassed = 0;
+        double speedSum = 0;
+    };
+
+    struct Scenario
+    {
+        std::string network;
+        std::string demand;
+        std::string odMatrix;
+        std::string tripList;
+        std::optional<std::string> routeCache; // directory, empty for off
+        float deltaTime = 0.5f;
+        float scale = 1;
+        unsigned int seed = 1;
+        int nThreads = 1;
+        double startTime = 0; // in s
+        double endTime = 24 * 3600;
+        std::optional<double> warmStartRelaxation; // in s
+        std::string summaryFile;
+        std::string tripsFile;
+        std::string edgeStatsFile;
+        double edgeStatsInterval = 300;
+        std::vector<Detector> detectors;
+        std::vector<std::tuple<std::string, std::string, float>> detectorSpecs; // until the network is loaded
+        std::string detectorsFile;
+        double detectorsInterval = 300;
+        std::string trajectoriesFile;
+        std::optional<double> speedUp; // paced if set
+        double maxLag = 10; // in s
+    };
+
+    std::string directoryOf(std::string const& fn) {
+        size_t slash = fn.find_last_of('/');
+        return slash == std::string::npos ? "" : fn.substr(0, slash + 1);
+    }
+
+    std::string resolve(std::string const& directory, std::string const& fn) {
+        return fn.empty() || fn[0] == '/' ? fn : directory + fn;
+    }
+
+    Scenario loadScenario(std::string const& fn, std::string const& outputDirectory) {
+        std::ifstream file(fn);
+        if (!file) {
+            throw std::runtime_error("Could not open scenario file " + fn);
+        }
+        std::string inputDirectory = directoryOf(fn);
+        Scenario scenario;
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            size_t colon = line.find(':');
+            std::string command = line.substr(0, colon);
+            std::vector<std::string> args;
+            std::stringstream stream(colon == std::string::npos ? "" : line.substr(colon + 1));
+            std::string arg;
+            while (std::getline(stream, arg, ',')) {
+                args.push_back(arg);
+            }
+            if (args.empty()) {
+                throw std::runtime_error("Missing arguments to scenario command " + command);
+            }
+            if (command == "Network") {
+                scenario.network = resolve(inputDirectory, args[0]);
+            } else if (command == "RouteCache") {
+                scenario.routeCache = args[0] == "off" ? "" : resolve(outputDirectory, args[0]);
+            } else if (command == "Demand") {
+                scenario.demand = resolve(inputDirectory, args[0]);
+            } else if (command == "OdMatrix") {
+                scenario.odMatrix = resolve(inputDirectory, args[0]);
+            } else if (command == "TripList") {
+                scenario.tripList = resolve(inputDirectory, args[0]);
+            } else if (command == "DeltaTime") {
+                scenario.deltaTime = std::stof(args[0]);
+            } else if (command == "Scale") {
+                scenario.scale = std::stof(args[0]);
+            } else if (command == "Seed") {
+                scenario.seed = std::stoul(args[0]);
+            } else if (command == "Threads") {
+                scenario.nThreads = std::stoi(args[0]);
+            } else if (command == "Start") {
+                scenario.startTime = std::stod(args[0]) * 3600;
+            } else if (command == "End") {
+                scenario.endTime = std::stod(args[0]) * 3600;
+            } else if (command == "WarmStart") {
+                scenario.warmStartRelaxation = std::stod(args[0]) * 3600;
+            } else if (command == "Summary") {
+                scenario.summaryFile = resolve(outputDirectory, args[0]);
+            } else if (command == "Trips") {
+                scenario.tripsFile = resolve(outputDirectory, args[0]);
+            } else if (command == "EdgeStats") {
+                scenario.edgeStatsFile = resolve(outputDirectory, args[0]);
+                if (args.size() > 1) {
+                    scenario.edgeStatsInterval = std::stod(args[1]);
+                }
+            } else if (command == "Detector") {
+                if (args.size() != 3) {
+                    throw std::runtime_error("Expected Detector:name,edge label,position");
+                }
+                scenario.detectorSpecs.emplace_back(args[0], args[1], std::stof(args[2]));
+            } else if (command == "Detectors") {
+                scenario.detectorsFile = resolve(outputDirectory, args[0]);
+                if (args.size() > 1) {
+                    scenario.detectorsInterval = std::stod(args[1]);
+                }
+            } else if (command == "Trajectories") {
+                scenario.trajectoriesFile = resolve(outputDirectory, args[0]);
+            } else if (command == "Pace") {
+                scenario.speedUp = std::stod(args[0]);
+                if (args.size() > 1) {
+                    scenario.maxLag = std::stod(args[1]);
+                }
+            } else {
+                throw std::runtime_error("Unknown scenario command " + command);
+            }
+        }
+        if (scenario.network.empty()) {
+            throw std::runtime_error("Scenario " + fn + " has no Network");
+        }
+        if (!(scenario.endTime > scenario.startTime) || !(scenario.edgeStatsInterval > 0)
+            || !(scenario.detectorsInterval > 0)) {
+            throw std::runtime_error("Scenario " + fn + " needs End after Start and positive intervals");
+        }
+        return scenario;
+    }
+
+    std::ofstream openOutput(std::string const& fn, std::string const& header) {
+        std::ofstream file(fn);
+        if (!file) {
+            throw std::runtime_error("Could not open output file " + fn);
+        }
+        file << header << "\n";
+        return file;
+    }
+
+    // Accumulates per edge over one interval of EdgeStats
+    struct EdgeStatsWriter
+    {
+        std::ofstream file;
+        double interval;
+        double intervalStart;
+        long nSteps = 0;
+        std::vector<double> carSum;
+        std::vector<double> speedSum; // weighted by the cars on the edge
+        std::vector<long> exits;
+        std::vector<long> lastExits;
+
+        EdgeStatsWriter(std::string const& fn, double interval, double startTime, TrafficModel& model)
+            : file(openOutput(fn, "time,edge,label,mean_cars,mean_speed,exits")), interval(interval),
+              intervalStart(startTime), carSum(model.getNEdges()), speedSum(model.getNEdges()),
+              exits(model.getNEdges()), lastExits(model.getNEdges()) {
+            for (int i = 0; i < model.getNEdges(); ++i) {
+                lastExits[i] = model.getEdge(i).getNExitedCars();
+            }
+        }
+
+        void onStep(TrafficModel& model) {
+            nSteps++;
+            for (int i = 0; i < model.getNEdges(); ++i) {
+                Edge const& edge = model.getEdge(i);
+                carSum[i] += edge.getNCars();
+                speedSum[i] += edge.getNCars() * edge.getMeanSpeed();
+                exits[i] += edge.getNExitedCars() - lastExits[i];
+                lastExits[i] = edge.getNExitedCars();
+            }
+            if (model.global_time >= intervalStart + interval) {
+                flush(model);
+            }
+        }
+
+        void flush(TrafficModel& model) {
+            if (nSteps == 0) {
+                return;
+            }
+            for (int i = 0; i < model.getNEdges(); ++i) {
+                file << intervalStart << "," << i << "," << model.getLabelFromEdgeID(i) << "," << carSum[i] / nSteps
+                     << "," << (carSum[i] > 0 ? speedSum[i] / carSum[i] : 0) << "," << exits[i] << "\n";
+            }
+            std::fill(carSum.begin(), carSum.end(), 0);
+            std::fill(speedSum.begin(), speedSum.end(), 0);
+            std::fill(exits.begin(), exits.end(), 0);
+            nSteps = 0;
+            intervalStart += interval;
+        }
+    };
+
+    struct DetectorWriter
+    {
+        std::ofstream file;
+        double interval;
+        double intervalStart;
+        long nSteps = 0;
+        std::vector<Detector> detectors;
+
+        DetectorWriter(std::string const& fn, double interval, double startTime, std::vector<Detector> detectors)
+            : file(openOutput(fn, "time,detector,edge,position,cars,flow,mean_speed")), interval(interval),
+              intervalStart(startTime), detectors(std::move(detectors)) {}
+
+        void onStep(TrafficModel& model) {
+            nSteps++;
+            float dt = model.getDeltaTime();
+            for (auto& detector : detectors) {
+                // A car passed the detector if it was behind it before its last move of v * dt
+                model.getEdge(detector.edge).getCars().forEach([&detector, dt](Car const& car) {
+                    if (car.getX() >= detector.position && car.getX() - car.getV() * dt < detector.position) {
+                        detector.nPassed++;
+                        detector.speedSum += car.getV();
+                    }
+                });
+            }
+            if (model.global_time >= intervalStart + interval) {
+                flush();
+            }
+        }
+
+        void flush() {
+            if (nSteps == 0) {
+                return;
+            }
+            for (auto& detector : detectors) {
+                file << intervalStart << "," << detector.name << "," << detector.edge << "," << detector.position << ","
+                     << detector.nPassed << "," << detector.nPassed * 3600 / interval << ","
+                     << (detector.nPassed > 0 ? detector.speedSum / detector.nPassed : 0) << "\n";
+                detector.nPassed = 0;
+                detector.speedSum = 0;
+            }
+            nSteps = 0;
+            intervalStart += interval;
+        }
+    };
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: traffic_runner <scenario file> [--output-dir directory]\n";
+        return 2;
+    }
+    std::string outputDirectory;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--output-dir" && i + 1 < argc) {
+            outputDirectory = std::string(argv[++i]) + "/";
+        } else {
+            std::cerr << "Unknown argument " << arg << "\n";
+            return 2;
+        }
+    }
+
+    try {
+        Scenario scenario = loadScenario(argv[1], outputDirectory);
+        auto wallStart = std::chrono::steady_clock::now();
+        if (scenario.routeCache) {
+            RouteCache::setEnabled(!scenario.routeCache->empty());
+            RouteCache::setDirectory(*scenario.routeCache);
+        }
+        TrafficModel model(scenario.network, scenario.deltaTime, scenario.scale);
+        if (!scenario.odMatrix.empty()) {
+            model.loadOdMatrix(scenario.odMatrix);
+        }
+        if (!scenario.demand.empty()) {
+            model.loadDemand(scenario.demand);
+        }
+        if (!scenario.tripList.empty()) {
+            model.loadTripList(scenario.tripList);
+        }
+        model.setThreadCount(scenario.nThreads);
+        model.seed(scenario.seed);
+        for (auto const& [name, label, position] : scenario.detectorSpecs) {
+            scenario.detectors.push_back({name, model.getEdgeIDFromLabel(label), position});
+        }
+
+        if (scenario.warmStartRelaxation) {
+            model.warmStart(scenario.startTime, *scenario.warmStartRelaxation, {});
+        } else {
+            model.clearTraffic(scenario.startTime);
+        }
+        double setupTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+        std::optional<EdgeStatsWriter> edgeStats;
+        if (!scenario.edgeStatsFile.empty()) {
+            edgeStats.emplace(scenario.edgeStatsFile, scenario.edgeStatsInterval, model.global_time, model);
+        }
+        std::optional<DetectorWriter> detectors;
+        if (!scenario.detectorsFile.empty()) {
+            detectors.emplace(scenario.detectorsFile, scenario.detectorsInterval, model.global_time,
+                              scenario.detectors);
+        }
+        if (!scenario.trajectoriesFile.empty()) {
+            model.startRecording(scenario.trajectoriesFile, 600, 4);
+        }
+
+        // Trips of the warm start relaxation are left out of the statistics
+        size_t nWarmUpTrips = model.getTravelStats().size();
+        std::optional<PacedRunner> pacedRunner;
+        if (scenario.speedUp) {
+            for (Detector const& detector : scenario.detectors) {
+                model.setEdgeHighPriority(detector.edge, true);
+            }
+            pacedRunner.emplace(model, *scenario.speedUp, scenario.maxLag);
+        }
+        auto runStart = std::chrono::steady_clock::now();
+        long nSteps = 0;
+        while (model.global_time < scenario.endTime) {
+            if (pacedRunner) {
+                pacedRunner->step();
+            } else {
+                model.step();
+            }
+            nSteps++;
+            if (edgeStats) {
+                edgeStats->onStep(model);
+            }
+            if (detectors) {
+                detectors->onStep(model);
+            }
+        }
+        model.stopRecording();
+        // The last interval may be partial
+        if (edgeStats) {
+            edgeStats->flush(model);
+        }
+        if (detectors) {
+            detectors->flush();
+        }
+        double runTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+
+        auto travelStats = model.getTravelStats();
+        double totalTravelTime = 0;
+        std::optional<std::ofstream> trips;
+        if (!scenario.tripsFile.empty()) {
+            trips = openOutput(scenario.tripsFile, "from,to,travel_time,start_time");
+        }
+        for (size_t i = nWarmUpTrips; i < travelStats.size(); ++i) {
+            auto const& [from, to, travelTime, startTime] = travelStats[i];
+            totalTravelTime += travelTime;
+            if (trips) {
+                *trips << model.getLabelFromNodeID(from) << "," << model.getLabelFromNodeID(to) << "," << travelTime
+                       << "," << startTime << "\n";
+            }
+        }
+        size_t nTrips = travelStats.size() - nWarmUpTrips;
+
+        std::ostringstream summary;
+        summary << "network " << scenario.network << "\n"
+                << "seed " << scenario.seed << "\n"
+                << "threads " << model.getThreadCount() << "\n"
+                << "start_time " << scenario.startTime << "\n"
+                << "end_time " << model.global_time << "\n"
+                << "steps " << nSteps << "\n"
+                << "cars_in_simulation " << model.getNCarsInSimulation() << "\n"
+                << "trips " << nTrips << "\n"
+                << "mean_travel_time " << (nTrips > 0 ? totalTravelTime / nTrips : 0) << "\n"
+                << "setup_seconds " << setupTime << "\n"
+                << "run_seconds " << runTime << "\n"
+                << "steps_per_second " << (runTime > 0 ? nSteps / runTime : 0) << "\n";
+        if (!scenario.tripList.empty()) {
+            auto [nReleased, nPending, maxPending] = model.getTripListStats();
+            summary << "trip_list_released " << nReleased << "\n"
+                    << "trip_list_max_read_ahead " << maxPending << "\n";
+        }
+        if (pacedRunner) {
+            PaceReport const& pace = pacedRunner->getReport();
+            summary << "pace_speed_up " << *scenario.speedUp << "\n"
+                    << "pace_mean_step_seconds " << pace.meanStepTime << "\n"
+                    << "pace_max_step_seconds " << pace.maxStepTime << "\n"
+                    << "pace_step_budget_seconds " << pace.stepBudget << "\n"
+                    << "pace_max_lag " << pace.maxLag << "\n"
+                    << "pace_slipped_time " << pace.slippedTime << "\n"
+                    << "pace_degraded_steps " << pace.nDegradedSteps << "\n";
+        }
+        std::cout << summary.str();
+        if (!scenario.summaryFile.empty()) {
+            openOutput(scenario.summaryFile, "# Written by traffic_runner") << summary.str();
+        }
+    } catch (std::exception const& e) {
+        std::cerr << "traffic_runner: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -1,61 +1,21 @@
 #ifndef ACTION_H
 #define ACTION_H
 
-#include <memory>
-#include <vector>
-
-#include "utils.h"
-#include "car.h"
-
-
-/*
- * This is an action abstract base class for cars to take.
- * Actions are applied to cars and may affect internal parameters.
- * In that case, the derivation must be befriended by Car.
- */
-class Action
-{
-public:
-    Action();
-    virtual void apply(Car& ego, float dt) = 0;
-    virtual ~Action() = default;
-};
-
-class CruiseAction : public Action
-{
-public:
-    void apply(Car& ego, float dt) override;
-};
-
-class HardBrakeAction : public Action
-{
-public:
-    void apply(Car& ego, float dt) override;
-};
-
-class ToLeftLaneAction : public Action
-{
-public:
-    void apply(Car& ego, float dt) override;
-};
-
-class ToRightLaneAction : public Action
-{
-public:
-    void apply(Car& ego, float dt) override;
-};
+#include <cstdint>
 
 /*
- * This action carries out multiple actions in a row.
+ * These are the actions for cars to take, decided once per step and applied by Car::step.
+ * They are plain codes rather than objects, such that deciding and applying an action
+ * inlines into the step loop of an edge instead of going through virtual calls.
+ * A lane change is always followed by cruising in the new lane.
  */
-class CompositeAction : public Action
+enum class ActionCode : std::uint8_t
 {
-private:
-    std::vector<std::unique_ptr<Action>> actions;
-
-public:
-    CompositeAction(std::vector<std::unique_ptr<Action>> actions);
-    void apply(Car& ego, float dt) override;
+    None,
+    Cruise,
+    HardBrake,
+    ToLeftLaneAndCruise,
+    ToRightLaneAndCruise,
 };
 
 #endif
@@ -1,84 +1,155 @@
 #ifndef CAR_H
 #define CAR_H
 
-#include "edge/basic_road/basic_road_dynamics.h"
+#include <cstdint>
 #include <random>
 #include <memory>
+#include <vector>
 #include "utils.h"
 #include "action.h"
 
-class CruiseAction;
-class HardBrakeAction;
-class ToLeftLaneAction;
-class ToRightLaneAction;
-class CompositeAction;
-
 /*
  * This is a car model for the traversal of the internal graph of TrafficModel.
  * They are the primary objects kept track of.
  * Each Car instance follows a route planner to its destination.
  * Cars remain idle on destination.
+ *
+ * Only the state touched by the step loop of an edge lives here, such that a car fits in half a cache line.
+ * The route and the start of the trip are kept by the CarPool in a CarTrip under the id of the car.
  */
 class Car
 {
 private:
     float x = 0; // in m
-    float baseTarget = 0; // in m/s
     float v; // in m/s (starts at speed limit of current edge (or maybe not, idfk))
+    float baseTarget = 0; // in m/s
     float offset; // in m/s (to be added to v, with respect to the speed limit)
-    int lane; // in number of lanes (starts at 0) (lane 0 is the rightmost lane)
-
-    std::unique_ptr<Action> action = nullptr;
-    BasicRoadDynamics dynamics = {};
-    float scale;
+    float age = 0; // in s of driving, unscaled, see CarPool::getTravelStats
+    int id = -1; // slot in the CarPool, stable for the lifetime of the car
+    std::int8_t lane; // in number of lanes (starts at 0) (lane 0 is the rightmost lane)
+    ActionCode action = ActionCode::None;
+    std::uint16_t nRemainingNodes; // of the path of the trip, including the node the car is heading to
 
     // Decision maker for graph traversal
 //    std::unique_ptr<RoutePlanner> routePlanner;
 
 public:
-    float age = 0; // in s
-    float global_time;
-    int fromNodeID, toNodeID;
-
 //    Car(std::unique_ptr<RoutePlanner> routePlanner);
-    Car(std::vector<int> path, float global_time, float scale);
-    void syncCarToEdge(float targetSpeed) {
+    // offset is drawn by the CarPool, such that every model has its own generator
+    Car(int nPathNodes, float offset);
+    // Reinitialises a recycled car for a new trip along a path of the given number of nodes
+    void reset(int nPathNodes, float offset);
+    int getID() const { return id; }
+    float getAge() const { return age; }
+    void setAge(float age) { this->age = age; }
+    int getNRemainingNodes() const { return nRemainingNodes; }
+    bool hasArrived() const { return nRemainingNodes == 0; }
+    // Called by a node the car has reached, the next node of the path becomes its target
+    void passNode() { nRemainingNodes--; }
+    // For a change of the speed limit of the edge the car is on
+    void setBaseTarget(float targetSpeed) { baseTarget = targetSpeed; }
+    void syncCarToEdge(float targetSpeed, int nLanes) {
         baseTarget = targetSpeed;
         x = 0;
+        // Roads may have fewer lanes than the previous one
+        if (lane >= nLanes) {
+            lane = (std::int8_t) (nLanes - 1);
+        }
+    }
+    // Halts the car at position x, e.g. at the end of a road with a full junction ahead
+    void stopAt(float x) {
+        this->x = x;
+        v = 0;
+    }
+    // Puts the car somewhere along its edge at speed v, e.g. when a network is populated directly
+    void placeAt(float x, int lane, float v) {
+        this->x = x;
+        this->lane = (std::int8_t) lane;
+        this->v = v;
+    }
+    void setAction(ActionCode action) { this->action = action; }
+    ActionCode getAction() const { return action; }
+    // Applies the current action and moves the car, inline such that the step loop of an edge can be optimised as a whole
+    void step(float dt) {
+        switch (action) {
+            case ActionCode::None:
+                break;
+            case ActionCode::Cruise:
+                cruise(dt);
+                break;
+            case ActionCode::HardBrake:
+                hardBrake(dt);
+                break;
+            case ActionCode::ToLeftLaneAndCruise:
+                toLeftLane();
+                cruise(dt);
+                break;
+            case ActionCode::ToRightLaneAndCruise:
+                toRightLane();
+                cruise(dt);
+                break;
+        }
+        x += v * dt;
+        age += dt;
     }
-    void updateAction(Observation const& observation);
-    void step(float dt);
-    std::vector<int> path;
 
     float getX() const { return x; }
     float getV() const { return v; }
     int getLane() const { return lane; }
-    float getMargin() const { return 20 + 35 * v / 30; }
+    float getMargin() const { return getMargin(v); }
+    // Distance kept to other cars at speed v
+    static float getMargin(float v) { return 20 + 35 * v / 30; }
 
 //    std::shared_ptr<Checkpoint> nextCheckpoint();
 //    std::shared_ptr<Checkpoint> getTargetCheckpoint();
-    // Friend all actions that need internal parameters
-    friend CruiseAction;
-    friend HardBrakeAction;
-    friend ToLeftLaneAction;
-    friend ToRightLaneAction;
-    friend CompositeAction;
 
     float getTarget() const { return baseTarget + offset + 2 * lane; }
 
-    void accelerate(float dt);
-    void softBrake(float dt);
-    void hardBrake(float dt);
+    void cruise(float dt) {
+        float target = getTarget();
+        if (v < target) {
+            accelerate(dt);
+        } else if (v > target) {
+            softBrake(dt);
+        }
+    }
+    void accelerate(float dt) {
+        v += 2 * dt;
+    }
+    void softBrake(float dt) {
+        v -= 2 * dt;
+        if (v < 0) {
+            v = 0;
+        }
+    }
+    void hardBrake(float dt) {
+        v -= 10 * dt;
+        if (v < 0) {
+            v = 0;
+        }
+    }
 
-    void toLeftLane();
-    void toRightLane();
+    void toLeftLane() { lane++; }
+    void toRightLane() { lane--; }
 
     // Necessary for data-locality motivated sorting of the cars
     friend bool operator<(Car const& left, Car const& right);
 
-    static std::default_random_engine generator;
+    friend CarPool;
+};
+
+static_assert(sizeof(Car) <= 32, "The step loop relies on two cars per cache line");
+
+/*
+ * The cold part of a car: its route and when it set out, only needed when the car reaches a node or arrives.
+ */
+struct CarTrip
+{
+    std::vector<int> path; // from the origin to the destination node
+    float startTime; // global time of departure
 
-    static std::normal_distribution<double> normalDistribution;
+    int getOrigin() const { return path.front(); }
+    int getDestination() const { return path.back(); }
 };
 
 /*
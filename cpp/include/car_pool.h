@@ -0,0 +1,85 @@
+#ifndef TRAFFICJELLY_CAR_POOL_H
+#define TRAFFICJELLY_CAR_POOL_H
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "utils.h"
+#include "car.h"
+
+#define CarPoolStats std::tuple<long, long, long, long>
+#define TravelStats std::tuple<int, int, float, float>
+
+/*
+ * This car pool owns the storage of every car in a TrafficModel.
+ * Cars live in a deque, which grows in blocks and never moves them, so the slot index is a stable handle (Car::getID).
+ * The trip of every slot is kept apart in a second deque, such that stepping edges only touches the compact cars.
+ * Arrived cars are recycled through a free list, together with their path capacity,
+ * such that the steady state of a simulation does not touch the general allocator for cars.
+ * Cars released from a WorkerPool thread go to a cache of that worker, merged in worker order by flushCaches.
+ * Acquiring is only done from the main thread.
+ * compact moves the cars in use to the front of the slots in a given order, e.g. that of the edges they are on, such
+ * that stepping walks the slots sequentially. It renumbers the cars, so ids are only stable between compactions.
+ * A copy of a pool holds the same cars under the same ids, which the holders of the copied cars map to with getCopy.
+ */
+class CarPool
+{
+private:
+    std::deque<Car> slots;
+    std::deque<CarTrip> trips; // by car id
+    std::vector<Car*> freeCars;
+    std::vector<std::vector<Car*>> workerCaches;
+    long nAllocated = 0; // slots ever constructed
+    long nReused = 0; // acquisitions served from the free list
+    long nReleased = 0;
+    float scale = 1;
+    // Speed offsets of new cars, per pool such that models can run side by side
+    std::default_random_engine generator;
+    std::normal_distribution<double> offsetDistribution{0, 3};
+
+public:
+    CarPool() = default;
+    // Only between steps, when no car is in a worker cache
+    CarPool(CarPool const& other);
+    CarPool& operator=(CarPool const&) = delete;
+
+    void setScale(float scale) { this->scale = scale; }
+    void seed(unsigned int seed);
+    CarPtr acquire(std::vector<int> const& path, float global_time);
+    void release(Car* car);
+    void setNWorkers(int nWorkers) { workerCaches.resize(nWorkers); }
+    void flushCaches();
+    // Moves the cars to the first slots in the order of the handles, which are then pointed to the moved cars.
+    // Every car in use has to be given exactly once, and no car may be in a worker cache.
+    void compact(std::vector<CarPtr*> const& handles);
+    Car& get(int id) { return slots[id]; }
+    // A handle on the car of this pool with the id of car, which is a car of the pool this one was copied from
+    CarPtr getCopy(Car const& car) { return CarPtr(&slots[car.getID()], CarRecycler{this}); }
+    // Replaces the rest of the path of the car by path, which starts at the node it is heading to or the one it
+    // passed last, and keeps everything before it
+    void reroute(Car& car, std::vector<int> const& path);
+    CarTrip const& getTrip(Car const& car) const { return trips[car.getID()]; }
+    // The node the car is heading to, or reached last once it arrived
+    int getNextNode(Car const& car) const {
+        auto const& path = trips[car.getID()].path;
+        return path[path.size() - std::max(car.getNRemainingNodes(), 1)];
+    }
+    // (from node, to node, travel time, start time) of the trip, with the travel time in global time
+    TravelStats getTravelStats(Car const& car) const {
+        CarTrip const& trip = trips[car.getID()];
+        return std::make_tuple(trip.getOrigin(), trip.getDestination(), car.getAge() / scale, trip.startTime);
+    }
+    int getNCarsInUse() const { return (int) (slots.size() - freeCars.size()); }
+    int getCapacity() const { return (int) slots.size(); }
+    // (allocated, reused, released, in use)
+    CarPoolStats getStats() const {
+        return std::make_tuple(nAllocated, nReused, nReleased, (long) getNCarsInUse());
+    }
+    // (bytes per car touched by stepping, bytes per car of trip data including the path storage)
+    std::tuple<long, long> getBytesPerCar() const;
+};
+
+#endif //TRAFFICJELLY_CAR_POOL_H
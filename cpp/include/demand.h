@@ -0,0 +1,102 @@
+#ifndef TRAFFICJELLY_DEMAND_H
+#define TRAFFICJELLY_DEMAND_H
+
+#include <functional>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * This demand profile is a piecewise constant rate multiplier over the time of day, repeating every day.
+ * Segment i starts at starts[i] seconds after midnight and lasts until the next start.
+ */
+class DemandProfile
+{
+private:
+    std::vector<double> starts; // in s, ascending, starting at 0
+    std::vector<double> multipliers;
+
+public:
+    static constexpr double secondsPerDay = 86400;
+    DemandProfile(std::vector<double> starts, std::vector<double> multipliers);
+    // The hardcoded profile of old: six times the base rate from 7 to 9 and 17 to 19, nothing otherwise.
+    static DemandProfile rushHours();
+    double multiplierAt(double time) const;
+    double getDailyMultiplier() const; // integral of the multiplier over one day, in s
+    // Time at which the integral of rate * multiplier from time onwards reaches area, by inversion.
+    // Returns infinity if the profile never produces demand.
+    double invert(double time, double rate, double area) const;
+};
+
+/*
+ * A stream of trips from one origin, to either a fixed destination or one sampled on arrival (destination == -1).
+ * Every stream draws from its own generator, so arrival times do not depend on the order of spawning or the tick size.
+ */
+struct DemandStream
+{
+    int origin;
+    int destination;
+    double rate; // in trips/s at multiplier 1
+    int profile;
+    std::mt19937 rng;
+};
+
+/*
+ * This demand schedule generates the trips of all streams as non-homogeneous Poisson processes.
+ * The next arrival of every stream is kept in a priority queue, so a tick without arrivals only peeks at the queue.
+ */
+class DemandSchedule
+{
+private:
+    std::vector<DemandProfile> profiles;
+    std::unordered_map<std::string, int> labelToProfile;
+    std::vector<DemandStream> streams;
+    using Arrival = std::pair<double, int>; // (time, stream)
+    std::priority_queue<Arrival, std::vector<Arrival>, std::greater<>> arrivals;
+
+    void scheduleNext(int stream, double time);
+
+public:
+    int addProfile(std::string const& label, DemandProfile profile);
+    int getProfileID(std::string const& label) const { return labelToProfile.at(label); }
+    void addStream(int origin, int destination, double rate, int profile, unsigned int seed);
+    // Discards pending arrivals and schedules the first arrival of every stream after time.
+    void start(double time);
+    // Derives the generator of every stream from seed and restarts at time
+    void seed(unsigned int seed, double time);
+    bool empty() const { return streams.empty(); }
+    double getNextArrival() const;
+
+    // Calls spawn(stream) for every arrival before until, in order of arrival time.
+    template <typename F>
+    void release(double until, F&& spawn) {
+        while (!arrivals.empty() && arrivals.top().first < until) {
+            auto [time, stream] = arrivals.top();
+            arrivals.pop();
+            spawn(streams[stream]);
+            scheduleNext(stream, time);
+        }
+    }
+
+    // Calls visit(stream, time) for every arrival in [from, to) of an independent draw from all streams,
+    // using rng instead of the stream generators, such that the schedule itself is left untouched.
+    template <typename F>
+    void sample(double from, double to, std::mt19937& rng, F&& visit) const {
+        for (auto const& stream : streams) {
+            double time = from;
+            while (true) {
+                double area = std::exponential_distribution<double>(1.0)(rng);
+                time = profiles[stream.profile].invert(time, stream.rate, area);
+                if (!(time < to)) {
+                    break;
+                }
+                visit(stream, time);
+            }
+        }
+    }
+};
+
+#endif //TRAFFICJELLY_DEMAND_H
@@ -5,17 +5,18 @@
 #ifndef CPP_SIMPLE_ROAD_H
 #define CPP_SIMPLE_ROAD_H
 
-#include "edge/edge.h"
+#include "edge/policy_road.h"
+#include "edge/basic_road/basic_road_dynamics.h"
+#include "edge/basic_road/basic_road_observation.h"
 #include "node/node.h"
 
 
-class BasicRoad : public Edge
+class BasicRoad final : public PolicyRoad<BasicRoadDynamics, BasicRoadObserver>
 {
 public:
     BasicRoad(Node& inNode, Node& outNode, std::string label, float speedLimit, int nLanes);
-    void enterCar(std::unique_ptr<Car>&& car) override;
-    void setActions() override;
-    int nLanes;
+    void enterCar(CarPtr&& car) override;
+    std::shared_ptr<Edge> clone(Node& inNode, Node& outNode, CarPool& pool) const override;
 };
 
 
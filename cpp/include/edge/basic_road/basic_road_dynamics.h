@@ -1,4 +1,3 @@
-
 //
 // Created by sappie on 10-10-23.
 //
@@ -7,17 +6,40 @@
 #define TRAFFICJELLY_BASIC_ROAD_DYNAMICS_H
 
 
-#include "edge/basic_road/basic_road_observation.h"
+#include "edge/observation_batch.h"
 #include "action.h"
+#include "car.h"
 
 
-class Action;
-class Observation;
-
+/*
+ * Dynamics policy of a simple road: keep right if possible, otherwise cruise,
+ * otherwise overtake on the left, otherwise brake.
+ * Defined inline, such that PolicyRoad can specialise its step loop on it.
+ */
 class BasicRoadDynamics {
 public:
-    std::unique_ptr<Action> getAction(Observation const& observation,
-                                      Car const& ego);
+    // The same decision for every car of a batch, see ObservationBatch for the sentinels replacing missing cars
+    static void decideBatch(ObservationBatch& batch) {
+        decideRange(batch, 0, batch.size());
+    }
+
+    // The decisions of the entries [begin, end) only, for a window of the road, see Edge::stepSplit
+    static void decideRange(ObservationBatch& batch, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            float margin = Car::getMargin(batch.egoV[i]);
+            bool rightSafe = batch.rightLaneExists[i]
+                    & (batch.rightFrontDx[i] > margin) & (batch.rightFrontDv[i] > 0)
+                    & (batch.rightBackDx[i] < -margin) & (batch.rightBackDv[i] < 0);
+            bool cruise = (batch.frontDx[i] > margin) & (batch.frontDv[i] > -10);
+            bool leftSafe = batch.leftLaneExists[i]
+                    & (batch.leftFrontDx[i] > margin) & (batch.leftFrontDv[i] > 0)
+                    & (batch.leftBackDx[i] < -margin) & (batch.leftBackDv[i] < 0);
+            batch.actions[i] = rightSafe ? ActionCode::ToRightLaneAndCruise
+                    : cruise ? ActionCode::Cruise
+                    : leftSafe ? ActionCode::ToLeftLaneAndCruise
+                    : ActionCode::HardBrake;
+        }
+    }
 };
 
 
@@ -2,38 +2,126 @@
 // Created by sappie on 10-10-23.
 //
 // Observation for a simple road. In a certain range around the car
-// (n meters, implemented in BasicRoad itself) the cars are observed.
+// (n meters, implemented in BasicRoadObserver) the cars are observed.
 // That is, speed, position. (to possibly be extended with braking, etc.)
 
 #ifndef TRAFFICJELLY_OBSERVATION_H
 #define TRAFFICJELLY_OBSERVATION_H
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
-#include <optional>
+#include "utils.h"
 #include "car.h"
+#include "edge/lane_order.h"
+#include "edge/observation_batch.h"
 #include <memory>
 
 class Car;
 
-class RelativeCarObservation{
+/*
+ * Observation policy of a simple road: every car sees the nearest car in front and behind,
+ * in its own lane and both neighbouring lanes, within a fixed margin.
+ */
+class BasicRoadObserver {
 public:
-    float dx, dv;
-};
+    static constexpr float margin = 200;  // update to be relative to speed (or don't)
 
+    // Fills batch with the observations of every car on the road in one pass, in the order of LaneOrder::forEach
+    static void observeBatch(LaneOrder const& cars, ObservationBatch& batch) {
+        batch.resize(cars.size());
+        size_t offset = 0;
+        for (int l = 0; l < cars.getNLanes(); ++l) {
+            size_t n = cars.getLane(l).size();
+            observeLane(cars, l, 0, n, offset, batch);
+            offset += n;
+        }
+    }
 
-class Observation {
-public:
-    Observation(std::vector<std::reference_wrapper<Car>> const& cars,
-                std::unique_ptr<Car> const& ego,
-                int n_lanes);
-    bool leftLaneExists = true;
-    bool rightLaneExists = true;
-    std::optional<RelativeCarObservation> left_front = std::nullopt;
-    std::optional<RelativeCarObservation> left_back = std::nullopt;
-    std::optional<RelativeCarObservation> right_front = std::nullopt;
-    std::optional<RelativeCarObservation> right_back = std::nullopt;
-    std::optional<RelativeCarObservation> front = std::nullopt;
-    std::optional<RelativeCarObservation> back = std::nullopt;
+    // Observes the cars [begin, end) of a lane into batch, at offset + their index in the lane, where batch holds
+    // the cars of all lanes in the order of observeBatch. Neighbours are looked up from the car at begin onwards,
+    // so a window of the road reads the cars up to margin beyond its bounds but writes only its own entries, and
+    // windows can be observed concurrently, see Edge::stepSplit.
+    static void observeLane(LaneOrder const& cars, int l, size_t begin, size_t end, size_t offset,
+                            ObservationBatch& batch) {
+        if (begin >= end) {
+            return;
+        }
+        int nLanes = cars.getNLanes();
+        auto const& lane = cars.getLane(l);
+        auto const* leftLane = l + 1 < nLanes ? &cars.getLane(l + 1) : nullptr;
+        auto const* rightLane = l > 0 ? &cars.getLane(l - 1) : nullptr;
+        // Index of the first car ahead of the ego car in each lane. Egos are visited in ascending order, so these
+        // only ever move forward, starting from the first car not behind the first ego.
+        float firstX = lane[begin]->getX();
+        size_t left = leftLane != nullptr ? firstNotBehind(*leftLane, firstX) : 0;
+        size_t right = rightLane != nullptr ? firstNotBehind(*rightLane, firstX) : 0;
+        size_t front = begin;
+        size_t i = offset + begin;
+        for (size_t j = begin; j < end; ++j, ++i) {
+            Car const& ego = *lane[j];
+            float x = ego.getX();
+            float v = ego.getV();
+            batch.egoX[i] = x;
+            batch.egoV[i] = v;
+            batch.egoLane[i] = l;
+            batch.leftLaneExists[i] = leftLane != nullptr;
+            batch.rightLaneExists[i] = rightLane != nullptr;
+            front = std::max(front, j + 1);
+            while (front < lane.size() && lane[front]->getX() <= x) {
+                front++;
+            }
+            setAhead(batch.frontDx[i], batch.frontDv[i], x, v, front < lane.size() ? lane[front].get() : nullptr);
+            setBehind(batch.backDx[i], batch.backDv[i], x, v, j > 0 ? lane[j - 1].get() : nullptr);
+            Car const* leftFront = nullptr;
+            Car const* leftBack = nullptr;
+            if (leftLane != nullptr) {
+                while (left < leftLane->size() && (*leftLane)[left]->getX() <= x) {
+                    left++;
+                }
+                leftFront = left < leftLane->size() ? (*leftLane)[left].get() : nullptr;
+                leftBack = left > 0 ? (*leftLane)[left - 1].get() : nullptr;
+            }
+            setAhead(batch.leftFrontDx[i], batch.leftFrontDv[i], x, v, leftFront);
+            setBehind(batch.leftBackDx[i], batch.leftBackDv[i], x, v, leftBack);
+            Car const* rightFront = nullptr;
+            Car const* rightBack = nullptr;
+            if (rightLane != nullptr) {
+                while (right < rightLane->size() && (*rightLane)[right]->getX() <= x) {
+                    right++;
+                }
+                rightFront = right < rightLane->size() ? (*rightLane)[right].get() : nullptr;
+                rightBack = right > 0 ? (*rightLane)[right - 1].get() : nullptr;
+            }
+            setAhead(batch.rightFrontDx[i], batch.rightFrontDv[i], x, v, rightFront);
+            setBehind(batch.rightBackDx[i], batch.rightBackDv[i], x, v, rightBack);
+        }
+    }
+
+private:
+    static size_t firstNotBehind(std::deque<CarPtr> const& lane, float x) {
+        auto first = std::lower_bound(lane.begin(), lane.end(), x, [](CarPtr const& car, float x) {
+            return car->getX() < x;
+        });
+        return first - lane.begin();
+    }
+    // Relative observation of other, or the sentinel if there is none within margin
+    static void setAhead(float& dx, float& dv, float x, float v, Car const* other) {
+        dx = ObservationBatch::ahead;
+        dv = ObservationBatch::ahead;
+        if (other != nullptr && std::abs(other->getX() - x) <= margin) {
+            dx = other->getX() - x;
+            dv = other->getV() - v;
+        }
+    }
+    static void setBehind(float& dx, float& dv, float x, float v, Car const* other) {
+        dx = ObservationBatch::behind;
+        dv = ObservationBatch::behind;
+        if (other != nullptr && std::abs(other->getX() - x) <= margin) {
+            dx = other->getX() - x;
+            dv = other->getV() - v;
+        }
+    }
 };
 
 
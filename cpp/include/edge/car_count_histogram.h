@@ -0,0 +1,44 @@
+#ifndef TRAFFICJELLY_CAR_COUNT_HISTOGRAM_H
+#define TRAFFICJELLY_CAR_COUNT_HISTOGRAM_H
+
+/*
+ * This is a histogram of car counts along an edge, binned by position.
+ * It is kept up to date incrementally while cars move, so reading it never requires a rebuild.
+ * The counts live in a buffer owned by the caller, such that all edges can share one contiguous block.
+ * Bin i covers [i * binDistance, (i + 1) * binDistance), cars beyond the last bin are not counted.
+ */
+class CarCountHistogram
+{
+private:
+    int* counts = nullptr;
+    int nBins = 0;
+    float binDistance = 0;
+
+    int binOf(float x) const { return (int) (x / binDistance); }
+
+public:
+    static int countBins(float length, float binDistance);
+    void attach(int* counts, int nBins, float binDistance);
+    bool isAttached() const { return counts != nullptr; }
+    float getBinDistance() const { return binDistance; }
+
+    void add(float x) {
+        int bin = binOf(x);
+        if (bin < nBins) counts[bin]++;
+    }
+    void remove(float x) {
+        int bin = binOf(x);
+        if (bin < nBins) counts[bin]--;
+    }
+    void move(float fromX, float toX) {
+        int from = binOf(fromX);
+        int to = binOf(toX);
+        if (from == to) {
+            return;
+        }
+        if (from < nBins) counts[from]--;
+        if (to < nBins) counts[to]++;
+    }
+};
+
+#endif //TRAFFICJELLY_CAR_COUNT_HISTOGRAM_H
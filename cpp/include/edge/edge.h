@@ -1,8 +1,9 @@
 #ifndef EDGE_H
 #define EDGE_H
 
+#include <algorithm>
+#include <cstdint>
 #include <deque>
-#include <list>
 #include <memory>
 #include <vector>
 #include <string>
@@ -10,6 +11,13 @@
 #include <tuple>
 #include "utils.h"
 #include "car.h"
+#include "edge/car_count_histogram.h"
+#include "edge/lane_order.h"
+#include "edge/observation_batch.h"
+#include "probe.h"
+#include "spsc_queue.h"
+
+class WorkerPool;
 
 /*
  * This is an edge for the internal graph of TrafficModel.
@@ -19,38 +27,172 @@
 class Edge
 {
 protected:
-    // To keep track of every car in the driving order.
-    std::list<std::unique_ptr<Car>> cars;
-    float const speedLimit; // in m/s
+    // To keep track of every car in the driving order, per lane.
+    LaneOrder cars;
+    float speedLimit; // in m/s
+    int const nLanes;
     int id;
 
     Node& inNode;
     std::string const label;
+    // Kept up to date while cars enter, move and exit, see attachHistogram.
+    CarCountHistogram histogram;
+    // Handoff with the nodes, which may run on other threads: the in-node produces the inbox,
+    // the out-node consumes the outbox.
+    SpscQueue<CarPtr> inbox;
+    SpscQueue<CarPtr> outbox;
+    std::vector<CarPtr> exitingCars; // scratch for publishExitingCars
+    ObservationBatch batch; // scratch for setActions
+    bool actionsOverridden = false; // skip setActions for one step, see overrideActions
+    // Steps between two calls of setActions, see setDecisionInterval
+    int decisionInterval = 1;
+    int stepsUntilDecision = 0;
+    bool highPriority = false; // always decides every step
+    // Scratch of stepSplit. Window w holds the cars of lane l from windowStarts[w * nLanes + l] on, the last row
+    // holds the lane sizes. laneOffsets and previousX are in the order of LaneOrder::forEach.
+    std::vector<int> windowStarts;
+    std::vector<int> laneOffsets;
+    std::vector<float> previousX; // for the histogram
+    // Counted while moving the cars in updateCars
+    float meanSpeed = 0; // in m/s
+    int nQueuedCars = 0;
+    long nExitedCars = 0; // taken by the out-node since construction or clearCars, see countExit
+    bool closed = false; // takes no new cars, those on it still leave
+    std::vector<char> entrySpace; // per lane, see takeEntrySnapshot
+    ProbeSet const* probes = nullptr; // of the model, told about entries, exits and lane changes
+
+    // Gives the cars their actions, in the order of LaneOrder::forEach
+    void applyActions(std::vector<ActionCode> const& actions);
+    // Whether the cars get new actions in this step, or keep those of the last decision, see setDecisionInterval
+    bool isDecisionStep() {
+        if (actionsOverridden) {
+            actionsOverridden = false;
+            return false;
+        }
+        if (--stepsUntilDecision > 0) {
+            keepActions();
+            return false;
+        }
+        stepsUntilDecision = decisionInterval;
+        return true;
+    }
+    // Lane changes were made in the step they were decided in, so they turn into cruising in the new lane
+    void keepActions();
+    // Splits the cars by position into up to nWindows windows of about as many cars each, see stepSplit
+    int splitIntoWindows(int nWindows);
+    // Observes the cars of a window of stepSplit and gives them their actions
+    virtual void decideWindow(int window) = 0;
+    void applyWindowActions(int window);
+    void updateWindow(float dt, int window);
+    // Copies the cars and counters into edge, a new edge of the same road type, see clone
+    void copyStateTo(Edge& edge, CarPool& pool) const;
 public:
     float length; // In meters
 
     Node& outNode;
-    Edge(Node& inNode, Node& outNode, std::string label, float speedLimit);
+    Edge(Node& inNode, Node& outNode, std::string label, float speedLimit, int nLanes);
     virtual ~Edge();
+    // An edge of the same road and state between the given nodes, holding the cars with the same ids in pool, which
+    // is a copy of the pool of this edge. Only between steps, when the handoff queues are empty.
+    virtual std::shared_ptr<Edge> clone(Node& inNode, Node& outNode, CarPool& pool) const = 0;
     virtual void setActions() = 0;
-    virtual void enterCar(std::unique_ptr<Car>&& car) = 0;
-    std::vector<std::unique_ptr<Car>> getExitingCars();
+    // Observations of all cars at once and the decision of the road's own dynamics on them, see ObservationBatch
+    virtual void observe(ObservationBatch& observations) const = 0;
+    virtual void decide(ObservationBatch& observations) const = 0;
+    // Replaces the decisions of the next step by actions from an external controller, in the order of observe.
+    // A lane change towards a lane the edge does not have becomes cruising, like the road's own decisions never
+    // make it.
+    void overrideActions(std::vector<ActionCode> const& actions);
+    virtual void enterCar(CarPtr&& car) = 0;
+    // Called by the in-node, the car enters at the next receiveCars. Returns false and keeps the car if the inbox is
+    // full or the edge is closed.
+    bool sendCar(CarPtr&& car) { return !closed && inbox.push(std::move(car)); }
+    // Enters all sent cars in the order they were sent
+    void receiveCars();
+    // Moves the cars that passed the end of the edge to the outbox, front-most car first.
+    void publishExitingCars();
+    // Whether cars wait in the handoff queues, for the out-node and for this edge respectively
+    bool hasExitingCars() const { return !outbox.empty(); }
+    bool hasEnteringCars() const { return !inbox.empty(); }
+    // Called by the out-node, moves the published cars into exitingCars.
+    void getExitingCars(std::vector<CarPtr>& exitingCars);
+    // Called by the out-node for every car of getExitingCars it keeps, rather than holding it at the end of the
+    // edge, such that a car sent back is counted once, when it finally leaves
+    void countExit(Car const& car);
+    // Enters a car directly at position x in the given lane, driving at speed v
+    void placeCar(CarPtr&& car, float x, int lane, float v);
+    // The position nearest to x, at or behind it, that is at least gap away from every car in the lane, or -1 if
+    // the lane is queued up to its start
+    float findFreePosition(int lane, float x, float gap) const;
+    // Removes every car, including those in the handoff queues, the attached histogram is left to its owner
+    void clearCars();
+    // Appends the handles of the cars on the edge, in driving order per lane. Only valid between steps, when the
+    // handoff queues are empty.
+    void collectCarHandles(std::vector<CarPtr*>& handles) { cars.collectHandles(handles); }
+    // Sets what a step without cars would, for an empty edge that is no longer stepped
+    void idle() {
+        meanSpeed = 0;
+        nQueuedCars = 0;
+        std::fill(entrySpace.begin(), entrySpace.end(), 1);
+    }
+    // Puts an exiting car back at the end of the edge, standing still, when it cannot leave yet
+    void holdCarAtEnd(CarPtr&& car);
+    // Whether a car can enter the given lane without landing on the car that entered last, as of the last
+    // takeEntrySnapshot
+    bool hasEntrySpace(int lane) const { return entrySpace[std::min(lane, nLanes - 1)]; }
+    // Records the entry space of every lane for the node phase, after publishExitingCars. The in-node reads it while
+    // the out-node, possibly on another worker, holds cars at the end of the edge.
+    void takeEntrySnapshot();
+    static constexpr float entryGap = 7.5f; // in m
+    static constexpr size_t handoffCapacity = 1024; // in cars, per inbox and outbox
+    static constexpr float queueSpeed = 1.0f; // in m/s, slower cars count as queued
     void sortCars();
     void updateCars(float dt);
-    void step(float dt) {
-        setActions();
+    // Road types may override this with a loop specialised on their policies, see PolicyRoad
+    virtual void step(float dt) {
+        if (isDecisionStep()) {
+            setActions();
+        }
         updateCars(dt);
         sortCars();
     }
+    // The same step with every worker of the pool on one window of the edge, for a long edge holding so many cars
+    // that it would keep the other workers waiting. Windows observe in parallel, reading their neighbours up to
+    // the observation margin beyond their bounds, then move their cars in parallel once all have decided. The
+    // counters and the order of the cars are merged afterwards, in the order of step, so results are the same.
+    void stepSplit(float dt, WorkerPool& workers);
     std::string getLabel() const;
     int getNCars() const { return cars.size(); }
+    int getNLanes() const { return nLanes; }
+    float getSpeedLimit() const { return speedLimit; }
+    // Also for the cars on the edge
+    void setSpeedLimit(float speedLimit);
+    bool isClosed() const { return closed; }
+    void setClosed(bool closed) { this->closed = closed; }
+    // Observes and decides only every nSteps steps, the cars keep their actions in between. A cheaper, coarser
+    // step for when a run falls behind real time, see PacedRunner. Edges decide in turns, spread by id.
+    void setDecisionInterval(int nSteps);
+    int getDecisionInterval() const { return decisionInterval; }
+    bool isHighPriority() const { return highPriority; }
+    void setHighPriority(bool highPriority) { this->highPriority = highPriority; }
+    // Over the cars moved in the last step
+    float getMeanSpeed() const { return meanSpeed; }
+    int getNQueuedCars() const { return nQueuedCars; }
+    long getNExitedCars() const { return nExitedCars; }
+    LaneOrder const& getCars() const { return cars; }
     int getID() const { return id; }
     void setID(int id) { this->id = id; }
+    void setProbes(ProbeSet const* probes) { this->probes = probes; }
     float getLength() const { return length; }
     Node& getInNode() const { return inNode; }
     Node& getOutNode() const { return outNode; }
     std::tuple<std::vector<int>, std::vector<float>> getCarCountHist(float bin_distance) const;
+    int getHistogramBinCount(float binDistance) const { return CarCountHistogram::countBins(length, binDistance); }
+    void attachHistogram(int* counts, float binDistance);
+    float getHistogramBinDistance() const { return histogram.getBinDistance(); }
     float getExpectedCrossingTime() const { return length / speedLimit; }
+    // Digest of the state of all cars on the edge, in driving order per lane
+    std::uint64_t computeStateDigest() const;
 };
 
 
@@ -0,0 +1,80 @@
+#ifndef TRAFFICJELLY_LANE_ORDER_H
+#define TRAFFICJELLY_LANE_ORDER_H
+
+#include <deque>
+#include <vector>
+
+#include "utils.h"
+#include "car.h"
+
+/*
+ * This lane order keeps the cars of an edge in one sequence per lane, each ordered by position (ascending x).
+ * Neighbour queries can then step along a lane instead of filtering every nearby car by lane.
+ * Since cars only move a little per step, resort() finishes in a single pass when nobody overtook anybody,
+ * and otherwise pays one adjacent swap per overtake and one merge per lane that cars changed into.
+ * A global order over all lanes is available through getOrder(), built lazily for code that needs it.
+ */
+class LaneOrder
+{
+private:
+    std::vector<std::deque<CarPtr>> lanes;
+    int nCars = 0;
+    mutable std::vector<Car*> order;
+    mutable bool orderValid = true;
+    // Scratch for resort
+    struct LaneChanger
+    {
+        CarPtr car;
+        long rank; // among the cars at the same position in its new lane, see resort
+    };
+    std::vector<LaneChanger> laneChangers;
+    std::vector<float> laneFronts;
+
+    void insertIntoLane(CarPtr&& car);
+    // Moves laneChangers into their new lanes, see resort
+    void mergeLaneChangers();
+
+public:
+    explicit LaneOrder(int nLanes);
+    // The cars of other, as the cars with the same ids in pool, a copy of the pool of other
+    void copyFrom(LaneOrder const& other, CarPool& pool);
+    int getNLanes() const { return (int) lanes.size(); }
+    int size() const { return nCars; }
+    std::deque<CarPtr>& getLane(int lane) { return lanes[lane]; }
+    std::deque<CarPtr> const& getLane(int lane) const { return lanes[lane]; }
+
+    void insert(CarPtr&& car);
+    // Restores the per-lane order after cars moved and possibly changed lanes.
+    void resort();
+    // Moves the cars past position x into exitingCars, front-most car first.
+    void popBeyond(float x, std::vector<CarPtr>& exitingCars);
+    std::vector<Car*> const& getOrder() const;
+
+    template <typename F>
+    void forEach(F&& f) {
+        for (auto& lane : lanes) {
+            for (auto& car : lane) {
+                f(*car);
+            }
+        }
+    }
+    template <typename F>
+    void forEach(F&& f) const {
+        for (auto const& lane : lanes) {
+            for (auto const& car : lane) {
+                f(*car);
+            }
+        }
+    }
+    // Appends the handle of every car, lane by lane, for code that moves the cars, see CarPool::compact
+    void collectHandles(std::vector<CarPtr*>& handles) {
+        for (auto& lane : lanes) {
+            for (auto& car : lane) {
+                handles.push_back(&car);
+            }
+        }
+        orderValid = false;
+    }
+};
+
+#endif //TRAFFICJELLY_LANE_ORDER_H
@@ -0,0 +1,49 @@
+#ifndef TRAFFICJELLY_OBSERVATION_BATCH_H
+#define TRAFFICJELLY_OBSERVATION_BATCH_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "action.h"
+
+/*
+ * Observations of all cars of an edge as flat arrays, with one entry per car in the order of LaneOrder::forEach.
+ * Instead of an optional, a neighbour that is missing or beyond the observation margin is stored as a sentinel
+ * that passes every distance check: dx = dv = ahead for a car in front, dx = dv = behind for a car behind.
+ * Decisions over a batch are then plain loops over the arrays, and the arrays can be handed to external controllers.
+ */
+struct ObservationBatch
+{
+    static constexpr float ahead = std::numeric_limits<float>::infinity();
+    static constexpr float behind = -std::numeric_limits<float>::infinity();
+
+    std::vector<float> egoX;
+    std::vector<float> egoV;
+    std::vector<std::int32_t> egoLane;
+    std::vector<std::uint8_t> leftLaneExists;
+    std::vector<std::uint8_t> rightLaneExists;
+    std::vector<float> frontDx, frontDv;
+    std::vector<float> backDx, backDv;
+    std::vector<float> leftFrontDx, leftFrontDv;
+    std::vector<float> leftBackDx, leftBackDv;
+    std::vector<float> rightFrontDx, rightFrontDv;
+    std::vector<float> rightBackDx, rightBackDv;
+    std::vector<ActionCode> actions; // filled by a decision over the batch
+
+    size_t size() const { return egoX.size(); }
+
+    // Resizes every array, the entries are left to the observer
+    void resize(size_t n) {
+        for (auto* column : {&egoX, &egoV, &frontDx, &frontDv, &backDx, &backDv, &leftFrontDx, &leftFrontDv,
+                             &leftBackDx, &leftBackDv, &rightFrontDx, &rightFrontDv, &rightBackDx, &rightBackDv}) {
+            column->resize(n);
+        }
+        egoLane.resize(n);
+        leftLaneExists.resize(n);
+        rightLaneExists.resize(n);
+        actions.resize(n);
+    }
+};
+
+#endif //TRAFFICJELLY_OBSERVATION_BATCH_H
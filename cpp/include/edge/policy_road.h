@@ -0,0 +1,60 @@
+#ifndef TRAFFICJELLY_POLICY_ROAD_H
+#define TRAFFICJELLY_POLICY_ROAD_H
+
+#include <string>
+#include <utility>
+
+#include "edge/edge.h"
+
+/*
+ * This is a road whose step is specialised at compile time on a dynamics and an observation policy.
+ * Observing, deciding and applying actions all inline into one loop per edge,
+ * so the only dynamic dispatch left is the virtual step call per edge per tick.
+ * Road types chosen at runtime from the network file each map to one instantiation.
+ *
+ * Observer must provide observeBatch(LaneOrder const&, ObservationBatch&) filling the observations of every car,
+ * and Dynamics must provide decideBatch(ObservationBatch&) filling the actions, such that both run as flat loops.
+ * For the windows of Edge::stepSplit, Observer must also provide observeLane and Dynamics decideRange, the same
+ * over a range of the cars of one lane.
+ */
+template <typename Dynamics, typename Observer>
+class PolicyRoad : public Edge
+{
+public:
+    PolicyRoad(Node& inNode, Node& outNode, std::string label, float speedLimit, int nLanes)
+        : Edge(inNode, outNode, std::move(label), speedLimit, nLanes) {}
+
+    void setActions() override {
+        Observer::observeBatch(cars, batch);
+        Dynamics::decideBatch(batch);
+        applyActions(batch.actions);
+    }
+
+    void observe(ObservationBatch& observations) const override {
+        Observer::observeBatch(cars, observations);
+    }
+
+    void decide(ObservationBatch& observations) const override {
+        Dynamics::decideBatch(observations);
+    }
+
+    void decideWindow(int window) override {
+        for (int l = 0; l < nLanes; ++l) {
+            size_t begin = windowStarts[window * nLanes + l];
+            size_t end = windowStarts[(window + 1) * nLanes + l];
+            Observer::observeLane(cars, l, begin, end, laneOffsets[l], batch);
+            Dynamics::decideRange(batch, laneOffsets[l] + begin, laneOffsets[l] + end);
+        }
+        applyWindowActions(window);
+    }
+
+    void step(float dt) override {
+        if (isDecisionStep()) {
+            PolicyRoad::setActions();
+        }
+        updateCars(dt);
+        sortCars();
+    }
+};
+
+#endif //TRAFFICJELLY_POLICY_ROAD_H
@@ -0,0 +1,88 @@
+#ifndef TRAFFICJELLY_FRAME_PUBLISHER_H
+#define TRAFFICJELLY_FRAME_PUBLISHER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class TrafficModel;
+
+/*
+ * Layout of the shared memory segment written by FramePublisher, mirrored by graphviz/frame_stream.py.
+ * It starts with this header, followed by a static section with the topology and a ring of frame slots:
+ *
+ * static: float nodeX[nNodes], nodeY[nNodes], int32 edgeStart[nEdges], edgeEnd[nEdges],
+ *         float edgeLength[nEdges], int32 binOffsets[nEdges + 1]
+ * slot:   FrameSlotHeader, int32 carsPerEdge[nEdges], carsPerNode[nNodes], histograms[nBins],
+ *         int32 carEdge[maxCars], float carX[maxCars], int32 carLane[maxCars]
+ *
+ * Every section starts 8 byte aligned.
+ */
+struct FrameStreamHeader
+{
+    static constexpr std::uint32_t magicValue = 0x534a4654; // "TFJS"
+    static constexpr std::uint32_t currentVersion = 1;
+
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t nNodes;
+    std::uint32_t nEdges;
+    std::uint32_t nBins;
+    std::uint32_t maxCars;
+    std::uint32_t nSlots;
+    float binDistance; // in m
+    float deltaTime; // in s, per step
+    std::uint32_t padding;
+    std::uint64_t staticOffset;
+    std::uint64_t slotOffset;
+    std::uint64_t slotSize;
+    std::atomic<std::uint64_t> latestFrame; // number of the newest complete frame, 0 before the first
+};
+
+/*
+ * A slot is guarded by a sequence lock: sequence is odd while the publisher writes the slot.
+ * A reader copies the slot and accepts the copy if sequence was even and unchanged around the copy.
+ */
+struct FrameSlotHeader
+{
+    std::atomic<std::uint64_t> sequence;
+    std::uint64_t frame;
+    double globalTime; // in s
+    std::uint32_t nCars; // car entries in use, at most maxCars
+    std::uint32_t padding;
+};
+
+/*
+ * This frame publisher writes compact frames of a TrafficModel into a lock-free ring buffer in shared memory.
+ * Any number of viewers in other processes can attach by name, read the latest frame and skip stale ones,
+ * while the simulation never waits for them.
+ */
+class FramePublisher
+{
+private:
+    std::string name;
+    int fd = -1;
+    std::byte* memory = nullptr;
+    size_t memorySize = 0;
+    FrameStreamHeader* header = nullptr;
+    int stepsPerFrame;
+    int stepsSinceFrame = 0;
+    std::uint64_t nFrames = 0;
+
+    template <typename T>
+    T* at(size_t offset) const { return reinterpret_cast<T*>(memory + offset); }
+
+public:
+    // The model must already have car count histograms registered, which are included in every frame
+    FramePublisher(TrafficModel& model, std::string name, int stepsPerFrame, int nSlots, int maxCars);
+    ~FramePublisher();
+    FramePublisher(FramePublisher const&) = delete;
+    FramePublisher& operator=(FramePublisher const&) = delete;
+
+    void onStep(TrafficModel& model);
+    void publish(TrafficModel& model);
+    std::uint64_t getNFrames() const { return nFrames; }
+};
+
+#endif //TRAFFICJELLY_FRAME_PUBLISHER_H
@@ -0,0 +1,21 @@
+#ifndef TRAFFICJELLY_NETWORK_ORDER_H
+#define TRAFFICJELLY_NETWORK_ORDER_H
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Orders points along a Hilbert curve over their bounding box, such that points close in the plane end up close in
+ * the order. TrafficModel numbers its nodes this way, so that neighbouring nodes and edges share cache lines in every
+ * array by id and are handled by the same worker.
+ */
+namespace NetworkOrder {
+    int const curveOrder = 16; // bits per coordinate of the grid the points are snapped to
+
+    // Position of grid cell (x, y) along the curve, with x and y below 2^curveOrder
+    std::uint64_t hilbertIndex(std::uint32_t x, std::uint32_t y);
+    // Indices of the points in curve order, ties keep their original order
+    std::vector<int> hilbertOrder(std::vector<float> const& xs, std::vector<float> const& ys);
+}
+
+#endif //TRAFFICJELLY_NETWORK_ORDER_H
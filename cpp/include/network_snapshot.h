@@ -0,0 +1,43 @@
+#ifndef TRAFFICJELLY_NETWORK_SNAPSHOT_H
+#define TRAFFICJELLY_NETWORK_SNAPSHOT_H
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * The static part of a network as flat arrays by node and edge id, read once by viewers and loggers.
+ */
+struct NetworkTopology
+{
+    std::vector<float> nodeX; // as in TrafficModel::getNodePosition
+    std::vector<float> nodeY;
+    std::vector<std::int32_t> edgeStart; // node id
+    std::vector<std::int32_t> edgeEnd; // node id
+    std::vector<float> edgeLength; // in m
+    std::vector<std::int32_t> edgeLanes;
+    std::vector<float> edgeSpeedLimit; // in m/s
+};
+
+/*
+ * The changing state of all edges and nodes as flat arrays by id, filled in place by
+ * TrafficModel::fillNetworkSnapshot, such that a frame costs one call and no allocation.
+ * Every value comes from counters kept during step.
+ */
+struct NetworkSnapshot
+{
+    double globalTime = 0;
+    int nCars = 0; // in the whole simulation
+    std::vector<std::int32_t> edgeCars;
+    std::vector<float> edgeMeanSpeed; // in m/s, over the cars moved in the last step, 0 for an empty edge
+    std::vector<std::int32_t> edgeQueue; // cars moving slower than Edge::queueSpeed
+    std::vector<std::int32_t> nodeCars; // spawned, waiting or queued in the node
+
+    void resize(size_t nNodes, size_t nEdges) {
+        edgeCars.resize(nEdges);
+        edgeMeanSpeed.resize(nEdges);
+        edgeQueue.resize(nEdges);
+        nodeCars.resize(nNodes);
+    }
+};
+
+#endif //TRAFFICJELLY_NETWORK_SNAPSHOT_H
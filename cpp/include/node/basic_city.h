@@ -16,6 +16,7 @@ private:
 public:
     BasicCity(std::string label, int population, float x, float y);
     int getPopulation() { return population; }
+    std::shared_ptr<Node> clone(CarPool& pool) const override;
     void distributeCars() override;
     void step(float dt) override {
     }
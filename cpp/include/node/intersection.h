@@ -0,0 +1,54 @@
+#ifndef TRAFFICJELLY_INTERSECTION_H
+#define TRAFFICJELLY_INTERSECTION_H
+
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "node/node.h"
+
+/*
+ * This is an intersection node, usable for merges and crossroads.
+ * Cars wait in a bounded queue per turning movement (in-edge, out-edge pair),
+ * and each movement discharges at most saturationFlow cars per second.
+ * A car is only released if the entry of its out-edge is free, and a full movement queue
+ * keeps cars at the end of their in-edge, such that congestion spills back upstream.
+ */
+class Intersection : public Node {
+private:
+    struct Movement {
+        std::deque<CarPtr> queue;
+        float credit = 1; // cars that may still be discharged
+        double idleSince = 0; // in s of Node::clock, when the queue last ran empty
+        bool active = false;
+    };
+
+    float saturationFlow; // in cars/s per movement
+    int queueCapacity; // in cars per movement
+    int nQueued = 0;
+    // Turning table, built once by prepare()
+    std::unordered_map<int, int> outEdgeByNextNode;
+    std::vector<Movement> movements; // indexed by inEdge * outEdges.size() + outEdge
+    std::vector<int> activeMovements;
+    std::vector<std::uint32_t> enteredLanes; // bit per lane, per out-edge
+    std::vector<CarPtr> exitingCars; // scratch for collectCars
+
+    void activate(int movement);
+
+public:
+    Intersection(std::string label, float x, float y, float saturationFlow, int queueCapacity);
+    std::shared_ptr<Node> clone(CarPool& pool) const override;
+    void prepare() override;
+    void clearCars() override;
+    void collectCarHandles(std::vector<CarPtr*>& handles) override;
+    // Queued cars whose next node changes move to the queue of their new movement, behind the cars there
+    void rerouteCars(std::function<void(Car&)> const& reroute) override;
+    void collectCars() override;
+    void distributeCars() override;
+    void step(float dt) override;
+    int getNCars() const override { return storedCars.size() + nQueued; }
+    std::uint64_t computeStateDigest() const override;
+};
+
+#endif //TRAFFICJELLY_INTERSECTION_H
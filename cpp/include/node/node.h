@@ -1,6 +1,8 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include <cstdint>
+#include <functional>
 #include <list>
 #include <memory>
 #include <vector>
@@ -10,6 +12,7 @@
 
 #include "utils.h"
 #include "car.h"
+#include "car_pool.h"
 #include "edge/edge.h"
 #include <tuple>
 /*
@@ -21,21 +24,53 @@
 
 class Node {
     std::string const label;
+protected:
+    // Copies the position, stats and stored cars into node, a new node of the same type, see clone
+    void copyStateTo(Node& node, CarPool& pool) const;
 public:
     float x, y;
     std::vector<std::tuple<int, int, float, float>> travelStats;
     int population;
     int id;
+    CarPool* carPool = nullptr; // of the model, holds the trips of the cars passing through
+    ProbeSet const* probes = nullptr; // of the model, told about arrivals
+    // Of the model, advanced by the dt of every step before the nodes run, also for nodes that are idle and not
+    // stepped. In s, since any fixed start.
+    double const* clock = nullptr;
     Node(std::string label, float x, float y, int population);
-    std::string getLabel() { return label; }
+    std::string getLabel() const { return label; }
     std::vector<std::reference_wrapper<Edge>> inEdges; // ref
     std::vector<std::reference_wrapper<Edge>> outEdges;
-    std::vector<std::unique_ptr<Car>> storedCars;
-    void spawnCar(std::vector<int> path, float global_time, float scale) {
-        std::unique_ptr<Car> car = std::make_unique<Car>(path, global_time, scale);
+    std::vector<CarPtr> storedCars;
+    void spawnCar(CarPtr&& car) {
         storedCars.push_back(std::move(car));
     }
-    void collectCars();
+    virtual ~Node() = default;
+    // A node of the same type and state, without edges, holding the cars with the same ids in pool, which is a copy
+    // of carPool. Only between steps.
+    virtual std::shared_ptr<Node> clone(CarPool& pool) const = 0;
+    // Keeps the travel stats of a car that ends its trip here, before it is recycled
+    void recordArrival(Car const& car);
+    // Called once the graph is complete and ids are assigned
+    virtual void prepare() {}
+    virtual void collectCars();
+    // Removes every car held by the node and its travel stats
+    virtual void clearCars() {
+        storedCars.clear();
+        travelStats.clear();
+    }
+    // Appends the handles of every car held by the node
+    virtual void collectCarHandles(std::vector<CarPtr*>& handles) {
+        for (auto& car : storedCars) {
+            handles.push_back(&car);
+        }
+    }
+    // Calls reroute for every car held by the node, which may change the path from this node on
+    virtual void rerouteCars(std::function<void(Car&)> const& reroute) {
+        for (auto& car : storedCars) {
+            reroute(*car);
+        }
+    }
     virtual void distributeCars() = 0;
     virtual void step(float dt) = 0;
     int getID() const { return id; }
@@ -44,7 +79,9 @@ public:
         return std::sqrt(std::pow(x - other.x, 2) + std::pow(y - other.y, 2));
     }
     std::tuple<float, float> getPosition() const { return std::make_tuple(x, -y); }
-    int getNCars() const { return storedCars.size(); }
+    virtual int getNCars() const { return storedCars.size(); }
+    // Digest of the cars held by the node, in order
+    virtual std::uint64_t computeStateDigest() const;
 };
 
 #endif
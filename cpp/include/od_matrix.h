@@ -0,0 +1,60 @@
+#ifndef TRAFFICJELLY_OD_MATRIX_H
+#define TRAFFICJELLY_OD_MATRIX_H
+
+#include <functional>
+#include <istream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/*
+ * This is a sparse origin-destination matrix of trips per day, stored row-wise (CSR).
+ * Only non-zero pairs are kept, so memory and sampling scale with the number of pairs instead of n^2.
+ * Every row keeps cumulative weights, such that a destination is sampled by binary search.
+ * The gravity model is dense but separable, the weight of a pair is the product of two populations, so it keeps
+ * the cumulative populations instead, O(n) for any number of pairs, and samples a destination from them.
+ * Matrices are made by one of the generators below.
+ */
+class OdMatrix
+{
+private:
+    std::vector<size_t> rowStarts; // n + 1 offsets into destinations, empty for the gravity model
+    std::vector<int> destinations;
+    std::vector<double> cumulativeWeights; // per row, restarting at every origin
+    std::vector<double> cumulativeRowTotals; // over origins, for sampling a whole pair
+    // Of the gravity model only, over the nodes, with their norm, the sum of the products of all pairs
+    std::vector<double> cumulativePopulations;
+    double gravityNorm = 0;
+    double gravityTripsPerDay = 0;
+    size_t nGravityPairs = 0;
+
+    bool isGravity() const { return rowStarts.empty(); }
+    double getPopulation(int node) const;
+
+public:
+    using Entry = std::tuple<int, int, double>; // (origin, destination, trips per day)
+
+    OdMatrix() = default;
+    // Duplicate pairs are summed, zero and negative weights are dropped
+    OdMatrix(int nNodes, std::vector<Entry> entries);
+
+    // The population-product gravity model, scaled to tripsPerDay in total, without a pair within a node
+    static OdMatrix gravity(std::vector<int> const& populations, double tripsPerDay);
+    // The row totals of the gravity model, without building it
+    static std::vector<double> gravityRowTotals(std::vector<int> const& populations, double tripsPerDay);
+    // Reads "origin,destination,trips per day" lines, nodes given by label
+    static OdMatrix load(std::istream& input, int nNodes, std::function<int(std::string const&)> const& toNodeID);
+
+    int getNNodes() const { return (int) cumulativeRowTotals.size(); }
+    size_t getNNonZero() const { return isGravity() ? nGravityPairs : destinations.size(); }
+    size_t getMemoryUsage() const;
+    double getTotal() const { return cumulativeRowTotals.empty() ? 0 : cumulativeRowTotals.back(); }
+    double getRowTotal(int origin) const;
+    double getWeight(int origin, int destination) const;
+
+    // u is uniform in [0, 1)
+    int sampleDestination(int origin, double u) const;
+    std::pair<int, int> samplePair(double u) const;
+};
+
+#endif //TRAFFICJELLY_OD_MATRIX_H
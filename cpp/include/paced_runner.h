@@ -0,0 +1,88 @@
+#ifndef TRAFFICJELLY_PACED_RUNNER_H
+#define TRAFFICJELLY_PACED_RUNNER_H
+
+#include <chrono>
+
+class TrafficModel;
+
+// Since the runner was made or restarted
+struct PaceReport
+{
+    long nSteps;
+    double simulatedTime; // in s of global time
+    double wallTime; // in s, sleeping included
+    double meanStepTime; // in s of wall time per step, everything but sleeping, also the work of the caller
+    double maxStepTime;
+    double stepBudget; // in s of wall time per step at the target speed-up
+    double lag; // in s of global time behind the target after the last step, 0 if on time
+    double maxLag;
+    double slippedTime; // in s of global time given up to catch up with the wall clock, see PacedRunner
+    long nSlips;
+    long nDegradedSteps; // with a decision interval above one
+    int degradation; // after the last step, the decision interval is 2^degradation
+};
+
+/*
+ * This runner steps a TrafficModel in real time, speedUp s of global time per s of wall time, for displays and
+ * hardware in the loop. Every step waits until the state it leaves is due, so a run ahead of its target sleeps.
+ * A run behind its target steps right away and degrades gracefully: once the mean cost of a step exceeds the
+ * budget, the edges that are not high priority decide only every 2, 4, ... steps, see
+ * TrafficModel::setDecisionInterval, and go back to deciding every step once there is room again. When the lag grows
+ * beyond maxLag all the same, the target is moved to the current state instead of stepping at full speed until
+ * the run has caught up, and the time given up is reported as slipped.
+ * Degraded steps are coarser and depend on the wall clock, so a paced run is not reproducible from its seed.
+ */
+class PacedRunner
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    TrafficModel& model;
+    double speedUp;
+    double maxLag; // in s of global time
+    int maxDegradation;
+    int degradation = 0;
+    double stepLength; // in s of global time
+    double meanStepTime = 0; // in s of wall time, moving average over about adaptSteps steps
+    int stepsSinceAdapt = 0;
+    bool started = false;
+    Clock::time_point startWall;
+    Clock::time_point anchorWall; // the wall time at which the global time anchorTime is due
+    double anchorTime = 0;
+    Clock::time_point lastWake; // end of the last sleep, the start of the cost of the next step
+    PaceReport report{};
+
+    // Steps between two changes of the degradation, such that the mean step time reflects the current one
+    static constexpr int adaptSteps = 10;
+    // Degrades when a lagging run uses more than this share of the budget, since it has to catch up as well
+    static constexpr double catchUpShare = 0.8;
+    // Goes back one level below this share of the budget, with room for the cost of deciding twice as often
+    static constexpr double recoverShare = 0.4;
+
+    double getTargetTime(Clock::time_point now) const;
+    void adapt(double lag);
+    void setDegradation(int degradation);
+
+public:
+    static constexpr int defaultMaxDegradation = 3;
+    // Deciding every 256 steps, beyond which the cars would drive blind for too long
+    static constexpr int degradationLimit = 8;
+
+    PacedRunner(TrafficModel& model, double speedUp, double maxLag = 10, int maxDegradation = defaultMaxDegradation);
+    // Back to deciding every step
+    ~PacedRunner();
+    PacedRunner(PacedRunner const&) = delete;
+    PacedRunner& operator=(PacedRunner const&) = delete;
+    // One step of the model, returning when the state it leaves is due
+    void step();
+    // Steps until the global time reaches until
+    PaceReport const& run(double until);
+    // Starts the clock and the report over at the next step, e.g. after a pause, keeping the degradation
+    void restart();
+    void setSpeedUp(double speedUp);
+    double getSpeedUp() const { return speedUp; }
+    int getDegradation() const { return degradation; }
+    PaceReport const& getReport() const { return report; }
+};
+
+#endif //TRAFFICJELLY_PACED_RUNNER_H
@@ -0,0 +1,165 @@
+#ifndef TRAFFICJELLY_PROBE_H
+#define TRAFFICJELLY_PROBE_H
+
+#include <memory>
+#include <vector>
+
+#include "car.h"
+#include "car_pool.h"
+
+class TrafficModel;
+
+// Events a Probe may observe, combined as bits by Probe::getHooks
+struct ProbeHook
+{
+    static constexpr unsigned Spawn = 1u << 0;
+    static constexpr unsigned EdgeEntry = 1u << 1;
+    static constexpr unsigned EdgeExit = 1u << 2;
+    static constexpr unsigned LaneChange = 1u << 3;
+    static constexpr unsigned Arrival = 1u << 4;
+    static constexpr unsigned TickEnd = 1u << 5;
+    static constexpr int count = 6;
+
+    static constexpr int index(unsigned hook) {
+        int i = 0;
+        while ((1u << i) != hook) {
+            i++;
+        }
+        return i;
+    }
+};
+
+/*
+ * This is a probe for custom metrics, compiled into the core and attached to a TrafficModel at runtime.
+ * Only the hooks named by getHooks are called, so a hook no probe uses costs one branch where its event happens.
+ * Car hooks run in the phase of the step the event belongs to, which may be on any worker, so a probe should only
+ * touch the state of that worker there, e.g. a WorkerLocal, and merge it in onTickEnd, which runs on the calling
+ * thread after every step.
+ * Node and edge ids are those of the network file, like in the interface of TrafficModel.
+ * Cars are renumbered by TrafficModel::compactCars, which is skipped while a probe observes cars.
+ */
+class Probe
+{
+public:
+    virtual ~Probe() = default;
+    // Bits of ProbeHook
+    virtual unsigned getHooks() const = 0;
+    // Called when the probe is attached and whenever the number of workers changes, before any hook
+    virtual void setNWorkers(int nWorkers) {}
+    // In the node the car starts from
+    virtual void onSpawn(int worker, Car const& car, int node) {}
+    // Once the car is on the edge, at the start of it
+    virtual void onEdgeEntry(int worker, Car const& car, int edge) {}
+    // Once the out-node of the edge has taken the car. A car the out-node sends back to wait at the end of the edge
+    // exits when it is taken after all, so entries minus exits is the number of cars on the edge.
+    virtual void onEdgeExit(int worker, Car const& car, int edge) {}
+    // Right after the move in which the car left fromLane
+    virtual void onLaneChange(int worker, Car const& car, int edge, int fromLane) {}
+    // Right before the car is recycled, with the stats that were recorded for its trip
+    virtual void onArrival(int worker, Car const& car, int node, TravelStats const& stats) {}
+    virtual void onTickEnd(TrafficModel const& model) {}
+};
+
+/*
+ * A value per worker, each on its own cache lines, such that workers never write to a line another worker reads.
+ */
+template <typename T>
+class WorkerLocal
+{
+private:
+    struct alignas(64) Slot
+    {
+        T value{};
+    };
+    std::vector<Slot> slots;
+
+public:
+    void resize(int nWorkers) { slots.resize(nWorkers); }
+    T& operator[](int worker) { return slots[worker].value; }
+    // Visits the values in worker order, such that merged results do not depend on the scheduling
+    template <typename F>
+    void forEach(F&& f) {
+        for (auto& slot : slots) {
+            f(slot.value);
+        }
+    }
+};
+
+/*
+ * The probes attached to a TrafficModel, grouped by hook. Edges and nodes report their events here, with the ids of
+ * the model, and this passes them on with file ids and the index of the calling worker.
+ */
+class ProbeSet
+{
+private:
+    std::vector<std::shared_ptr<Probe>> probes;
+    std::vector<Probe*> byHook[ProbeHook::count];
+    unsigned hooks = 0; // of all probes
+    int nWorkers = 1;
+    std::vector<int> const* fileNodeIDs = nullptr; // by internal id
+    std::vector<int> const* fileEdgeIDs = nullptr;
+
+    static int currentWorker();
+
+public:
+    void setFileIDs(std::vector<int> const& fileNodeIDs, std::vector<int> const& fileEdgeIDs);
+    void setNWorkers(int nWorkers);
+    void add(std::shared_ptr<Probe> probe);
+    void remove(std::shared_ptr<Probe> const& probe);
+    bool has(unsigned hook) const { return hooks & hook; }
+    // Whether any probe keeps track of cars, whose ids must then stay stable
+    bool observesCars() const { return hooks & ~ProbeHook::TickEnd; }
+
+    void carSpawned(Car const& car, int node) const;
+    void carEnteredEdge(Car const& car, int edge) const;
+    void carExitedEdge(Car const& car, int edge) const;
+    void carChangedLane(Car const& car, int edge, int fromLane) const;
+    void carArrived(Car const& car, int node, TravelStats const& stats) const;
+    void tickEnded(TrafficModel const& model) const;
+};
+
+/*
+ * Counts every car event per node and edge, a probe for monitoring and an example of per-worker accumulation.
+ * Counts are totals since the probe was attached.
+ */
+class EventCounter : public Probe
+{
+private:
+    struct Counts
+    {
+        std::vector<long> edgeEntries;
+        std::vector<long> edgeExits;
+        std::vector<long> laneChanges;
+        std::vector<long> spawns; // by node
+        std::vector<long> arrivals;
+    };
+    int nNodes;
+    int nEdges;
+    WorkerLocal<Counts> local;
+    Counts totals;
+
+    void resize(Counts& counts) const;
+
+public:
+    EventCounter(int nNodes, int nEdges);
+    unsigned getHooks() const override;
+    void setNWorkers(int nWorkers) override;
+    void onSpawn(int worker, Car const& car, int node) override { local[worker].spawns[node]++; }
+    void onEdgeEntry(int worker, Car const& car, int edge) override { local[worker].edgeEntries[edge]++; }
+    void onEdgeExit(int worker, Car const& car, int edge) override { local[worker].edgeExits[edge]++; }
+    void onLaneChange(int worker, Car const& car, int edge, int fromLane) override {
+        local[worker].laneChanges[edge]++;
+    }
+    void onArrival(int worker, Car const& car, int node, TravelStats const& stats) override {
+        local[worker].arrivals[node]++;
+    }
+    void onTickEnd(TrafficModel const& model) override;
+
+    std::vector<long> const& getEdgeEntries() const { return totals.edgeEntries; }
+    std::vector<long> const& getEdgeExits() const { return totals.edgeExits; }
+    std::vector<long> const& getLaneChanges() const { return totals.laneChanges; }
+    std::vector<long> const& getSpawns() const { return totals.spawns; }
+    std::vector<long> const& getArrivals() const { return totals.arrivals; }
+};
+
+#endif //TRAFFICJELLY_PROBE_H
@@ -2,10 +2,51 @@
 #define ROUTE_H
 
 #include "node/node.h"
+#include "worker_pool.h"
+#include <cstdint>
+#include <string>
+#include <tuple>
 #include <vector>
 
-std::vector<std::vector<int>> computeMapping(std::vector<std::shared_ptr<Node>>& nodes);
-std::vector<std::vector<float>> computeProbabilities(std::vector<int> populations);
+// Next-hop mapping with arr[endNodeId][startNodeId] the node after startNodeId on the fastest path, -1 if unreachable.
+// One Dijkstra per source node, spread over the workers. Closed edges are left out.
+std::vector<std::vector<int>> computeMapping(std::vector<std::shared_ptr<Node>>& nodes, WorkerPool& workers);
 std::vector<int> reconstructPath(const std::vector<std::vector<int>>& arr, int startNodeId, int endNodeId);
+void reconstructPath(const std::vector<std::vector<int>>& arr, int startNodeId, int endNodeId, std::vector<int>& path);
+
+/*
+ * This route cache stores the mapping of computeMapping in a file, keyed by a hash of the network and the edge cost,
+ * such that constructing a model of an unchanged network loads the mapping instead of recomputing it.
+ * A file of another network or cost definition is a miss and gets replaced.
+ * By default the file lives next to the network file, setDirectory moves it elsewhere, e.g. out of a read-only or
+ * shared tree, and setEnabled(false) turns caching off.
+ */
+class RouteCache
+{
+private:
+    std::string fn;
+    std::uint64_t key;
+
+public:
+    // Bump when computeMapping changes the cost of an edge or how ties are broken
+    static constexpr std::uint32_t costVersion = 1;
+
+    // An empty fn caches nothing, see getPath
+    RouteCache(std::string fn, std::vector<std::shared_ptr<Node>> const& nodes);
+    // Whether the file holds a mapping for this network, which is then loaded into arr
+    bool load(std::vector<std::vector<int>>& arr) const;
+    // Writes through a temporary file, so concurrent readers never see a partial mapping. Failing to write is ignored.
+    void store(std::vector<std::vector<int>> const& arr) const;
+    std::uint64_t getKey() const { return key; }
+
+    // (hits, misses) of all caches in this process
+    static std::tuple<long, long> getStats();
+    // The cache file of a network file, empty if caching is off. The settings are process wide and apply to the
+    // models built after them.
+    static std::string getPath(std::string const& networkFn);
+    // An empty directory goes back to the directory of the network file
+    static void setDirectory(std::string directory);
+    static void setEnabled(bool enabled);
+};
 
 #endif
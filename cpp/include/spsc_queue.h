@@ -0,0 +1,62 @@
+#ifndef TRAFFICJELLY_SPSC_QUEUE_H
+#define TRAFFICJELLY_SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/*
+ * This is a bounded, lock-free queue for exactly one producer thread and one consumer thread.
+ * Items come out in the order they went in, which keeps car handoffs between edges and nodes deterministic.
+ * The capacity is rounded up to a power of two. Storage is allocated by the first push, so a queue that never
+ * carries an item costs no memory, e.g. on the edges of a cloned model that no car has used since.
+ */
+template <typename T>
+class SpscQueue
+{
+private:
+    std::unique_ptr<T[]> items; // allocated and written by the producer, published to the consumer by tail
+    size_t mask;
+    // Producer and consumer indices live on separate cache lines to avoid false sharing
+    alignas(64) std::atomic<size_t> tail{0}; // next slot to write, owned by the producer
+    alignas(64) std::atomic<size_t> head{0}; // next slot to read, owned by the consumer
+
+public:
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask = size - 1;
+    }
+
+    // Leaves item untouched and returns false if the queue is full
+    bool push(T&& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask) {
+            return false;
+        }
+        if (!items) {
+            items = std::make_unique<T[]>(mask + 1);
+        }
+        items[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(items[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+};
+
+#endif //TRAFFICJELLY_SPSC_QUEUE_H
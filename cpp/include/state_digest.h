@@ -0,0 +1,39 @@
+#ifndef TRAFFICJELLY_STATE_DIGEST_H
+#define TRAFFICJELLY_STATE_DIGEST_H
+
+#include <cstdint>
+#include <cstring>
+
+#include "car.h"
+
+/*
+ * Helpers for the state digests of edges and nodes, used to check that two runs are bit for bit identical.
+ * Values are mixed in a fixed order, so a digest depends on the order of cars as well as their state.
+ */
+struct StateDigest
+{
+    // Finaliser of splitmix64, every input bit affects every output bit
+    static std::uint64_t mix(std::uint64_t value) {
+        value ^= value >> 30;
+        value *= 0xbf58476d1ce4e5b9ULL;
+        value ^= value >> 27;
+        value *= 0x94d049bb133111ebULL;
+        return value ^ (value >> 31);
+    }
+    static std::uint64_t combine(std::uint64_t digest, std::uint64_t value) {
+        return mix(digest + 0x9e3779b97f4a7c15ULL + value);
+    }
+    static std::uint64_t bits(float value) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+    // Pool slots are left out, they depend on the order in which cars were recycled
+    static std::uint64_t ofCar(Car const& car) {
+        std::uint64_t digest = combine(bits(car.getX()), bits(car.getV()));
+        digest = combine(digest, std::uint64_t(car.getLane()) << 32 | std::uint32_t(car.getNRemainingNodes()));
+        return combine(digest, bits(car.getAge()));
+    }
+};
+
+#endif //TRAFFICJELLY_STATE_DIGEST_H
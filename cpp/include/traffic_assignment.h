@@ -0,0 +1,120 @@
+#ifndef TRAFFICJELLY_TRAFFIC_ASSIGNMENT_H
+#define TRAFFICJELLY_TRAFFIC_ASSIGNMENT_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "worker_pool.h"
+
+class TrafficModel;
+
+/*
+ * Routes with their share of the trips, per departure interval and OD pair, for TrafficModel to spawn cars on.
+ * Every departure is counted, also for OD pairs without routes yet, which then take the fastest free flow path.
+ */
+class RouteChoice
+{
+public:
+    struct OdRoutes
+    {
+        int interval;
+        int origin;
+        int destination;
+        std::vector<std::vector<int>> paths;
+        std::vector<double> shares; // summing to one
+        long nDepartures = 0;
+    };
+
+private:
+    double intervalLength; // in s of global time
+    int nNodes;
+    std::unordered_map<std::int64_t, OdRoutes> routes;
+
+public:
+    RouteChoice(double intervalLength, int nNodes) : intervalLength(intervalLength), nNodes(nNodes) {}
+
+    int getInterval(double time) const { return (int) (time / intervalLength); }
+    double getIntervalLength() const { return intervalLength; }
+    // Counts a departure and picks one of the routes by u in [0, 1), returns false if the pair has no routes
+    bool choose(double time, int origin, int destination, double u, std::vector<int>& path);
+    void resetDepartures();
+    std::unordered_map<std::int64_t, OdRoutes>& getRoutes() { return routes; }
+    int getNRoutes() const;
+};
+
+struct AssignmentIteration
+{
+    int iteration;
+    double relativeGap; // (experienced - shortest) / experienced travel time over all departures
+    double meanTravelTime; // in s, of the trips completed within the simulated period
+    long nTrips; // completed
+    int nRoutes; // over all intervals and OD pairs
+    double wallTime; // in s
+};
+
+/*
+ * This traffic assignment searches the dynamic user equilibrium of the demand of a TrafficModel.
+ * Every iteration simulates the period from startTime to endTime on the same model, measures the travel time of
+ * every edge per departure interval and moves a share 1 / (k + 1) of the trips of every interval and OD pair to the
+ * fastest path under those times (method of successive averages). Fastest paths are solved time dependently, once
+ * per interval and origin with departures, and kept as additional routes of the pair, so route sets only grow by
+ * the paths that turn out to be faster.
+ * Each iteration is seeded the same, such that the gap reflects route changes rather than noise in the demand.
+ */
+class TrafficAssignment
+{
+private:
+    // Of one worker, reused for every search
+    struct SearchBuffers
+    {
+        std::vector<std::pair<double, int>> heap; // (arrival time, node)
+        std::vector<double> arrival; // in s of global time, by node
+        std::vector<int> previousEdge; // by node, on the fastest path
+    };
+
+    TrafficModel& model;
+    double startTime;
+    double endTime;
+    unsigned int seed;
+    RouteChoice routeChoice;
+    WorkerPool workers;
+    int iteration = 0;
+    // Network as seen by the path search
+    std::vector<std::vector<int>> outEdges; // edge ids by node
+    std::vector<int> edgeStarts; // node id by edge
+    std::vector<int> edgeEnds;
+    std::vector<float> freeFlowTimes; // in s of global time, by edge
+    // travelTimes[interval][edge] in s of global time, measured in the last iteration
+    std::vector<std::vector<float>> travelTimes;
+
+    void simulate();
+    float getTravelTime(int edge, double time) const;
+    // Experienced travel time of a path for a departure at time, -1 if consecutive nodes are not connected
+    double getPathTime(std::vector<int> const& path, double time) const;
+    // Fastest path and its travel time for every pair, which all depart from origin at time
+    void findFastestPaths(int origin, double time, std::vector<RouteChoice::OdRoutes*> const& pairs,
+                          SearchBuffers& buffers, std::vector<std::vector<int>>& paths,
+                          std::vector<double>& times) const;
+
+public:
+    static constexpr double minShare = 1e-4; // routes below this share are dropped
+
+    TrafficAssignment(TrafficModel& model, double startTime, double endTime, double intervalLength,
+                      unsigned int seed);
+    // Detaches the route choice from the model, which then spawns on free flow paths again
+    ~TrafficAssignment();
+    TrafficAssignment(TrafficAssignment const&) = delete;
+    TrafficAssignment& operator=(TrafficAssignment const&) = delete;
+
+    // Simulates with the current routes, reports their gap and updates them
+    AssignmentIteration iterate();
+    // Iterates until the relative gap drops below targetGap or after maxIterations
+    std::vector<AssignmentIteration> run(int maxIterations, double targetGap);
+    // Measured in the last iteration, in s of global time
+    std::vector<float> getEdgeTravelTimes(int interval) const;
+    int getNIntervals() const { return (int) travelTimes.size(); }
+};
+
+#endif //TRAFFICJELLY_TRAFFIC_ASSIGNMENT_H
@@ -9,16 +9,25 @@
 #include <memory>
 #include <any>
 #include <random>
+#include <stdexcept>
 
 #include "utils.h"
 #include "car.h"
+#include "car_pool.h"
+#include "demand.h"
+#include "od_matrix.h"
+#include "worker_pool.h"
+#include "frame_publisher.h"
+#include "network_snapshot.h"
+#include "probe.h"
+#include "trajectory_recorder.h"
+#include "trip_list.h"
 #include "node/node.h"
 #include "edge/edge.h"
 #include "route.h"
 
-#define TravelStats std::tuple<int, int, float, float>
-
 class TrafficModelBuilder;
+class RouteChoice;
 
 /*
  * This is a traffic model for cars moving on a graph.
@@ -30,7 +39,23 @@ class TrafficModel
 {
 private:
 // Holds all information of the model.
-    std::vector<std::vector<int>> shortestPathMapping;
+    // Declared first, such that it outlives the cars held by nodes and edges.
+    CarPool carPool;
+    std::vector<int> spawnPath; // reused for every spawn to avoid allocating a path per car
+    int carCompactionInterval = 600; // in steps, 0 to never compact
+    int nStepsSinceCompaction = 0;
+    ProbeSet probes;
+    std::unique_ptr<WorkerPool> workers;
+    std::unique_ptr<FramePublisher> framePublisher;
+    std::unique_ptr<TrajectoryRecorder> recorder;
+    // Shared by the clones of a model until one of them changes its network, see updateRoutes
+    std::shared_ptr<std::vector<std::vector<int>> const> shortestPathMapping;
+    bool routesStale = false; // since an edge was closed, opened or changed speed
+    int decisionInterval = 1; // in steps, of the edges that are not high priority
+    double nodeClock = 0; // in s, delta_time per step, see Node::clock
+    RouteChoice* routeChoice = nullptr; // spawned cars take its routes where it has them
+    bool routesFromCache = false;
+    double routingTime = 0; // in s of wall time, to compute or load shortestPathMapping
     float delta_time;
     std::vector<std::shared_ptr<Node>> nodes;
     // Convenient utility for users
@@ -38,74 +63,249 @@ private:
     std::unordered_map<std::string, std::shared_ptr<Edge>> labelToEdge;
     int population;
     std::vector<std::shared_ptr<Edge>> edges;
+    // Nodes and edges are stored and numbered in an order that keeps neighbours close in memory, see renumber.
+    // The ids of the interface are their positions in the network file, which these map to and from.
+    std::vector<int> internalNodeIDs; // by file id
+    std::vector<int> fileNodeIDs; // by internal id
+    std::vector<int> internalEdgeIDs;
+    std::vector<int> fileEdgeIDs;
     float scale;
+    // Car count histograms of all edges in one block, edge i owns [histogramOffsets[i], histogramOffsets[i + 1]).
+    std::vector<int> histogramCounts;
+    std::vector<int> histogramOffsets;
+    DemandSchedule demand;
+    // In trips per day, shared by clones. Until a matrix is loaded it is the gravity model over populations, built
+    // once a destination is sampled from it, see getOdMatrix.
+    mutable std::shared_ptr<OdMatrix const> odMatrix;
+    std::vector<int> populations; // by file id, scaled
+    double tripsPerDay; // of the gravity model
+    std::unique_ptr<TripSchedule> tripList; // instead of the demand, if loaded
+    // Chained over all ticks since enableStateDigest, see getStateDigest
+    bool stateDigestEnabled = false;
+    std::uint64_t stateDigest = 0;
+    std::vector<std::uint64_t> edgeDigests;
+    std::vector<std::uint64_t> nodeDigests;
+    // Only edges and nodes holding cars are stepped. An edge joins when its in-node sends it a car and a node when
+    // a car is spawned in it or an in-edge hands it one, both leave once they are empty at the start of their phase.
+    std::vector<int> activeEdges; // by id
+    std::vector<int> activeNodes;
+    std::vector<char> edgeScheduled; // by id, whether in activeEdges
+    // Edges holding at least splitThreshold cars are stepped after the others, one at a time by every worker,
+    // see Edge::stepSplit. 0 to never split.
+    int splitThreshold = 2000;
+    std::vector<int> splitEdges; // of the current step
+    std::vector<char> nodeScheduled;
+    // Woken within a parallel phase, by worker, added to the active sets after it
+    std::vector<std::vector<int>> wokenEdges;
+    std::vector<std::vector<int>> wokenNodes;
+
+    // Between the ids of the network file and of the model, in place
+    void toInternalPath(std::vector<int>& path) const;
+    void toFilePath(std::vector<int>& path) const;
+    // Sorts the nodes along a Hilbert curve over their positions and the edges by in-node, then out-node
+    void renumber();
+    void spawnCar(int startNodeID, int endNodeID);
+    // Makes every edge and node active, after cars were added or removed outside of step
+    void scheduleAll();
+    void useDefaultDemand();
+    // Reroutes the cars whose remaining path crosses a closed edge, from the next node they decide at
+    void rerouteAroundClosures();
+    // See clone
+    TrafficModel(TrafficModel const& other);
 public:
     std::default_random_engine generator;
     std::uniform_real_distribution<float> distribution;
-    std::vector<std::vector<float>> mappingProbabilities;
     TrafficModel(std::string fn, float delta_time, float scale);
+    TrafficModel& operator=(TrafficModel const&) = delete;
+    // A branch of the model in its current state, to be changed and stepped independently, e.g. for what-if studies.
+    // The routes, OD matrix and trip list file are shared until a branch changes them, the cars, queues, demand
+    // and generators are copied, such that stepping both gives identical results. Probes, the route choice,
+    // recordings and frame streams stay with this model. Only between steps.
+    std::unique_ptr<TrafficModel> clone() const;
+    // Steps every model nSteps times, the models spread over up to one thread per core, e.g. the branches of clone
+    static void stepConcurrently(std::vector<TrafficModel*> const& models, int nSteps);
+    // Network changes, by file id. Routes are replanned at the next step, see updateRoutes.
+    void setEdgeClosed(int idx, bool closed);
+    bool isEdgeClosed(int idx) const { return getEdge(idx).isClosed(); }
+    void setEdgeSpeedLimit(int idx, float speedLimit);
+    // Replans the fastest paths after network changes, for this model only, and sends the cars that would cross a
+    // closed edge around it. Cars that cannot reach their destination any more wait in front of the closure.
+    void updateRoutes();
+    // Edges that are not high priority observe and decide only every nSteps steps, see Edge::setDecisionInterval.
+    // 1 for the full model. Set by PacedRunner when a run falls behind real time.
+    void setDecisionInterval(int nSteps);
+    int getDecisionInterval() const { return decisionInterval; }
+    // High priority edges decide every step whatever the decision interval, e.g. those that are watched
+    void setEdgeHighPriority(int idx, bool highPriority);
+    bool isEdgeHighPriority(int idx) const { return getEdge(idx).isHighPriority(); }
     // Model usage and interpretation
     void spawnCar();
     void step();
     void transferCars();
+    // Edges and nodes are stepped in parallel phases, results do not depend on the thread count
+    void setThreadCount(int nThreads);
+    // Seeds every random generator of the model, such that runs from the same seed give identical results
+    void seed(unsigned int seed);
+    // Starts to chain the state of every edge and node into a digest after each step
+    void enableStateDigest();
+    // Changes at the first tick in which any car or node queue differs from another run
+    std::uint64_t getStateDigest() const { return stateDigest; }
+    std::vector<std::uint64_t> const& getEdgeStateDigests() const { return edgeDigests; }
+    std::vector<std::uint64_t> const& getNodeStateDigests() const { return nodeDigests; }
+    // Observations of all cars on an edge, for external controllers
+    ObservationBatch getEdgeObservations(int idx) const;
+    // Actions the edge's own dynamics choose for its cars, in the order of getEdgeObservations
+    std::vector<int> getEdgeActions(int idx) const;
+    // Actions for the cars of an edge in the next step, instead of the edge's own dynamics, see
+    // Edge::overrideActions
+    void setEdgeActions(int idx, std::vector<int> const& actions);
+    int getThreadCount() const { return workers->size(); }
+    // Edges holding at least nCars cars are split into windows stepped by every worker, with more than one thread.
+    // Results are the same either way. 0 to never split.
+    void setEdgeSplitThreshold(int nCars);
+    int getEdgeSplitThreshold() const { return splitThreshold; }
+    // (edges, nodes) in the active sets, which bound the work of a step
+    std::tuple<int, int> getActiveCounts() const {
+        return std::make_tuple((int) activeEdges.size(), (int) activeNodes.size());
+    }
     void display() const; // Only reasonably used, if small graph
-    // getFirstEdge
+    // By file id, like every node and edge id of this interface. The ids of the edge and its nodes are internal.
     Edge& getEdge(int idx) {
-        return *edges[idx];
+        return *edges[internalEdgeIDs[idx]];
+    }
+    Edge const& getEdge(int idx) const {
+        return *edges[internalEdgeIDs[idx]];
     }
     friend TrafficModelBuilder;
     void setIDs();
+    int getNNodes() const { return nodes.size(); }
+    int getNEdges() const { return edges.size(); }
     std::vector<int> getEdgeIDs();
     std::vector<int> getNodeIDs();
     float getEdgeRoadLength(int idx) {
-        return edges[idx]->getLength();
+        return getEdge(idx).getLength();
     }
     int getEdgeStartNodeID(int idx) {
-        return edges[idx]->getInNode().getID();
+        return fileNodeIDs[getEdge(idx).getInNode().getID()];
     }
     int getEdgeEndNodeID(int idx) {
-        return edges[idx]->getOutNode().getID();
+        return fileNodeIDs[getEdge(idx).getOutNode().getID()];
     }
     std::tuple<float, float> getNodePosition(int idx) {
-        return nodes[idx]->getPosition();
+        return nodes[internalNodeIDs[idx]]->getPosition();
     }
     std::tuple<std::vector<int>, std::vector<float>> getCarCountHistInEdge(int idx, float bin_distance) {
-        return edges[idx]->getCarCountHist(bin_distance);
+        if (!(bin_distance > 0)) {
+            throw std::invalid_argument("Car count histograms need a positive bin distance.");
+        }
+        return getEdge(idx).getCarCountHist(bin_distance);
     }
+    // Registers a car count histogram on every edge, kept up to date while the cars move. Throws
+    // std::invalid_argument unless binDistance is positive.
+    void setHistogramBinDistance(float binDistance);
+    std::vector<int> const& getCarCountHists() const { return histogramCounts; }
+    std::vector<int> const& getCarCountHistOffsets() const { return histogramOffsets; }
+    // Publishes a frame to shared memory every stepsPerFrame steps, with the histograms at the given bin distance.
+    // Registers the histograms if there are none yet, otherwise they must have that bin distance.
+    void startFrameStream(std::string name, float binDistance, int stepsPerFrame, int nSlots, int maxCars);
+    void stopFrameStream() { framePublisher.reset(); }
+    // Records the cars of every following step to a trajectory file, until stopRecording
+    void startRecording(std::string fn, int ticksPerChunk, int maxPendingChunks);
+    void stopRecording() { recorder.reset(); }
     int getCarCountInNode(int idx) {
-        return nodes[idx]->getNCars();
+        return nodes[internalNodeIDs[idx]]->getNCars();
     }
     std::vector<int> getFastestPath(int startNodeID, int endNodeID) {
-        return reconstructPath(shortestPathMapping, startNodeID, endNodeID);
+        updateRoutes();
+        std::vector<int> path = reconstructPath(*shortestPathMapping, internalNodeIDs[startNodeID],
+                                                internalNodeIDs[endNodeID]);
+        toFilePath(path);
+        return path;
     }
     float global_time;
     float getDeltaTime() const { return delta_time; }
+    float getScale() const { return scale; }
+    // Routes for spawned cars instead of the fastest free flow path, see TrafficAssignment
+    void setRouteChoice(RouteChoice* routeChoice) { this->routeChoice = routeChoice; }
 
     void spawnCars();
+    // Removes every car and travel stat and restarts the demand at the given time, keeping the network and routes
+    void clearTraffic(double time);
+    // Populates the empty network with the cars that would be on the road at targetTime, estimated from the demand
+    // and the time to cross every edge (in s of global time, free flow if empty). Starts relaxationTime earlier and
+    // simulates up to targetTime, so that queues and spacing can settle.
+    void warmStart(double targetTime, double relaxationTime, std::vector<float> const& edgeTravelTimes);
+    // Time to cross every edge at the current mean speed of its cars, or at free flow for empty edges
+    std::vector<float> getEdgeTravelTimes() const;
+    // Replaces the default demand by the profiles and streams in the given file
+    void loadDemand(std::string fn);
+    // Replaces the gravity model by the OD pairs in the given file and resets to the default demand over them
+    void loadOdMatrix(std::string fn);
+    size_t getNODPairs() const { return getOdMatrix().getNNonZero(); }
+    OdMatrix const& getOdMatrix() const;
+    // Replaces the demand by the trips in the given file, streamed from disk as their departures come up, see
+    // TripSchedule. Loading a demand or OD matrix afterwards goes back to the stochastic demand.
+    void loadTripList(std::string fn, int nSlots = TripSchedule::defaultNSlots);
+    // (trips released since the last restart, trips read ahead, most trips ever read ahead), zeros without a trip list
+    std::tuple<long, long, long> getTripListStats() const {
+        return tripList ? tripList->getStats() : std::make_tuple(0L, 0L, 0L);
+    }
 
     std::string getLabelFromNodeID(int nodeID) {
-        return nodes[nodeID]->getLabel();
+        return nodes[internalNodeIDs[nodeID]]->getLabel();
     }
 
     std::string getLabelFromEdgeID(int edgeID) {
-        return edges[edgeID]->getLabel();
+        return getEdge(edgeID).getLabel();
+    }
+
+    int getNodeIDFromLabel(std::string const& label) const {
+        return fileNodeIDs[labelToNode.at(label)->getID()];
     }
 
-    int getNCarsInSimulation();
+    int getEdgeIDFromLabel(std::string const& label) const {
+        return fileEdgeIDs[labelToEdge.at(label)->getID()];
+    }
+
+    // Cars acquired and not yet arrived, kept by the car pool
+    int getNCarsInSimulation() const { return carPool.getNCarsInUse(); }
+    NetworkTopology getNetworkTopology() const;
+    // Fills the snapshot with the state after the last step, sizing it on first use
+    void fillNetworkSnapshot(NetworkSnapshot& snapshot) const;
+
+    CarPoolStats getCarPoolStats() const { return carPool.getStats(); }
+    // Moves the cars in the pool into the order of the edges they are on, renumbering them. Not while recording
+    // trajectories or while probes observe cars, which both rely on car ids.
+    void compactCars();
+    bool canCompactCars() const { return !recorder && !probes.observesCars(); }
+    // Compacts the cars every so many steps, whenever that is possible
+    void setCarCompactionInterval(int nSteps) { carCompactionInterval = nSteps; }
+    // Attaches a probe, whose hooks are called from the next event on, see Probe
+    void addProbe(std::shared_ptr<Probe> probe) { probes.add(std::move(probe)); }
+    void removeProbe(std::shared_ptr<Probe> const& probe) { probes.remove(probe); }
+    std::tuple<long, long> getBytesPerCar() const { return carPool.getBytesPerCar(); }
+    // (whether the routes of this model came from the cache, time to get them in s, cache hits and misses of the process)
+    std::tuple<bool, double, long, long> getRoutingStats() const {
+        auto [hits, misses] = RouteCache::getStats();
+        return std::make_tuple(routesFromCache, routingTime, hits, misses);
+    }
 
     std::vector<int> getNCarsPerEdge() {
         std::vector<int> nCarsPerEdge;
         nCarsPerEdge.reserve(edges.size());
-        for (auto& edge : edges) {
-            nCarsPerEdge.push_back(edge->getNCars());
+        for (int i : internalEdgeIDs) {
+            nCarsPerEdge.push_back(edges[i]->getNCars());
         }
         return nCarsPerEdge;
     }
 
+    // Of the trips completed so far, grouped by the node they ended in
     std::vector<TravelStats> getTravelStats() {
         std::vector<TravelStats> travelStats;
-        for (auto& node : nodes) {
-            travelStats.insert(travelStats.end(), node->travelStats.begin(), node->travelStats.end());
+        for (int i : internalNodeIDs) {
+            for (auto const& [from, to, travelTime, startTime] : nodes[i]->travelStats) {
+                travelStats.emplace_back(fileNodeIDs[from], fileNodeIDs[to], travelTime, startTime);
+            }
         }
         return travelStats;
     }
@@ -138,6 +338,13 @@ public:
     void apply(std::vector<std::string>& args) const override;
 };
 
+class IntersectionStringCommand : public StringCommand
+{
+public:
+    IntersectionStringCommand(TrafficModelBuilder &trafficModelBuilder);
+    void apply(std::vector<std::string>& args) const override;
+};
+
 #endif
 
 /*
@@ -156,8 +363,10 @@ public:
     TrafficModelBuilder(TrafficModel& trafficModel);
     void build(std::string file_content);
     void addBasicCity(std::string label, int population, float x, float y);
+    void addIntersection(std::string label, float x, float y, float saturationFlow, int queueCapacity);
     void addBasicRoad(std::string label, std::string inNodeLabel, std::string outNodeLabel, float speedLimit, int nLanes);
 
     friend BasicRoadStringCommand;
     friend BasicCityStringCommand;
+    friend IntersectionStringCommand;
 };
@@ -0,0 +1,51 @@
+#ifndef TRAFFICJELLY_TRAJECTORY_READER_H
+#define TRAFFICJELLY_TRAJECTORY_READER_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "trajectory_recorder.h"
+
+/*
+ * The decoded rows of one chunk, the rows of tick i are [tickOffsets[i], tickOffsets[i + 1]).
+ */
+struct TrajectoryChunk
+{
+    std::vector<double> tickTimes;
+    std::vector<std::int64_t> tickOffsets;
+    std::vector<std::int32_t> ids;
+    std::vector<std::int32_t> edges;
+    std::vector<float> xs;
+    std::vector<float> vs;
+    std::vector<std::int32_t> lanes;
+};
+
+/*
+ * This trajectory reader gives random access to the chunks of a file written by TrajectoryRecorder.
+ * A file without index, because the recording did not finish, is indexed by scanning its chunks.
+ */
+class TrajectoryReader
+{
+private:
+    mutable std::ifstream file;
+    TrajectoryFileHeader header;
+    std::vector<TrajectoryIndexEntry> index;
+
+    void scanChunks();
+
+public:
+    explicit TrajectoryReader(std::string const& fn);
+
+    int getNChunks() const { return index.size(); }
+    int getNEdges() const { return header.nEdges; }
+    float getDeltaTime() const { return header.deltaTime; }
+    std::tuple<double, double> getChunkTimeRange(int idx) const;
+    // Index of the chunk containing the tick at the given time, clamped to the first and last chunk
+    int findChunk(double time) const;
+    TrajectoryChunk readChunk(int idx) const;
+};
+
+#endif //TRAFFICJELLY_TRAJECTORY_READER_H
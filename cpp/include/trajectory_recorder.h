@@ -0,0 +1,189 @@
+#ifndef TRAFFICJELLY_TRAJECTORY_RECORDER_H
+#define TRAFFICJELLY_TRAJECTORY_RECORDER_H
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TrafficModel;
+
+/*
+ * Layout of a trajectory file, read back by TrajectoryReader:
+ *
+ * TrajectoryFileHeader, then chunks of TrajectoryChunkHeader, double tickTimes[nTicks] and the encoded columns,
+ * then TrajectoryIndexEntry[nChunks] and TrajectoryFileFooter.
+ *
+ * A chunk holds consecutive ticks and can be decoded on its own, the rows of a tick are its cars in edge order and
+ * ascending x per lane. Columns are stored one after the other: cars per tick, car id, edge id, x, v and lane, as
+ * zigzag varints of the difference to a prediction from the previous tick of the chunk, see TrajectoryHistory.
+ * x and v are quantised to the resolution in the file header. Car ids are pool slots, reused by later trips.
+ */
+struct TrajectoryFileHeader
+{
+    static constexpr std::uint32_t magicValue = 0x524a5454; // "TTJR"
+    static constexpr std::uint32_t currentVersion = 1;
+
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t nEdges;
+    float deltaTime; // in s, per tick
+    float positionResolution; // in m
+    float speedResolution; // in m/s
+};
+
+struct TrajectoryChunkHeader
+{
+    static constexpr std::uint32_t magicValue = 0x4b4e4843; // "CHNK"
+    static constexpr int nColumns = 6;
+
+    std::uint32_t magic;
+    std::uint32_t nTicks;
+    std::uint64_t nRows;
+    std::uint64_t columnSizes[nColumns]; // in bytes
+};
+
+struct TrajectoryIndexEntry
+{
+    double startTime;
+    double endTime;
+    std::uint64_t offset; // of the chunk header
+    std::uint64_t nRows;
+};
+
+struct TrajectoryFileFooter
+{
+    static constexpr std::uint32_t magicValue = 0x58444e49; // "INDX"
+
+    std::uint64_t indexOffset;
+    std::uint32_t nChunks;
+    std::uint32_t magic;
+};
+
+/*
+ * The quantised state of every car in the previous tick, which the values of a tick are stored relative to.
+ * Rows keep their order between ticks, so the id of a row is predicted to be the id that followed the previous
+ * row one tick earlier. The state of a car is predicted to be unchanged, except that x advances by the current
+ * speed. Cars that were not present in the previous tick are stored as is.
+ */
+struct TrajectoryHistory
+{
+    std::vector<std::uint32_t> lastTick; // tick number in the chunk starting at 1, 0 if not seen
+    std::vector<std::int64_t> edges;
+    std::vector<std::int64_t> xs;
+    std::vector<std::int64_t> vs;
+    std::vector<std::int64_t> lanes;
+    std::vector<std::int32_t> successors; // id of the next row
+    std::int32_t firstID = 0; // of the previous tick
+    double xPerV = 0; // quantised x travelled in one tick per quantised speed
+
+    TrajectoryHistory() = default;
+    explicit TrajectoryHistory(TrajectoryFileHeader const& header)
+        : xPerV(header.deltaTime * header.speedResolution / header.positionResolution) {}
+
+    void reset() {
+        std::fill(lastTick.begin(), lastTick.end(), 0);
+        firstID = 0;
+    }
+    // Whether the car was present in the previous tick
+    bool knows(std::int32_t id, std::uint32_t tick) {
+        if (id >= (std::int32_t) lastTick.size()) {
+            size_t size = std::max<size_t>(id + 1, 2 * lastTick.size());
+            lastTick.resize(size, 0);
+            edges.resize(size);
+            xs.resize(size);
+            vs.resize(size);
+            lanes.resize(size);
+            successors.resize(size);
+        }
+        return lastTick[id] != 0 && lastTick[id] + 1 == tick;
+    }
+    // Prediction for the row after the given car, to be taken before the car is updated
+    std::int32_t predictNextID(std::int32_t id, bool known) const {
+        return known ? successors[id] : id + 1;
+    }
+    std::int64_t predictX(std::int32_t id, std::int64_t v) const {
+        return xs[id] + std::llround(v * xPerV);
+    }
+    void update(std::int32_t id, std::int32_t previousID, std::uint32_t tick, std::int64_t edge, std::int64_t x,
+                std::int64_t v, std::int64_t lane) {
+        if (previousID >= 0) {
+            successors[previousID] = id;
+        } else {
+            firstID = id;
+        }
+        successors[id] = id + 1; // until the next row is known
+        lastTick[id] = tick;
+        edges[id] = edge;
+        xs[id] = x;
+        vs[id] = v;
+        lanes[id] = lane;
+    }
+};
+
+/*
+ * This trajectory recorder writes the car states of every tick to a compressed trajectory file.
+ * The simulation thread only copies the states into the current chunk, full chunks are encoded and
+ * written by a background thread. At most maxPendingChunks chunks wait for the writer, after that
+ * recording blocks the simulation instead of growing without bound.
+ */
+class TrajectoryRecorder
+{
+private:
+    struct Chunk
+    {
+        std::vector<double> tickTimes;
+        std::vector<std::uint32_t> tickRows;
+        std::vector<std::int32_t> ids;
+        std::vector<std::int32_t> edges;
+        std::vector<float> xs;
+        std::vector<float> vs;
+        std::vector<std::int32_t> lanes;
+
+        void clear();
+    };
+
+    std::ofstream file;
+    TrajectoryFileHeader header;
+    int ticksPerChunk;
+    size_t maxPendingChunks;
+    Chunk current;
+    std::deque<Chunk> pending;
+    std::vector<Chunk> spare; // written chunks, reused to avoid reallocating the columns
+    std::vector<TrajectoryIndexEntry> index;
+    std::mutex mutex;
+    std::condition_variable pendingCondition;
+    bool stopping = false;
+    std::uint64_t nBytes = 0;
+    std::uint64_t nTicks = 0;
+    std::thread writer;
+    // Used by the writer only
+    TrajectoryHistory history;
+    std::vector<std::uint8_t> columns[TrajectoryChunkHeader::nColumns];
+
+    void submit();
+    void write();
+    void writeChunk(Chunk const& chunk);
+
+public:
+    static constexpr float positionResolution = 0.01f;
+    static constexpr float speedResolution = 0.01f;
+
+    TrajectoryRecorder(std::string const& fn, int nEdges, float deltaTime, int ticksPerChunk, int maxPendingChunks);
+    // Writes the last chunk and the index
+    ~TrajectoryRecorder();
+    TrajectoryRecorder(TrajectoryRecorder const&) = delete;
+    TrajectoryRecorder& operator=(TrajectoryRecorder const&) = delete;
+
+    // Appends the current state of all cars on edges as one tick
+    void record(TrafficModel& model);
+    std::uint64_t getNTicks() const { return nTicks; }
+};
+
+#endif //TRAFFICJELLY_TRAJECTORY_RECORDER_H
@@ -0,0 +1,120 @@
+#ifndef TRAFFICJELLY_TRIP_LIST_H
+#define TRAFFICJELLY_TRIP_LIST_H
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+struct ScheduledTrip
+{
+    double departure; // in s of global time
+    int origin;
+    int destination;
+};
+
+/*
+ * Reads a trip list file one trip at a time, such that a list of any length is never held in memory.
+ * Lines are "origin,destination,departure", nodes given by label and the departure in s after midnight of the first
+ * day. Trips must be sorted by departure. Blank lines and lines starting with # are skipped.
+ */
+class TripReader
+{
+private:
+    std::string fn;
+    mutable std::ifstream file; // for tellg when copying
+    std::function<int(std::string const&)> toNodeID;
+    std::string line;
+    std::string origin; // reused by every line
+    std::string destination;
+    long lineNumber = 0;
+    double lastDeparture = 0;
+
+public:
+    TripReader(std::string fn, std::function<int(std::string const&)> toNodeID);
+    // Another reader of the same list, at the same trip, with toNodeID instead of that of other
+    TripReader(TripReader const& other, std::function<int(std::string const&)> toNodeID);
+    // Back to the first trip
+    void rewind();
+    // Another reader of the same list, at its first trip
+    TripReader reopen() const { return TripReader(fn, toNodeID); }
+    // Returns false at the end of the list. Throws on a malformed line or a trip out of departure order.
+    bool next(ScheduledTrip& trip);
+};
+
+/*
+ * This trip schedule streams a trip list from disk and releases every trip in the tick of its departure, like
+ * DemandSchedule does for its arrivals. Trips are read ahead into a timing wheel of nSlots slots of slotLength each,
+ * slot k % nSlots holding the trips departing in [k, k + 1) * slotLength. Since the list is sorted, reading stops at
+ * the first trip beyond the wheel, so only the trips of the next nSlots slots are in memory at any time.
+ * Only origin and destination are kept, the route is looked up when a trip is released.
+ */
+class TripSchedule
+{
+private:
+    TripReader reader;
+    double slotLength; // in s of global time, one tick
+    std::vector<std::vector<ScheduledTrip>> slots;
+    long currentSlot = 0; // absolute, the first slot that may hold trips
+    ScheduledTrip ahead; // the next trip of the file, beyond the wheel
+    bool hasAhead = false;
+    long nReleased = 0;
+    long nPending = 0; // in the wheel
+    long maxPending = 0;
+
+    long slotOf(double time) const { return (long) std::floor(time / slotLength); }
+    // Moves the trips of the file into the wheel, up to its last slot
+    void fill();
+
+public:
+    static constexpr int defaultNSlots = 256;
+
+    TripSchedule(std::string fn, double slotLength, int nSlots, std::function<int(std::string const&)> toNodeID);
+    // The same schedule, reading on from the same trip of the list
+    TripSchedule(TripSchedule const& other, std::function<int(std::string const&)> toNodeID);
+    // Empties the wheel and restarts the list at the first trip departing at or after time
+    void start(double time);
+    // (trips released since start, trips in the wheel, most trips ever in the wheel)
+    std::tuple<long, long, long> getStats() const { return std::make_tuple(nReleased, nPending, maxPending); }
+
+    // Calls spawn(origin, destination) for every trip departing before until, in departure order
+    template <typename F>
+    void release(double until, F&& spawn) {
+        // A trip departing at or after until is in the slot of until or later, since division and floor are monotonic
+        long lastSlot = slotOf(until);
+        while (true) {
+            fill();
+            auto& slot = slots[currentSlot % slots.size()];
+            size_t n = 0;
+            while (n < slot.size() && slot[n].departure < until) {
+                spawn(slot[n].origin, slot[n].destination);
+                n++;
+            }
+            slot.erase(slot.begin(), slot.begin() + n);
+            nReleased += n;
+            nPending -= n;
+            if (currentSlot >= lastSlot) {
+                break;
+            }
+            currentSlot++;
+        }
+    }
+
+    // Calls visit(origin, destination, departure) for every trip departing in [from, to), reading the file
+    // separately, such that the schedule itself is left untouched
+    template <typename F>
+    void sample(double from, double to, F&& visit) const {
+        TripReader list = reader.reopen();
+        ScheduledTrip trip;
+        while (list.next(trip) && trip.departure < to) {
+            if (trip.departure >= from) {
+                visit(trip.origin, trip.destination, trip.departure);
+            }
+        }
+    }
+};
+
+#endif //TRAFFICJELLY_TRIP_LIST_H
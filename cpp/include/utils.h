@@ -13,5 +13,18 @@ using optional_const_reference = std::optional<std::reference_wrapper<T const>>;
 class Car;
 class Node;
 class Edge;
+class CarPool;
+
+/*
+ * Deleter that hands a car back to the pool it was acquired from.
+ * Cars without a pool are deleted normally.
+ */
+struct CarRecycler
+{
+    CarPool* pool = nullptr;
+    void operator()(Car* car) const;
+};
+
+using CarPtr = std::unique_ptr<Car, CarRecycler>;
 
 #endif
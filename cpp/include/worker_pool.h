@@ -0,0 +1,60 @@
+#ifndef TRAFFICJELLY_WORKER_POOL_H
+#define TRAFFICJELLY_WORKER_POOL_H
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * This worker pool runs the phases of a simulation step on a fixed set of threads.
+ * Work is split into one contiguous range per worker, so the same element is always handled by the same worker
+ * and per-worker results can be merged in a fixed order.
+ * The calling thread takes part as worker 0, a pool of one thread runs everything inline.
+ */
+class WorkerPool
+{
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable startCondition;
+    std::condition_variable doneCondition;
+    std::function<void(int)> const* task = nullptr;
+    long generation = 0;
+    int nBusy = 0;
+    bool stopping = false;
+    std::vector<std::exception_ptr> errors; // by worker, of the current run
+
+    void work(int worker);
+
+public:
+    explicit WorkerPool(int nThreads = 1);
+    ~WorkerPool();
+    WorkerPool(WorkerPool const&) = delete;
+    WorkerPool& operator=(WorkerPool const&) = delete;
+
+    int size() const { return (int) threads.size() + 1; }
+    // Index of the worker running on this thread, or -1 outside of run
+    static int currentWorker();
+
+    // Runs f(worker) on every worker and returns once all are done. If any of them throws, the others still finish
+    // and the exception of the lowest such worker is rethrown.
+    void run(std::function<void(int)> const& f);
+
+    // Calls f(worker, begin, end) with one contiguous part of [0, n) per worker
+    template <typename F>
+    void parallelFor(int n, F&& f) {
+        if (threads.empty()) {
+            run([&](int worker) { f(worker, 0, n); });
+            return;
+        }
+        int nWorkers = size();
+        run([&](int worker) {
+            f(worker, (int) ((long) n * worker / nWorkers), (int) ((long) n * (worker + 1) / nWorkers));
+        });
+    }
+};
+
+#endif //TRAFFICJELLY_WORKER_POOL_H
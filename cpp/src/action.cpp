@@ -1,38 +0,0 @@
-#include "action.h"
-#include "car.h"
-#include <memory>
-
-Action::Action() = default;
-
-void CruiseAction::apply(Car& ego, float dt) {
-    float target = ego.getTarget();
-    if (ego.getV() < target) {
-        ego.accelerate(dt);
-    } else if (ego.getV() > target) {
-        ego.softBrake(dt);
-    }
-}
-
-void HardBrakeAction::apply(Car& ego, float dt) {
-    ego.hardBrake(dt);
-}
-
-void ToLeftLaneAction::apply(Car& ego, float dt) {
-    ego.toLeftLane();
-}
-
-void ToRightLaneAction::apply(Car& ego, float dt) {
-    ego.toRightLane();
-}
-
-void CompositeAction::apply(Car& ego, float dt) {
-    for (auto &action : actions) {
-        action->apply(ego, dt);
-    }
-}
-
-CompositeAction::CompositeAction(std::vector<std::unique_ptr<Action>> actions) {
-    this->actions = std::move(actions);
-}
-
-
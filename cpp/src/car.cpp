@@ -1,69 +1,24 @@
 #include "car.h"
+#include <algorithm>
 #include <random>
 
 
-std::default_random_engine Car::generator(time(0));
-std::normal_distribution<double> Car::normalDistribution(0, 3);
-
-
-Car::Car(std::vector<int> path, float global_time, float scale) :
-    path(path), global_time(global_time), scale(scale)
-{
-    fromNodeID = path[0];
-    toNodeID = path[path.size() - 1];
-    v = 20;
-    // offset random number between -5 and 5
-    offset = (float) (normalDistribution(generator));
-    if (offset < -5) {
-        offset = -5;
-    } else if (offset > 5) {
-        offset = 5;
-    }
-    lane = 0;
-}
-
-void Car::step(float dt)
-{
-    if (action != nullptr) {
-        action->apply(*this, dt);
-    }
-    x += v * dt;
-    age += dt / scale;
-}
-
-void Car::accelerate(float dt)
+Car::Car(int nPathNodes, float offset)
 {
-    v += 2 * dt;
+    reset(nPathNodes, offset);
 }
 
-void Car::softBrake(float dt)
+void Car::reset(int nPathNodes, float offset)
 {
-    v -= 2 * dt;
-    if (v < 0) {
-        v = 0;
-    }
-}
-
-void Car::hardBrake(float dt)
-{
-    v -= 10 * dt;
-    if (v < 0) {
-        v = 0;
-    }
-}
-
-void Car::toLeftLane()
-{
-    lane++;
-}
-
-void Car::toRightLane()
-{
-    lane--;
-}
-
-void Car::updateAction(const Observation &observation) {
-    action = dynamics.getAction(observation, *this);
+    nRemainingNodes = (std::uint16_t) nPathNodes;
+    x = 0;
+    baseTarget = 0;
+    age = 0;
+    action = ActionCode::None;
+    v = 20;
+    // offset between -5 and 5
+    this->offset = std::clamp(offset, -5.0f, 5.0f);
+    lane = 0;
 }
 
 //std::shared_ptr<Checkpoint> Car::nextCheckpoint()
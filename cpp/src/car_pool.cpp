@@ -0,0 +1,136 @@
+#include "car_pool.h"
+#include "worker_pool.h"
+
+#include <stdexcept>
+
+CarPool::CarPool(CarPool const& other)
+    : slots(other.slots), trips(other.trips), workerCaches(other.workerCaches.size()), nAllocated(other.nAllocated),
+      nReused(other.nReused), nReleased(other.nReleased), scale(other.scale), generator(other.generator),
+      offsetDistribution(other.offsetDistribution)
+{
+    for (Car* car : other.freeCars) {
+        freeCars.push_back(&slots[car->id]);
+    }
+    for (auto const& cache : other.workerCaches) {
+        if (!cache.empty()) {
+            throw std::logic_error("A car pool can only be copied without cars in the worker caches.");
+        }
+    }
+}
+
+void CarPool::seed(unsigned int seed)
+{
+    generator.seed(seed);
+    offsetDistribution.reset();
+}
+
+void CarRecycler::operator()(Car* car) const
+{
+    if (pool != nullptr) {
+        pool->release(car);
+    } else {
+        delete car;
+    }
+}
+
+CarPtr CarPool::acquire(std::vector<int> const& path, float global_time)
+{
+    if (path.size() > UINT16_MAX) {
+        throw std::length_error("A path may have at most 65535 nodes.");
+    }
+    Car* car;
+    if (!freeCars.empty()) {
+        car = freeCars.back();
+        freeCars.pop_back();
+        car->reset((int) path.size(), (float) offsetDistribution(generator));
+        nReused++;
+    } else {
+        car = &slots.emplace_back((int) path.size(), (float) offsetDistribution(generator));
+        car->id = (int) slots.size() - 1;
+        trips.emplace_back();
+        nAllocated++;
+    }
+    CarTrip& trip = trips[car->id];
+    trip.path.assign(path.begin(), path.end());
+    trip.startTime = global_time;
+    return CarPtr(car, CarRecycler{this});
+}
+
+void CarPool::release(Car* car)
+{
+    int worker = WorkerPool::currentWorker();
+    if (worker >= 0 && worker < (int) workerCaches.size()) {
+        workerCaches[worker].push_back(car);
+        return;
+    }
+    freeCars.push_back(car);
+    nReleased++;
+}
+
+void CarPool::flushCaches()
+{
+    for (auto& cache : workerCaches) {
+        freeCars.insert(freeCars.end(), cache.begin(), cache.end());
+        nReleased += cache.size();
+        cache.clear();
+    }
+}
+
+void CarPool::compact(std::vector<CarPtr*> const& handles)
+{
+    if ((int) handles.size() != getNCarsInUse()) {
+        throw std::logic_error("Every car in use has to be compacted.");
+    }
+    // Free slots go after the cars in use, keeping their path capacity, and are handed out lowest first
+    std::vector<Car*> order;
+    order.reserve(slots.size());
+    for (CarPtr* handle : handles) {
+        order.push_back(handle->release());
+    }
+    order.insert(order.end(), freeCars.begin(), freeCars.end());
+    std::deque<Car> compactSlots;
+    std::deque<CarTrip> compactTrips;
+    for (Car* car : order) {
+        compactTrips.push_back(std::move(trips[car->id]));
+        compactSlots.push_back(*car);
+        compactSlots.back().id = (int) compactSlots.size() - 1;
+    }
+    slots.swap(compactSlots);
+    trips.swap(compactTrips);
+    for (size_t i = 0; i < handles.size(); ++i) {
+        *handles[i] = CarPtr(&slots[i], CarRecycler{this});
+    }
+    freeCars.clear();
+    for (size_t i = slots.size(); i > handles.size(); --i) {
+        freeCars.push_back(&slots[i - 1]);
+    }
+}
+
+void CarPool::reroute(Car& car, std::vector<int> const& path)
+{
+    auto& tripPath = trips[car.id].path;
+    int heading = (int) tripPath.size() - car.nRemainingNodes;
+    int start = heading;
+    if (heading > 0 && tripPath[heading - 1] == path.front()) {
+        start = heading - 1;
+    } else if (car.nRemainingNodes == 0 || tripPath[heading] != path.front()) {
+        throw std::logic_error("A car can only be rerouted from the node it is heading to or passed last.");
+    }
+    if (start + path.size() > UINT16_MAX) {
+        throw std::length_error("A path may have at most 65535 nodes.");
+    }
+    tripPath.resize(start);
+    tripPath.insert(tripPath.end(), path.begin(), path.end());
+    // A passed node stays passed
+    car.nRemainingNodes = (std::uint16_t) (path.size() - (heading - start));
+}
+
+std::tuple<long, long> CarPool::getBytesPerCar() const
+{
+    long pathBytes = 0;
+    for (auto const& trip : trips) {
+        pathBytes += trip.path.capacity() * sizeof(int);
+    }
+    long nSlots = std::max<long>(1, (long) trips.size());
+    return std::make_tuple((long) sizeof(Car), (long) sizeof(CarTrip) + pathBytes / nSlots);
+}
@@ -0,0 +1,110 @@
+#include "demand.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+DemandProfile::DemandProfile(std::vector<double> starts, std::vector<double> multipliers)
+    : starts(std::move(starts)), multipliers(std::move(multipliers))
+{
+    if (this->starts.empty() || this->starts[0] != 0 || this->starts.size() != this->multipliers.size()) {
+        throw std::invalid_argument("A demand profile needs one multiplier per segment, starting at midnight.");
+    }
+}
+
+DemandProfile DemandProfile::rushHours()
+{
+    return {{0, 7 * 3600, 9 * 3600, 17 * 3600, 19 * 3600}, {0, 6, 0, 6, 0}};
+}
+
+double DemandProfile::multiplierAt(double time) const
+{
+    double timeOfDay = std::fmod(time, secondsPerDay);
+    int segment = (int) (std::upper_bound(starts.begin(), starts.end(), timeOfDay) - starts.begin()) - 1;
+    return multipliers[segment];
+}
+
+double DemandProfile::getDailyMultiplier() const
+{
+    double sum = 0;
+    for (size_t i = 0; i < starts.size(); ++i) {
+        double end = i + 1 < starts.size() ? starts[i + 1] : secondsPerDay;
+        sum += multipliers[i] * (end - starts[i]);
+    }
+    return sum;
+}
+
+double DemandProfile::invert(double time, double rate, double area) const
+{
+    double daily = rate * getDailyMultiplier();
+    if (daily <= 0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    // Skip whole days at once, then walk the segments
+    double days = std::floor(area / daily);
+    time += days * secondsPerDay;
+    area -= days * daily;
+
+    double dayStart = std::floor(time / secondsPerDay) * secondsPerDay;
+    int segment = (int) (std::upper_bound(starts.begin(), starts.end(), time - dayStart) - starts.begin()) - 1;
+    while (true) {
+        double end = dayStart + (segment + 1 < (int) starts.size() ? starts[segment + 1] : secondsPerDay);
+        double segmentRate = rate * multipliers[segment];
+        double segmentArea = segmentRate * (end - time);
+        if (segmentRate > 0 && segmentArea >= area) {
+            return time + area / segmentRate;
+        }
+        area -= segmentArea;
+        time = end;
+        if (++segment == (int) starts.size()) {
+            segment = 0;
+            dayStart += secondsPerDay;
+        }
+    }
+}
+
+int DemandSchedule::addProfile(std::string const& label, DemandProfile profile)
+{
+    profiles.push_back(std::move(profile));
+    labelToProfile[label] = (int) profiles.size() - 1;
+    return (int) profiles.size() - 1;
+}
+
+void DemandSchedule::addStream(int origin, int destination, double rate, int profile, unsigned int seed)
+{
+    streams.push_back({origin, destination, rate, profile, std::mt19937(seed)});
+}
+
+void DemandSchedule::scheduleNext(int stream, double time)
+{
+    DemandStream& s = streams[stream];
+    // Exponentially distributed area under the rate curve until the next arrival
+    double area = std::exponential_distribution<double>(1.0)(s.rng);
+    double next = profiles[s.profile].invert(time, s.rate, area);
+    if (std::isfinite(next)) {
+        arrivals.emplace(next, stream);
+    }
+}
+
+void DemandSchedule::start(double time)
+{
+    arrivals = {};
+    for (int i = 0; i < (int) streams.size(); ++i) {
+        scheduleNext(i, time);
+    }
+}
+
+void DemandSchedule::seed(unsigned int seed, double time)
+{
+    for (int i = 0; i < (int) streams.size(); ++i) {
+        std::seed_seq sequence{seed, (unsigned int) i};
+        streams[i].rng.seed(sequence);
+    }
+    start(time);
+}
+
+double DemandSchedule::getNextArrival() const
+{
+    return arrivals.empty() ? std::numeric_limits<double>::infinity() : arrivals.top().first;
+}
@@ -5,47 +5,27 @@
 #include "edge/basic_road/basic_road.h"
 
 #include <utility>
-#include "edge/basic_road/basic_road_observation.h"
 #include "car.h"
-#include "algorithm"
 #include "node/node.h"
 
 BasicRoad::BasicRoad(Node& inNode, Node& outNode, std::string label, float speedLimit, int nLanes)
-        : Edge(inNode, outNode, std::move(label), speedLimit),  nLanes(nLanes)
+        : PolicyRoad(inNode, outNode, std::move(label), speedLimit, nLanes)
 {
 
 }
 
-void BasicRoad::setActions()
+std::shared_ptr<Edge> BasicRoad::clone(Node& inNode, Node& outNode, CarPool& pool) const
 {
-    float margin = 200;  // update to be relative to speed (or don't)
-    for (auto base_car = cars.begin(); base_car != cars.end(); ++base_car) {
-        // Collect cars in front and in back
-        std::vector<std::reference_wrapper<Car>> nearby_cars;
-        // Forward
-        auto forward_car = base_car;
-        for (auto car = forward_car++; car != cars.end(); ++car) {
-            if ((*car)->getX() - (*base_car)->getX() > margin) {
-                break;
-            }
-            nearby_cars.push_back(std::ref(**car));
-        }
-        // Backward
-        auto backward_car = base_car;
-        for (auto car = backward_car--; car != cars.begin(); --car) {
-            if ((*car)->getX() - (*base_car)->getX() < -margin) {
-                break;
-            }
-            nearby_cars.push_back(std::ref(**car));
-        }
-        Observation obs = {nearby_cars, *base_car, nLanes};
-        (*base_car)->updateAction(obs);
-    }
-
+    auto road = std::make_shared<BasicRoad>(inNode, outNode, label, speedLimit, nLanes);
+    copyStateTo(*road, pool);
+    return road;
 }
 
-void BasicRoad::enterCar(std::unique_ptr<Car>&& car)
+void BasicRoad::enterCar(CarPtr&& car)
 {
-    car->syncCarToEdge(speedLimit);
-    cars.push_front(std::move(car));
+    car->syncCarToEdge(speedLimit, nLanes);
+    if (histogram.isAttached()) {
+        histogram.add(car->getX());
+    }
+    cars.insert(std::move(car));
 }
@@ -0,0 +1,16 @@
+#include "edge/car_count_histogram.h"
+
+#include <cmath>
+
+int CarCountHistogram::countBins(float length, float binDistance)
+{
+    // Matches the bins of Edge::getCarCountHist: one bin is started for every multiple of binDistance below length.
+    return (int) std::ceil(length / binDistance);
+}
+
+void CarCountHistogram::attach(int* counts, int nBins, float binDistance)
+{
+    this->counts = counts;
+    this->nBins = nBins;
+    this->binDistance = binDistance;
+}
@@ -1,15 +1,21 @@
 #include "edge/edge.h"
 #include "node/node.h"
+#include "state_digest.h"
+#include "worker_pool.h"
 
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
 
-Edge::Edge(Node& inNode, Node& outNode, std::string label, float speedLimit)
-    : inNode(inNode), outNode(outNode), label(std::move(label)), speedLimit(speedLimit)
+Edge::Edge(Node& inNode, Node& outNode, std::string label, float speedLimit, int nLanes)
+    : cars(nLanes), speedLimit(speedLimit), nLanes(nLanes), inNode(inNode), label(std::move(label)),
+      inbox(handoffCapacity), outbox(handoffCapacity), outNode(outNode)
 {
     inNode.outEdges.emplace_back(*this);
     outNode.inEdges.emplace_back(*this);
     length = inNode.distanceTo(outNode);
     id = -1;
+    entrySpace.assign(nLanes, 1);
 }
 
 Edge::~Edge()
@@ -23,51 +29,184 @@ std::string Edge::getLabel() const
 }
 
 void Edge::sortCars() {
-    // We sort cars by iterating over them, and if the order is wrong, we swap them.
-    // After a swap, we keep going with the car with the least distance,
-    // because it may have been overtaken twice (or more).
-    // Since we only have local changes, we can do this in O(n),
-    // with practically zero memory cost.
-    for (auto it = cars.begin(); it != cars.end() && std::next(it) != cars.end(); ) {
-        auto next = std::next(it);
-        if (it->get()->getX() > next->get()->getX()) {
-            std::iter_swap(it, next);
-            // Step back to re-check, unless we're at the beginning
-            if (it != cars.begin()) {
-                it = std::prev(it);
-                continue;
+    // Cars only move a little per step, so this costs a single pass plus the actual overtakes and lane changes.
+    cars.resort();
+}
+
+
+void Edge::updateCars(float dt)
+{
+    // Counters for snapshots are kept in the same pass, while the cars are in cache anyway
+    float speedSum = 0;
+    int nQueued = 0;
+    if (probes != nullptr && probes->has(ProbeHook::LaneChange)) {
+        cars.forEach([this, dt, &speedSum, &nQueued](Car& car) {
+            float x = car.getX();
+            int lane = car.getLane();
+            car.step(dt);
+            if (histogram.isAttached()) {
+                histogram.move(x, car.getX());
+            }
+            if (car.getLane() != lane) {
+                probes->carChangedLane(car, id, lane);
             }
+            speedSum += car.getV();
+            nQueued += car.getV() < queueSpeed;
+        });
+    } else if (!histogram.isAttached()) {
+        cars.forEach([dt, &speedSum, &nQueued](Car& car) {
+            car.step(dt);
+            speedSum += car.getV();
+            nQueued += car.getV() < queueSpeed;
+        });
+    } else {
+        cars.forEach([this, dt, &speedSum, &nQueued](Car& car) {
+            float x = car.getX();
+            car.step(dt);
+            histogram.move(x, car.getX());
+            speedSum += car.getV();
+            nQueued += car.getV() < queueSpeed;
+        });
+    }
+    meanSpeed = cars.size() > 0 ? speedSum / cars.size() : 0;
+    nQueuedCars = nQueued;
+}
+
+int Edge::splitIntoWindows(int nWindows)
+{
+    nWindows = std::max(1, std::min(nWindows, cars.size()));
+    windowStarts.assign((nWindows + 1) * nLanes, 0);
+    laneOffsets.resize(nLanes);
+    int offset = 0;
+    int fullest = 0;
+    for (int l = 0; l < nLanes; ++l) {
+        int n = (int) cars.getLane(l).size();
+        laneOffsets[l] = offset;
+        offset += n;
+        windowStarts[nWindows * nLanes + l] = n;
+        if (n > (int) cars.getLane(fullest).size()) {
+            fullest = l;
+        }
+    }
+    // Bounds at the quantiles of the fullest lane, such that a jam is split as evenly as free flow
+    auto const& reference = cars.getLane(fullest);
+    for (int w = 1; w < nWindows; ++w) {
+        float bound = reference[reference.size() * w / nWindows]->getX();
+        for (int l = 0; l < nLanes; ++l) {
+            auto const& lane = cars.getLane(l);
+            auto start = std::lower_bound(lane.begin(), lane.end(), bound, [](CarPtr const& car, float x) {
+                return car->getX() < x;
+            });
+            windowStarts[w * nLanes + l] = (int) (start - lane.begin());
         }
-        it = next;
     }
+    return nWindows;
 }
 
+void Edge::applyWindowActions(int window)
+{
+    for (int l = 0; l < nLanes; ++l) {
+        auto& lane = cars.getLane(l);
+        for (int j = windowStarts[window * nLanes + l]; j < windowStarts[(window + 1) * nLanes + l]; ++j) {
+            lane[j]->setAction(batch.actions[laneOffsets[l] + j]);
+        }
+    }
+}
 
-void Edge::updateCars(float dt)
+void Edge::updateWindow(float dt, int window)
 {
-    for (auto& car : cars)
-    {
-        car->step(dt);
+    bool observed = probes != nullptr && probes->has(ProbeHook::LaneChange);
+    bool counted = histogram.isAttached();
+    for (int l = 0; l < nLanes; ++l) {
+        auto& lane = cars.getLane(l);
+        for (int j = windowStarts[window * nLanes + l]; j < windowStarts[(window + 1) * nLanes + l]; ++j) {
+            Car& car = *lane[j];
+            if (counted) {
+                previousX[laneOffsets[l] + j] = car.getX();
+            }
+            car.step(dt);
+            if (observed && car.getLane() != l) {
+                probes->carChangedLane(car, id, l);
+            }
+        }
     }
 }
 
-std::vector<std::unique_ptr<Car>> Edge::getExitingCars() {
-    std::vector<std::unique_ptr<Car>> exiting_cars;
-    // Loop from back to front
-    int cars_removed = 0;
-    for (auto car = cars.rbegin(); car != cars.rend(); ++car) {
-        if ((*car)->getX() > length) {
-            exiting_cars.push_back(std::move(*car));
-            cars_removed++;
+void Edge::stepSplit(float dt, WorkerPool& workers)
+{
+    int nWindows = splitIntoWindows(workers.size());
+    if (isDecisionStep()) {
+        batch.resize(cars.size());
+        workers.run([this, nWindows](int worker) {
+            if (worker < nWindows) {
+                decideWindow(worker);
+            }
+        });
+    }
+    // A window observes cars of its neighbours, so no car moves before every window has decided
+    if (histogram.isAttached()) {
+        previousX.resize(cars.size());
+    }
+    workers.run([this, dt, nWindows](int worker) {
+        if (worker < nWindows) {
+            updateWindow(dt, worker);
+        }
+    });
+    // The counters of updateCars, summed in its order
+    float speedSum = 0;
+    int nQueued = 0;
+    size_t i = 0;
+    cars.forEach([&](Car const& car) {
+        if (histogram.isAttached()) {
+            histogram.move(previousX[i++], car.getX());
         }
-        else {
-            break;
+        speedSum += car.getV();
+        nQueued += car.getV() < queueSpeed;
+    });
+    meanSpeed = cars.size() > 0 ? speedSum / cars.size() : 0;
+    nQueuedCars = nQueued;
+    sortCars();
+}
+
+void Edge::receiveCars() {
+    CarPtr car;
+    bool observed = probes != nullptr && probes->has(ProbeHook::EdgeEntry);
+    while (inbox.pop(car)) {
+        Car const* entered = car.get();
+        enterCar(std::move(car));
+        if (observed) {
+            probes->carEnteredEdge(*entered, id);
         }
     }
-    for (int i = 0; i < cars_removed; ++i) {
-        cars.pop_back();
+}
+
+void Edge::publishExitingCars() {
+    cars.popBeyond(length, exitingCars);
+    for (auto& car : exitingCars) {
+        if (histogram.isAttached()) {
+            histogram.remove(car->getX());
+        }
+        if (!outbox.push(std::move(car))) {
+            // The out-node is behind, so the car waits at the end of the edge
+            holdCarAtEnd(std::move(car));
+        }
+    }
+    exitingCars.clear();
+}
+
+void Edge::countExit(Car const& car)
+{
+    nExitedCars++;
+    if (probes != nullptr && probes->has(ProbeHook::EdgeExit)) {
+        probes->carExitedEdge(car, id);
+    }
+}
+
+void Edge::getExitingCars(std::vector<CarPtr>& exiting_cars) {
+    CarPtr car;
+    while (outbox.pop(car)) {
+        exiting_cars.push_back(std::move(car));
     }
-    return exiting_cars;
 }
 
 std::tuple<std::vector<int>, std::vector<float>> Edge::getCarCountHist(float bin_distance) const
@@ -75,11 +214,12 @@ std::tuple<std::vector<int>, std::vector<float>> Edge::getCarCountHist(float bin
     std::vector<int> counts;
     std::vector<float> bins;
     float distance = 0;
-    auto car = cars.begin();
+    auto const& order = cars.getOrder();
+    auto car = order.begin();
     int count = 0;
     while (distance < length) {
         bins.push_back(distance);
-        while (car != cars.end() && (*car)->getX() < distance + bin_distance) {
+        while (car != order.end() && (*car)->getX() < distance + bin_distance) {
             count++;
             car++;
         }
@@ -90,3 +230,156 @@ std::tuple<std::vector<int>, std::vector<float>> Edge::getCarCountHist(float bin
     bins.push_back(length);
     return std::make_tuple(counts, bins);
 }
+
+void Edge::placeCar(CarPtr&& car, float x, int lane, float v)
+{
+    car->syncCarToEdge(speedLimit, nLanes);
+    car->placeAt(x, std::min(lane, nLanes - 1), v);
+    if (histogram.isAttached()) {
+        histogram.add(car->getX());
+    }
+    cars.insert(std::move(car));
+}
+
+float Edge::findFreePosition(int lane, float x, float gap) const
+{
+    auto const& laneCars = cars.getLane(lane);
+    // The first car ahead of x, the spot moves back behind every car it comes too close to
+    auto ahead = std::upper_bound(laneCars.begin(), laneCars.end(), x,
+                                  [](float x, CarPtr const& car) { return x < car->getX(); });
+    if (ahead != laneCars.end()) {
+        x = std::min(x, (*ahead)->getX() - gap);
+    }
+    for (auto behind = ahead; behind != laneCars.begin() && x - (*(behind - 1))->getX() < gap; --behind) {
+        x = std::min(x, (*(behind - 1))->getX() - gap);
+    }
+    return x < 0 ? -1 : x;
+}
+
+void Edge::clearCars()
+{
+    cars = LaneOrder(nLanes);
+    CarPtr car;
+    while (inbox.pop(car)) {
+        car.reset();
+    }
+    while (outbox.pop(car)) {
+        car.reset();
+    }
+    exitingCars.clear();
+    meanSpeed = 0;
+    nQueuedCars = 0;
+    nExitedCars = 0;
+    std::fill(entrySpace.begin(), entrySpace.end(), 1);
+}
+
+void Edge::copyStateTo(Edge& edge, CarPool& pool) const
+{
+    if (!inbox.empty() || !outbox.empty()) {
+        throw std::logic_error("Edge " + label + " can only be copied between steps.");
+    }
+    edge.cars.copyFrom(cars, pool);
+    edge.id = id;
+    edge.length = length;
+    edge.actionsOverridden = actionsOverridden;
+    edge.decisionInterval = decisionInterval;
+    edge.stepsUntilDecision = stepsUntilDecision;
+    edge.highPriority = highPriority;
+    edge.meanSpeed = meanSpeed;
+    edge.nQueuedCars = nQueuedCars;
+    edge.nExitedCars = nExitedCars;
+    edge.closed = closed;
+    edge.entrySpace = entrySpace;
+}
+
+void Edge::setDecisionInterval(int nSteps)
+{
+    if (nSteps < 1) {
+        throw std::invalid_argument("Edge " + label + " needs a decision interval of at least one step.");
+    }
+    if (nSteps != decisionInterval) {
+        decisionInterval = nSteps;
+        stepsUntilDecision = 1 + id % nSteps;
+    }
+}
+
+void Edge::keepActions()
+{
+    cars.forEach([](Car& car) {
+        ActionCode action = car.getAction();
+        if (action == ActionCode::ToLeftLaneAndCruise || action == ActionCode::ToRightLaneAndCruise) {
+            car.setAction(ActionCode::Cruise);
+        }
+    });
+}
+
+void Edge::setSpeedLimit(float speedLimit)
+{
+    this->speedLimit = speedLimit;
+    cars.forEach([speedLimit](Car& car) {
+        car.setBaseTarget(speedLimit);
+    });
+}
+
+void Edge::holdCarAtEnd(CarPtr&& car)
+{
+    car->stopAt(length);
+    if (histogram.isAttached()) {
+        histogram.add(car->getX());
+    }
+    cars.insert(std::move(car));
+}
+
+void Edge::takeEntrySnapshot()
+{
+    for (int l = 0; l < nLanes; ++l) {
+        auto const& entryLane = cars.getLane(l);
+        entrySpace[l] = entryLane.empty() || entryLane.front()->getX() >= entryGap;
+    }
+}
+
+void Edge::attachHistogram(int* counts, float binDistance)
+{
+    // The buffer is expected to be zeroed, so only the cars currently on the edge have to be added.
+    histogram.attach(counts, getHistogramBinCount(binDistance), binDistance);
+    cars.forEach([this](Car const& car) {
+        histogram.add(car.getX());
+    });
+}
+
+std::uint64_t Edge::computeStateDigest() const
+{
+    std::uint64_t digest = StateDigest::mix(cars.size());
+    cars.forEach([&digest](Car const& car) {
+        digest = StateDigest::combine(digest, StateDigest::ofCar(car));
+    });
+    return digest;
+}
+
+void Edge::applyActions(std::vector<ActionCode> const& actions)
+{
+    size_t i = 0;
+    cars.forEach([&](Car& car) {
+        car.setAction(actions[i++]);
+    });
+}
+
+void Edge::overrideActions(std::vector<ActionCode> const& actions)
+{
+    if (actions.size() != (size_t) cars.size()) {
+        throw std::invalid_argument("Expected one action per car on edge " + label);
+    }
+    size_t i = 0;
+    cars.forEach([&](Car& car) {
+        ActionCode action = actions[i++];
+        bool leftLaneExists = car.getLane() + 1 < nLanes;
+        bool rightLaneExists = car.getLane() > 0;
+        if ((action == ActionCode::ToLeftLaneAndCruise && !leftLaneExists)
+            || (action == ActionCode::ToRightLaneAndCruise && !rightLaneExists)) {
+            action = ActionCode::Cruise;
+        }
+        car.setAction(action);
+    });
+    // An empty edge has no car to act on, and may not be stepped until a car has entered
+    actionsOverridden = !actions.empty();
+}
@@ -0,0 +1,162 @@
+#include "edge/lane_order.h"
+#include "car_pool.h"
+
+#include <algorithm>
+#include <limits>
+#include <tuple>
+
+LaneOrder::LaneOrder(int nLanes)
+    : lanes(nLanes)
+{
+
+}
+
+void LaneOrder::copyFrom(LaneOrder const& other, CarPool& pool)
+{
+    lanes = std::vector<std::deque<CarPtr>>(other.lanes.size());
+    for (size_t l = 0; l < lanes.size(); ++l) {
+        for (auto const& car : other.lanes[l]) {
+            lanes[l].push_back(pool.getCopy(*car));
+        }
+    }
+    nCars = other.nCars;
+    orderValid = false;
+}
+
+void LaneOrder::insertIntoLane(CarPtr&& car)
+{
+    auto& lane = lanes[car->getLane()];
+    float x = car->getX();
+    if (lane.empty() || x <= lane.front()->getX()) {
+        // The common case: cars enter at the start of the edge
+        lane.push_front(std::move(car));
+        return;
+    }
+    auto position = std::upper_bound(lane.begin(), lane.end(), x,
+                                     [](float x, CarPtr const& car) { return x < car->getX(); });
+    lane.insert(position, std::move(car));
+}
+
+void LaneOrder::insert(CarPtr&& car)
+{
+    insertIntoLane(std::move(car));
+    nCars++;
+    orderValid = false;
+}
+
+void LaneOrder::resort()
+{
+    for (int l = 0; l < (int) lanes.size(); ++l) {
+        auto& lane = lanes[l];
+        bool hasLaneChangers = false;
+        // One pass over the lane, which also serves as insertion sort.
+        // Every swap corresponds to exactly one overtake.
+        for (size_t i = 0; i < lane.size(); ++i) {
+            hasLaneChangers |= lane[i]->getLane() != l;
+            for (size_t j = i; j > 0 && lane[j]->getX() < lane[j - 1]->getX(); --j) {
+                std::swap(lane[j], lane[j - 1]);
+            }
+        }
+        if (!hasLaneChangers) {
+            continue;
+        }
+        // Stable compaction keeps the remaining cars ordered
+        auto kept = lane.begin();
+        for (auto& car : lane) {
+            if (car->getLane() != l) {
+                laneChangers.push_back({std::move(car), 0});
+            } else {
+                *kept++ = std::move(car);
+            }
+        }
+        lane.erase(kept, lane.end());
+    }
+    if (!laneChangers.empty()) {
+        mergeLaneChangers();
+    }
+    laneChangers.clear();
+    // Position changes alone also change the global order
+    orderValid = false;
+}
+
+void LaneOrder::mergeLaneChangers()
+{
+    // The cars land where insertIntoLane would put them one after the other: in front of the lane if they are not
+    // ahead of its front car, otherwise behind the cars at their position. The rank orders them that way among
+    // cars at the same position, such that every lane takes its new cars in one merge from the back, which moves
+    // the cars ahead of the rearmost of them once instead of once per lane changer.
+    laneFronts.resize(lanes.size());
+    for (size_t l = 0; l < lanes.size(); ++l) {
+        laneFronts[l] = lanes[l].empty() ? std::numeric_limits<float>::infinity() : lanes[l].front()->getX();
+    }
+    for (long i = 0; i < (long) laneChangers.size(); ++i) {
+        auto& changer = laneChangers[i];
+        float& front = laneFronts[changer.car->getLane()];
+        changer.rank = changer.car->getX() <= front ? -i - 1 : i;
+        front = std::min(front, changer.car->getX());
+    }
+    std::sort(laneChangers.begin(), laneChangers.end(), [](LaneChanger const& a, LaneChanger const& b) {
+        return std::make_tuple(a.car->getLane(), a.car->getX(), a.rank)
+               < std::make_tuple(b.car->getLane(), b.car->getX(), b.rank);
+    });
+    for (size_t end = laneChangers.size(); end > 0;) {
+        int l = laneChangers[end - 1].car->getLane();
+        auto& lane = lanes[l];
+        size_t begin = end;
+        while (begin > 0 && laneChangers[begin - 1].car->getLane() == l) {
+            begin--;
+        }
+        size_t i = lane.size();
+        lane.resize(lane.size() + end - begin);
+        for (size_t w = lane.size(); end > begin; --w) {
+            auto& changer = laneChangers[end - 1];
+            float x = changer.car->getX();
+            if (i > 0 && (lane[i - 1]->getX() > x || (lane[i - 1]->getX() == x && changer.rank < 0))) {
+                lane[w - 1] = std::move(lane[--i]);
+            } else {
+                lane[w - 1] = std::move(changer.car);
+                end--;
+            }
+        }
+    }
+}
+
+void LaneOrder::popBeyond(float x, std::vector<CarPtr>& exitingCars)
+{
+    size_t first = exitingCars.size();
+    for (auto& lane : lanes) {
+        while (!lane.empty() && lane.back()->getX() > x) {
+            exitingCars.push_back(std::move(lane.back()));
+            lane.pop_back();
+            nCars--;
+        }
+    }
+    if (exitingCars.size() - first > 1) {
+        std::stable_sort(exitingCars.begin() + first, exitingCars.end(),
+                         [](CarPtr const& left, CarPtr const& right) { return left->getX() > right->getX(); });
+    }
+    orderValid = false;
+}
+
+std::vector<Car*> const& LaneOrder::getOrder() const
+{
+    if (orderValid) {
+        return order;
+    }
+    // Merge of the lanes, the number of lanes is small so the minimum is found by a linear scan
+    order.clear();
+    order.reserve(nCars);
+    std::vector<size_t> heads(lanes.size(), 0);
+    for (int n = 0; n < nCars; ++n) {
+        int best = -1;
+        for (int l = 0; l < (int) lanes.size(); ++l) {
+            if (heads[l] < lanes[l].size() &&
+                    (best == -1 || lanes[l][heads[l]]->getX() < lanes[best][heads[best]]->getX())) {
+                best = l;
+            }
+        }
+        order.push_back(lanes[best][heads[best]++].get());
+    }
+    orderValid = true;
+    return order;
+}
@@ -0,0 +1,159 @@
+#include "frame_publisher.h"
+#include "traffic_model.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+    size_t align8(size_t size) { return (size + 7) & ~size_t(7); }
+}
+
+FramePublisher::FramePublisher(TrafficModel& model, std::string name, int stepsPerFrame, int nSlots, int maxCars)
+    : name(std::move(name)), stepsPerFrame(std::max(1, stepsPerFrame))
+{
+    if (nSlots < 1 || maxCars < 0) {
+        throw std::invalid_argument("A frame stream needs at least one slot and a non-negative car count.");
+    }
+    auto const& offsets = model.getCarCountHistOffsets();
+    if (offsets.empty()) {
+        throw std::logic_error("Register car count histograms before starting a frame stream.");
+    }
+    size_t nNodes = model.getNNodes();
+    size_t nEdges = model.getNEdges();
+    size_t nBins = offsets.back();
+
+    size_t staticOffset = align8(sizeof(FrameStreamHeader));
+    size_t staticSize = align8(2 * nNodes * sizeof(float)) + align8(2 * nEdges * sizeof(std::int32_t))
+        + align8(nEdges * sizeof(float)) + align8((nEdges + 1) * sizeof(std::int32_t));
+    size_t slotOffset = staticOffset + staticSize;
+    size_t slotSize = align8(sizeof(FrameSlotHeader)) + align8((nEdges + nNodes + nBins) * sizeof(std::int32_t))
+        + 3 * align8((size_t) maxCars * 4);
+    memorySize = slotOffset + (size_t) nSlots * slotSize;
+
+    // A stale segment of a previous run is replaced, attached readers keep their old mapping
+    shm_unlink(this->name.c_str());
+    fd = shm_open(this->name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t) memorySize) != 0) {
+        throw std::runtime_error("Could not create shared memory segment " + this->name);
+    }
+    void* mapped = mmap(nullptr, memorySize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Could not map shared memory segment " + this->name);
+    }
+    memory = static_cast<std::byte*>(mapped);
+    std::memset(memory, 0, memorySize);
+
+    header = new (memory) FrameStreamHeader();
+    header->version = FrameStreamHeader::currentVersion;
+    header->nNodes = nNodes;
+    header->nEdges = nEdges;
+    header->nBins = nBins;
+    header->maxCars = maxCars;
+    header->nSlots = nSlots;
+    header->binDistance = model.getEdge(0).getHistogramBinDistance();
+    header->deltaTime = model.getDeltaTime();
+    header->staticOffset = staticOffset;
+    header->slotOffset = slotOffset;
+    header->slotSize = slotSize;
+    header->latestFrame.store(0);
+    for (int slot = 0; slot < nSlots; ++slot) {
+        new (at<FrameSlotHeader>(slotOffset + slot * slotSize)) FrameSlotHeader();
+    }
+
+    // The topology never changes, so it is written once
+    size_t offset = staticOffset;
+    auto* nodeX = at<float>(offset);
+    auto* nodeY = nodeX + nNodes;
+    offset += align8(2 * nNodes * sizeof(float));
+    auto* edgeStart = at<std::int32_t>(offset);
+    auto* edgeEnd = edgeStart + nEdges;
+    offset += align8(2 * nEdges * sizeof(std::int32_t));
+    auto* edgeLength = at<float>(offset);
+    offset += align8(nEdges * sizeof(float));
+    auto* binOffsets = at<std::int32_t>(offset);
+    for (size_t i = 0; i < nNodes; ++i) {
+        auto [x, y] = model.getNodePosition(i);
+        nodeX[i] = x;
+        nodeY[i] = y;
+    }
+    for (size_t i = 0; i < nEdges; ++i) {
+        edgeStart[i] = model.getEdgeStartNodeID(i);
+        edgeEnd[i] = model.getEdgeEndNodeID(i);
+        edgeLength[i] = model.getEdgeRoadLength(i);
+    }
+    std::copy(offsets.begin(), offsets.end(), binOffsets);
+    // Written last, such that readers only accept a complete header
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = FrameStreamHeader::magicValue;
+}
+
+FramePublisher::~FramePublisher()
+{
+    if (memory != nullptr) {
+        munmap(memory, memorySize);
+    }
+    if (fd >= 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+    }
+}
+
+void FramePublisher::onStep(TrafficModel& model)
+{
+    if (++stepsSinceFrame >= stepsPerFrame) {
+        stepsSinceFrame = 0;
+        publish(model);
+    }
+}
+
+void FramePublisher::publish(TrafficModel& model)
+{
+    std::uint64_t frame = ++nFrames;
+    size_t slotOffset = header->slotOffset + (frame % header->nSlots) * header->slotSize;
+    auto* slot = at<FrameSlotHeader>(slotOffset);
+
+    slot->sequence.store(2 * frame - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->frame = frame;
+    slot->globalTime = model.global_time;
+    size_t offset = slotOffset + align8(sizeof(FrameSlotHeader));
+    auto* carsPerEdge = at<std::int32_t>(offset);
+    auto* carsPerNode = carsPerEdge + header->nEdges;
+    auto* histograms = carsPerNode + header->nNodes;
+    offset += align8((header->nEdges + header->nNodes + header->nBins) * sizeof(std::int32_t));
+    auto* carEdge = at<std::int32_t>(offset);
+    offset += align8(header->maxCars * 4);
+    auto* carX = at<float>(offset);
+    offset += align8(header->maxCars * 4);
+    auto* carLane = at<std::int32_t>(offset);
+
+    std::uint32_t nCars = 0;
+    for (std::uint32_t i = 0; i < header->nEdges; ++i) {
+        Edge const& edge = model.getEdge(i);
+        carsPerEdge[i] = edge.getNCars();
+        if (nCars < header->maxCars) {
+            edge.getCars().forEach([&](Car const& car) {
+                if (nCars < header->maxCars) {
+                    carEdge[nCars] = i;
+                    carX[nCars] = car.getX();
+                    carLane[nCars] = car.getLane();
+                    nCars++;
+                }
+            });
+        }
+    }
+    for (std::uint32_t i = 0; i < header->nNodes; ++i) {
+        carsPerNode[i] = model.getCarCountInNode(i);
+    }
+    auto const& counts = model.getCarCountHists();
+    std::copy(counts.begin(), counts.begin() + std::min<size_t>(counts.size(), header->nBins), histograms);
+    slot->nCars = nCars;
+
+    slot->sequence.store(2 * frame, std::memory_order_release);
+    header->latestFrame.store(frame, std::memory_order_release);
+}
@@ -0,0 +1,47 @@
+#include "network_order.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+std::uint64_t NetworkOrder::hilbertIndex(std::uint32_t x, std::uint32_t y)
+{
+    std::uint32_t n = 1u << curveOrder;
+    std::uint64_t index = 0;
+    for (std::uint32_t s = n / 2; s > 0; s /= 2) {
+        std::uint32_t rx = (x & s) > 0;
+        std::uint32_t ry = (y & s) > 0;
+        index += (std::uint64_t) s * s * ((3 * rx) ^ ry);
+        // Rotates the quadrant, such that the curve continues where the previous one ended
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return index;
+}
+
+std::vector<int> NetworkOrder::hilbertOrder(std::vector<float> const& xs, std::vector<float> const& ys)
+{
+    std::vector<int> order(xs.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (xs.empty()) {
+        return order;
+    }
+    auto [minX, maxX] = std::minmax_element(xs.begin(), xs.end());
+    auto [minY, maxY] = std::minmax_element(ys.begin(), ys.end());
+    // One scale for both axes, so the curve does not stretch along the shorter side of the network
+    float extent = std::max({*maxX - *minX, *maxY - *minY, 1e-6f});
+    float cells = (float) ((1u << curveOrder) - 1);
+    std::vector<std::uint64_t> indices(xs.size());
+    for (size_t i = 0; i < xs.size(); ++i) {
+        auto x = (std::uint32_t) ((xs[i] - *minX) / extent * cells);
+        auto y = (std::uint32_t) ((ys[i] - *minY) / extent * cells);
+        indices[i] = hilbertIndex(x, y);
+    }
+    std::stable_sort(order.begin(), order.end(), [&indices](int a, int b) { return indices[a] < indices[b]; });
+    return order;
+}
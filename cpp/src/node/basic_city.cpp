@@ -14,23 +14,36 @@ BasicCity::BasicCity(std::string label, int population, float x, float y)
     rng = std::mt19937(rd());
 }
 
+std::shared_ptr<Node> BasicCity::clone(CarPool& pool) const
+{
+    auto city = std::make_shared<BasicCity>(getLabel(), population, x, y);
+    city->rng = rng;
+    copyStateTo(*city, pool);
+    return city;
+}
+
 void BasicCity::distributeCars() {
+    // Cars that cannot be handed off yet stay, in order, for the next step
+    auto kept = storedCars.begin();
     for (auto& car : storedCars) {
-        if (car->path[0] == id) {
-            // remove the first node from the path
-            car->path.erase(car->path.begin());
+        if (carPool->getNextNode(*car) == id) {
+            // move on to the next node of the path
+            car->passNode();
         }
-        if (car->path.empty()) {
-            travelStats.emplace_back(car->fromNodeID, car->toNodeID, car->age, car->global_time);
+        if (car->hasArrived()) {
+            recordArrival(*car);
+            car.reset();
             continue;
         }
-        int nextNode = car->path[0];
+        int nextNode = carPool->getNextNode(*car);
         for (auto& edge : outEdges) {
             if (edge.get().getOutNode().getID() == nextNode) {
-                edge.get().enterCar(std::move(car));
+                if (!edge.get().sendCar(std::move(car))) {
+                    *kept++ = std::move(car);
+                }
                 break;
             }
         }
     }
-    storedCars.clear();
+    storedCars.erase(kept, storedCars.end());
 }
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include "node/intersection.h"
+#include "state_digest.h"
+#include "car.h"
+
+#include <algorithm>
+#include <utility>
+
+Intersection::Intersection(std::string label, float x, float y, float saturationFlow, int queueCapacity)
+    : Node(std::move(label), x, y, 0), saturationFlow(saturationFlow), queueCapacity(queueCapacity)
+{
+
+}
+
+std::shared_ptr<Node> Intersection::clone(CarPool& pool) const
+{
+    auto intersection = std::make_shared<Intersection>(getLabel(), x, y, saturationFlow, queueCapacity);
+    copyStateTo(*intersection, pool);
+    intersection->nQueued = nQueued;
+    intersection->outEdgeByNextNode = outEdgeByNextNode;
+    intersection->movements = std::vector<Movement>(movements.size());
+    for (size_t i = 0; i < movements.size(); ++i) {
+        for (auto const& car : movements[i].queue) {
+            intersection->movements[i].queue.push_back(pool.getCopy(*car));
+        }
+        intersection->movements[i].credit = movements[i].credit;
+        intersection->movements[i].idleSince = movements[i].idleSince;
+        intersection->movements[i].active = movements[i].active;
+    }
+    intersection->activeMovements = activeMovements;
+    intersection->enteredLanes = enteredLanes;
+    return intersection;
+}
+
+void Intersection::prepare()
+{
+    outEdgeByNextNode.clear();
+    for (int i = 0; i < (int) outEdges.size(); ++i) {
+        outEdgeByNextNode[outEdges[i].get().getOutNode().getID()] = i;
+    }
+    movements = std::vector<Movement>(inEdges.size() * outEdges.size());
+    enteredLanes.assign(outEdges.size(), 0);
+    activeMovements.clear();
+    activeMovements.reserve(movements.size());
+}
+
+void Intersection::clearCars()
+{
+    Node::clearCars();
+    exitingCars.clear();
+    nQueued = 0;
+    // Drops the movement queues and credits
+    prepare();
+}
+
+void Intersection::collectCarHandles(std::vector<CarPtr*>& handles)
+{
+    Node::collectCarHandles(handles);
+    for (auto& m : movements) {
+        for (auto& car : m.queue) {
+            handles.push_back(&car);
+        }
+    }
+}
+
+void Intersection::rerouteCars(std::function<void(Car&)> const& reroute)
+{
+    Node::rerouteCars(reroute);
+    int nOutEdges = (int) outEdges.size();
+    std::vector<std::pair<int, CarPtr>> moved; // (movement, car)
+    for (int movement = 0; movement < (int) movements.size(); ++movement) {
+        auto& queue = movements[movement].queue;
+        auto kept = queue.begin();
+        for (auto& car : queue) {
+            reroute(*car);
+            int next = movement / nOutEdges * nOutEdges + outEdgeByNextNode.at(carPool->getNextNode(*car));
+            if (next == movement) {
+                *kept++ = std::move(car);
+            } else {
+                moved.emplace_back(next, std::move(car));
+            }
+        }
+        queue.erase(kept, queue.end());
+    }
+    for (auto& [movement, car] : moved) {
+        movements[movement].queue.push_back(std::move(car));
+        activate(movement);
+    }
+}
+
+void Intersection::activate(int movement)
+{
+    if (movements[movement].active) {
+        return;
+    }
+    // An idle movement earns credit as if it had been stepped, up to one car, such that a car arriving at a drained
+    // queue still waits for the saturation flow
+    Movement& m = movements[movement];
+    m.active = true;
+    m.credit = std::min(1.0, m.credit + saturationFlow * (*clock - m.idleSince));
+    activeMovements.push_back(movement);
+}
+
+void Intersection::step(float dt)
+{
+    for (int movement : activeMovements) {
+        Movement& m = movements[movement];
+        // Credit does not build up while cars are held by spillback, so no burst follows it
+        m.credit = std::min(m.credit + saturationFlow * dt, std::max(1.0f, saturationFlow * dt));
+    }
+}
+
+void Intersection::collectCars()
+{
+    for (int i = 0; i < (int) inEdges.size(); ++i) {
+        Edge& edge = inEdges[i];
+        edge.getExitingCars(exitingCars);
+        for (auto& car : exitingCars) {
+            if (carPool->getNextNode(*car) == id) {
+                car->passNode();
+            }
+            if (car->hasArrived()) {
+                // Intersections are not meant as destinations, but a trip may still end here
+                edge.countExit(*car);
+                recordArrival(*car);
+                continue;
+            }
+            int movement = i * (int) outEdges.size() + outEdgeByNextNode.at(carPool->getNextNode(*car));
+            if ((int) movements[movement].queue.size() >= queueCapacity) {
+                edge.holdCarAtEnd(std::move(car));
+                continue;
+            }
+            edge.countExit(*car);
+            movements[movement].queue.push_back(std::move(car));
+            nQueued++;
+            activate(movement);
+        }
+        exitingCars.clear();
+    }
+}
+
+void Intersection::distributeCars()
+{
+    // Cars spawned here are sent through without limits, like in BasicCity
+    auto kept = storedCars.begin();
+    for (auto& car : storedCars) {
+        if (carPool->getNextNode(*car) == id) {
+            car->passNode();
+        }
+        if (car->hasArrived()) {
+            recordArrival(*car);
+            car.reset();
+            continue;
+        }
+        if (!outEdges[outEdgeByNextNode.at(carPool->getNextNode(*car))].get().sendCar(std::move(car))) {
+            *kept++ = std::move(car);
+        }
+    }
+    storedCars.erase(kept, storedCars.end());
+
+    // Sent cars only enter their edge after this, so lanes taken in this step are tracked here
+    int nOutEdges = (int) outEdges.size();
+    std::fill(enteredLanes.begin(), enteredLanes.end(), 0);
+    auto active = activeMovements.begin();
+    for (int movement : activeMovements) {
+        Movement& m = movements[movement];
+        Edge& outEdge = outEdges[movement % nOutEdges];
+        std::uint32_t& entered = enteredLanes[movement % nOutEdges];
+        while (!m.queue.empty() && m.credit >= 1) {
+            int lane = std::min(m.queue.front()->getLane(), outEdge.getNLanes() - 1);
+            if ((entered >> lane & 1) || !outEdge.hasEntrySpace(lane) || !outEdge.sendCar(std::move(m.queue.front()))) {
+                break;
+            }
+            entered |= 1u << lane;
+            m.queue.pop_front();
+            m.credit -= 1;
+            nQueued--;
+        }
+        if (m.queue.empty()) {
+            m.active = false;
+            m.idleSince = *clock;
+        } else {
+            *active++ = movement;
+        }
+    }
+    activeMovements.erase(active, activeMovements.end());
+}
+
+std::uint64_t Intersection::computeStateDigest() const
+{
+    std::uint64_t digest = Node::computeStateDigest();
+    for (auto const& m : movements) {
+        digest = StateDigest::combine(digest, StateDigest::bits(m.credit) << 32 | m.queue.size());
+        for (auto const& car : m.queue) {
+            digest = StateDigest::combine(digest, StateDigest::ofCar(*car));
+        }
+    }
+    return digest;
+}
@@ -1,4 +1,5 @@
 #include "node/node.h"
+#include "state_digest.h"
 
 #include <iostream>
 #include <utility>
@@ -11,10 +12,42 @@ Node::Node(std::string label, float x, float y, int population)
 }
 
 
+void Node::copyStateTo(Node& node, CarPool& pool) const
+{
+    node.x = x;
+    node.y = y;
+    node.travelStats = travelStats;
+    node.population = population;
+    node.id = id;
+    for (auto const& car : storedCars) {
+        node.storedCars.push_back(pool.getCopy(*car));
+    }
+}
+
 void Node::collectCars() {
     for (auto& edge : inEdges)
     {
-        auto exitingCars = edge.get().getExitingCars();
-        storedCars.insert(storedCars.end(), std::make_move_iterator(exitingCars.begin()), std::make_move_iterator(exitingCars.end()));
+        size_t first = storedCars.size();
+        edge.get().getExitingCars(storedCars);
+        for (size_t i = first; i < storedCars.size(); ++i) {
+            edge.get().countExit(*storedCars[i]);
+        }
+    }
+}
+
+void Node::recordArrival(Car const& car)
+{
+    travelStats.push_back(carPool->getTravelStats(car));
+    if (probes != nullptr && probes->has(ProbeHook::Arrival)) {
+        probes->carArrived(car, id, travelStats.back());
+    }
+}
+
+std::uint64_t Node::computeStateDigest() const
+{
+    std::uint64_t digest = StateDigest::mix(storedCars.size());
+    for (auto const& car : storedCars) {
+        digest = StateDigest::combine(digest, StateDigest::ofCar(*car));
     }
+    return digest;
 }
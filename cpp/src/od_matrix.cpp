@@ -0,0 +1,197 @@
+#include "od_matrix.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+OdMatrix::OdMatrix(int nNodes, std::vector<Entry> entries)
+{
+    std::sort(entries.begin(), entries.end());
+    rowStarts.assign(nNodes + 1, 0);
+    cumulativeRowTotals.assign(nNodes, 0);
+    int origin = 0;
+    double rowTotal = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        auto [from, to, weight] = entries[i];
+        if (from < 0 || from >= nNodes || to < 0 || to >= nNodes) {
+            throw std::out_of_range("OD pair outside of the network.");
+        }
+        // Merge duplicates into the first occurrence
+        while (i + 1 < entries.size() && std::get<0>(entries[i + 1]) == from && std::get<1>(entries[i + 1]) == to) {
+            weight += std::get<2>(entries[++i]);
+        }
+        if (weight <= 0) {
+            continue;
+        }
+        for (; origin < from; ++origin) {
+            rowStarts[origin + 1] = destinations.size();
+            cumulativeRowTotals[origin] = rowTotal;
+            rowTotal = 0;
+        }
+        rowTotal += weight;
+        destinations.push_back(to);
+        cumulativeWeights.push_back(rowTotal);
+    }
+    for (; origin < nNodes; ++origin) {
+        rowStarts[origin + 1] = destinations.size();
+        cumulativeRowTotals[origin] = rowTotal;
+        rowTotal = 0;
+    }
+    for (int i = 1; i < nNodes; ++i) {
+        cumulativeRowTotals[i] += cumulativeRowTotals[i - 1];
+    }
+}
+
+namespace {
+    // Sum of the population products over all pairs of different nodes
+    double sumOfPairProducts(std::vector<int> const& populations)
+    {
+        double total = 0;
+        double squares = 0;
+        for (int population : populations) {
+            if (population > 0) {
+                total += population;
+                squares += (double) population * population;
+            }
+        }
+        return total * total - squares;
+    }
+}
+
+OdMatrix OdMatrix::gravity(std::vector<int> const& populations, double tripsPerDay)
+{
+    // Only the cumulative populations and row totals, the pairs follow from them
+    OdMatrix matrix;
+    matrix.gravityNorm = sumOfPairProducts(populations);
+    matrix.gravityTripsPerDay = tripsPerDay;
+    matrix.cumulativePopulations.reserve(populations.size());
+    double total = 0;
+    size_t nPopulated = 0;
+    for (int population : populations) {
+        total += std::max(population, 0);
+        nPopulated += population > 0;
+        matrix.cumulativePopulations.push_back(total);
+    }
+    matrix.nGravityPairs = matrix.gravityNorm > 0 ? nPopulated * (nPopulated - 1) : 0;
+    matrix.cumulativeRowTotals = gravityRowTotals(populations, tripsPerDay);
+    for (size_t i = 1; i < populations.size(); ++i) {
+        matrix.cumulativeRowTotals[i] += matrix.cumulativeRowTotals[i - 1];
+    }
+    return matrix;
+}
+
+std::vector<double> OdMatrix::gravityRowTotals(std::vector<int> const& populations, double tripsPerDay)
+{
+    // Every row is its population times that of all other populated nodes
+    double norm = sumOfPairProducts(populations);
+    double total = 0;
+    for (int population : populations) {
+        total += std::max(population, 0);
+    }
+    std::vector<double> rowTotals(populations.size(), 0);
+    for (size_t i = 0; i < populations.size() && norm > 0; ++i) {
+        if (populations[i] > 0) {
+            rowTotals[i] = (double) populations[i] * (total - populations[i]) / norm * tripsPerDay;
+        }
+    }
+    return rowTotals;
+}
+
+OdMatrix OdMatrix::load(std::istream& input, int nNodes, std::function<int(std::string const&)> const& toNodeID)
+{
+    std::vector<Entry> entries;
+    std::string line;
+    while (std::getline(input, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        std::stringstream stream(line);
+        std::string origin, destination, weight;
+        std::getline(stream, origin, ',');
+        std::getline(stream, destination, ',');
+        std::getline(stream, weight, ',');
+        entries.emplace_back(toNodeID(origin), toNodeID(destination), std::stod(weight));
+    }
+    return {nNodes, std::move(entries)};
+}
+
+size_t OdMatrix::getMemoryUsage() const
+{
+    return rowStarts.capacity() * sizeof(size_t) + destinations.capacity() * sizeof(int)
+        + cumulativeWeights.capacity() * sizeof(double) + cumulativeRowTotals.capacity() * sizeof(double)
+        + cumulativePopulations.capacity() * sizeof(double);
+}
+
+double OdMatrix::getPopulation(int node) const
+{
+    return cumulativePopulations[node] - (node > 0 ? cumulativePopulations[node - 1] : 0);
+}
+
+double OdMatrix::getRowTotal(int origin) const
+{
+    return cumulativeRowTotals[origin] - (origin > 0 ? cumulativeRowTotals[origin - 1] : 0);
+}
+
+double OdMatrix::getWeight(int origin, int destination) const
+{
+    if (isGravity()) {
+        return origin == destination || gravityNorm <= 0 ? 0
+            : getPopulation(origin) * getPopulation(destination) / gravityNorm * gravityTripsPerDay;
+    }
+    auto first = destinations.begin() + rowStarts[origin];
+    auto last = destinations.begin() + rowStarts[origin + 1];
+    auto it = std::lower_bound(first, last, destination);
+    if (it == last || *it != destination) {
+        return 0;
+    }
+    size_t i = it - destinations.begin();
+    return cumulativeWeights[i] - (i > rowStarts[origin] ? cumulativeWeights[i - 1] : 0);
+}
+
+int OdMatrix::sampleDestination(int origin, double u) const
+{
+    if (isGravity()) {
+        if (!(getRowTotal(origin) > 0)) {
+            return -1;
+        }
+        // Destinations in proportion to their population, over every node but the origin, whose part of the
+        // cumulative populations is skipped rather than drawn again
+        double own = getPopulation(origin);
+        double ownStart = cumulativePopulations[origin] - own;
+        double target = u * (cumulativePopulations.back() - own);
+        if (target >= ownStart) {
+            target += own;
+        }
+        int destination = (int) (std::upper_bound(cumulativePopulations.begin(), cumulativePopulations.end(), target)
+                                 - cumulativePopulations.begin());
+        // Rounding may run past the last node, the nearest node before it with a population is taken then
+        destination = std::min(destination, getNNodes() - 1);
+        while (destination == origin || getPopulation(destination) <= 0) {
+            destination--;
+        }
+        return destination;
+    }
+    auto first = cumulativeWeights.begin() + rowStarts[origin];
+    auto last = cumulativeWeights.begin() + rowStarts[origin + 1];
+    if (first == last) {
+        return -1;
+    }
+    auto it = std::upper_bound(first, last, u * getRowTotal(origin));
+    if (it == last) {
+        --it;
+    }
+    return destinations[it - cumulativeWeights.begin()];
+}
+
+std::pair<int, int> OdMatrix::samplePair(double u) const
+{
+    double target = u * getTotal();
+    int origin = (int) (std::upper_bound(cumulativeRowTotals.begin(), cumulativeRowTotals.end(), target)
+                        - cumulativeRowTotals.begin());
+    origin = std::min(origin, getNNodes() - 1);
+    // Reuse the remainder of u within the row
+    double rowStart = origin > 0 ? cumulativeRowTotals[origin - 1] : 0;
+    double rowTotal = getRowTotal(origin);
+    double v = rowTotal > 0 ? (target - rowStart) / rowTotal : 0;
+    return {origin, sampleDestination(origin, std::min(std::max(v, 0.0), 0.999999))};
+}
@@ -0,0 +1,124 @@
+#include "paced_runner.h"
+#include "traffic_model.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+PacedRunner::PacedRunner(TrafficModel& model, double speedUp, double maxLag, int maxDegradation)
+    : model(model), speedUp(speedUp), maxLag(maxLag), maxDegradation(maxDegradation),
+      stepLength(model.getDeltaTime() / model.getScale())
+{
+    if (!(speedUp > 0) || !(maxLag > 0)) {
+        throw std::invalid_argument("A paced run needs a positive speed-up and maximum lag.");
+    }
+    if (maxDegradation < 0 || maxDegradation > degradationLimit) {
+        throw std::invalid_argument("The maximum degradation of a paced run must lie in [0, "
+                                    + std::to_string(degradationLimit) + "].");
+    }
+    setDegradation(0);
+}
+
+PacedRunner::~PacedRunner()
+{
+    model.setDecisionInterval(1);
+}
+
+double PacedRunner::getTargetTime(Clock::time_point now) const
+{
+    return anchorTime + std::chrono::duration<double>(now - anchorWall).count() * speedUp;
+}
+
+void PacedRunner::step()
+{
+    if (!started) {
+        started = true;
+        startWall = Clock::now();
+        anchorWall = startWall;
+        anchorTime = model.global_time;
+        lastWake = startWall;
+        report = PaceReport{};
+        report.stepBudget = stepLength / speedUp;
+        report.degradation = degradation;
+    }
+    double time = model.global_time;
+    model.step();
+    auto now = Clock::now();
+    double stepTime = std::chrono::duration<double>(now - lastWake).count();
+    double lag = std::max(0.0, getTargetTime(now) - model.global_time);
+    if (lag > maxLag) {
+        report.slippedTime += lag;
+        report.nSlips++;
+        anchorWall = now;
+        anchorTime = model.global_time;
+    }
+
+    report.nSteps++;
+    report.simulatedTime += model.global_time - time;
+    report.meanStepTime += (stepTime - report.meanStepTime) / report.nSteps;
+    report.maxStepTime = std::max(report.maxStepTime, stepTime);
+    report.lag = lag;
+    report.maxLag = std::max(report.maxLag, lag);
+    if (degradation > 0) {
+        report.nDegradedSteps++;
+    }
+    meanStepTime = report.nSteps == 1 ? stepTime : meanStepTime + (stepTime - meanStepTime) / adaptSteps;
+    adapt(lag);
+    report.degradation = degradation;
+
+    if (lag == 0) {
+        auto due = anchorWall + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>((model.global_time - anchorTime) / speedUp));
+        std::this_thread::sleep_until(due);
+        now = std::max(now, Clock::now());
+    }
+    lastWake = now;
+    report.wallTime = std::chrono::duration<double>(now - startWall).count();
+}
+
+void PacedRunner::adapt(double lag)
+{
+    if (++stepsSinceAdapt < adaptSteps) {
+        return;
+    }
+    double budget = stepLength / speedUp;
+    bool lagging = lag > stepLength;
+    if ((meanStepTime > budget || (lagging && meanStepTime > catchUpShare * budget)) && degradation < maxDegradation) {
+        setDegradation(degradation + 1);
+    } else if (!lagging && meanStepTime < recoverShare * budget && degradation > 0) {
+        setDegradation(degradation - 1);
+    }
+}
+
+void PacedRunner::setDegradation(int degradation)
+{
+    stepsSinceAdapt = 0;
+    this->degradation = degradation;
+    model.setDecisionInterval(1 << degradation);
+}
+
+PaceReport const& PacedRunner::run(double until)
+{
+    while (model.global_time < until) {
+        step();
+    }
+    return report;
+}
+
+void PacedRunner::restart()
+{
+    started = false;
+}
+
+void PacedRunner::setSpeedUp(double speedUp)
+{
+    if (!(speedUp > 0)) {
+        throw std::invalid_argument("A paced run needs a positive speed-up.");
+    }
+    this->speedUp = speedUp;
+    report.stepBudget = stepLength / speedUp;
+    // The new target runs from the current state
+    anchorWall = lastWake;
+    anchorTime = model.global_time;
+}
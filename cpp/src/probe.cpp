@@ -0,0 +1,150 @@
+#include "probe.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+int ProbeSet::currentWorker()
+{
+    // Outside of a parallel phase, the calling thread counts as worker 0
+    return std::max(0, WorkerPool::currentWorker());
+}
+
+void ProbeSet::setFileIDs(std::vector<int> const& fileNodeIDs, std::vector<int> const& fileEdgeIDs)
+{
+    this->fileNodeIDs = &fileNodeIDs;
+    this->fileEdgeIDs = &fileEdgeIDs;
+}
+
+void ProbeSet::setNWorkers(int nWorkers)
+{
+    this->nWorkers = nWorkers;
+    for (auto& probe : probes) {
+        probe->setNWorkers(nWorkers);
+    }
+}
+
+void ProbeSet::add(std::shared_ptr<Probe> probe)
+{
+    if (std::find(probes.begin(), probes.end(), probe) != probes.end()) {
+        return;
+    }
+    probe->setNWorkers(nWorkers);
+    unsigned probeHooks = probe->getHooks();
+    for (int i = 0; i < ProbeHook::count; ++i) {
+        if (probeHooks & (1u << i)) {
+            byHook[i].push_back(probe.get());
+        }
+    }
+    hooks |= probeHooks;
+    probes.push_back(std::move(probe));
+}
+
+void ProbeSet::remove(std::shared_ptr<Probe> const& probe)
+{
+    probes.erase(std::remove(probes.begin(), probes.end(), probe), probes.end());
+    hooks = 0;
+    for (int i = 0; i < ProbeHook::count; ++i) {
+        byHook[i].erase(std::remove(byHook[i].begin(), byHook[i].end(), probe.get()), byHook[i].end());
+        if (!byHook[i].empty()) {
+            hooks |= 1u << i;
+        }
+    }
+}
+
+void ProbeSet::carSpawned(Car const& car, int node) const
+{
+    int worker = currentWorker();
+    for (Probe* probe : byHook[ProbeHook::index(ProbeHook::Spawn)]) {
+        probe->onSpawn(worker, car, (*fileNodeIDs)[node]);
+    }
+}
+
+void ProbeSet::carEnteredEdge(Car const& car, int edge) const
+{
+    int worker = currentWorker();
+    for (Probe* probe : byHook[ProbeHook::index(ProbeHook::EdgeEntry)]) {
+        probe->onEdgeEntry(worker, car, (*fileEdgeIDs)[edge]);
+    }
+}
+
+void ProbeSet::carExitedEdge(Car const& car, int edge) const
+{
+    int worker = currentWorker();
+    for (Probe* probe : byHook[ProbeHook::index(ProbeHook::EdgeExit)]) {
+        probe->onEdgeExit(worker, car, (*fileEdgeIDs)[edge]);
+    }
+}
+
+void ProbeSet::carChangedLane(Car const& car, int edge, int fromLane) const
+{
+    int worker = currentWorker();
+    for (Probe* probe : byHook[ProbeHook::index(ProbeHook::LaneChange)]) {
+        probe->onLaneChange(worker, car, (*fileEdgeIDs)[edge], fromLane);
+    }
+}
+
+void ProbeSet::carArrived(Car const& car, int node, TravelStats const& stats) const
+{
+    int worker = currentWorker();
+    auto [from, to, travelTime, startTime] = stats;
+    TravelStats fileStats((*fileNodeIDs)[from], (*fileNodeIDs)[to], travelTime, startTime);
+    for (Probe* probe : byHook[ProbeHook::index(ProbeHook::Arrival)]) {
+        probe->onArrival(worker, car, (*fileNodeIDs)[node], fileStats);
+    }
+}
+
+void ProbeSet::tickEnded(TrafficModel const& model) const
+{
+    for (Probe* probe : byHook[ProbeHook::index(ProbeHook::TickEnd)]) {
+        probe->onTickEnd(model);
+    }
+}
+
+EventCounter::EventCounter(int nNodes, int nEdges)
+    : nNodes(nNodes), nEdges(nEdges)
+{
+    resize(totals);
+}
+
+void EventCounter::resize(Counts& counts) const
+{
+    counts.edgeEntries.resize(nEdges);
+    counts.edgeExits.resize(nEdges);
+    counts.laneChanges.resize(nEdges);
+    counts.spawns.resize(nNodes);
+    counts.arrivals.resize(nNodes);
+}
+
+unsigned EventCounter::getHooks() const
+{
+    return ProbeHook::Spawn | ProbeHook::EdgeEntry | ProbeHook::EdgeExit | ProbeHook::LaneChange
+           | ProbeHook::Arrival | ProbeHook::TickEnd;
+}
+
+void EventCounter::setNWorkers(int nWorkers)
+{
+    // Counts of the workers are merged after every step, so nothing is lost by starting over
+    local = WorkerLocal<Counts>();
+    local.resize(nWorkers);
+    local.forEach([this](Counts& counts) {
+        resize(counts);
+    });
+}
+
+void EventCounter::onTickEnd(TrafficModel const& model)
+{
+    auto add = [](std::vector<long>& total, std::vector<long>& counts) {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            total[i] += counts[i];
+            counts[i] = 0;
+        }
+    };
+    local.forEach([&](Counts& counts) {
+        add(totals.edgeEntries, counts.edgeEntries);
+        add(totals.edgeExits, counts.edgeExits);
+        add(totals.laneChanges, counts.laneChanges);
+        add(totals.spawns, counts.spawns);
+        add(totals.arrivals, counts.arrivals);
+    });
+}
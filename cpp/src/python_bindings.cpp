@@ -0,0 +1,226 @@
+#include "paced_runner.h"
+#include "traffic_model.h"
+#include "traffic_assignment.h"
+#include "trajectory_reader.h"
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include <pybind11/numpy.h>
+
+
+PYBIND11_MODULE(traffic_model, m) {
+    pybind11::class_<TrafficModel>(m, "TrafficModel")
+        .def(pybind11::init<const std::string &, float, float>())
+        .def("step_forward", &TrafficModel::step)
+        .def("display", &TrafficModel::display)
+        .def("get_edge_ids", &TrafficModel::getEdgeIDs)
+        .def("get_node_ids", &TrafficModel::getNodeIDs)
+        .def("get_edge_road_length", &TrafficModel::getEdgeRoadLength)
+        .def("get_edge_start_node_id", &TrafficModel::getEdgeStartNodeID)
+        .def("get_edge_end_node_id", &TrafficModel::getEdgeEndNodeID)
+        .def("get_node_pos", &TrafficModel::getNodePosition)
+        .def("get_car_count_histogram_in_edge", &TrafficModel::getCarCountHistInEdge)
+        .def("set_car_count_histogram_bin_distance", &TrafficModel::setHistogramBinDistance)
+        .def("get_car_count_histograms", [](TrafficModel const& model) {
+            auto const& counts = model.getCarCountHists();
+            return pybind11::array_t<int>(counts.size(), counts.data());
+        })
+        .def("get_car_count_histogram_offsets", &TrafficModel::getCarCountHistOffsets)
+        .def("start_frame_stream", &TrafficModel::startFrameStream,
+             pybind11::arg("name"), pybind11::arg("bin_distance"), pybind11::arg("steps_per_frame") = 1,
+             pybind11::arg("n_slots") = 4, pybind11::arg("max_cars") = 0)
+        .def("stop_frame_stream", &TrafficModel::stopFrameStream)
+        .def("start_recording", &TrafficModel::startRecording,
+             pybind11::arg("fn"), pybind11::arg("ticks_per_chunk") = 600, pybind11::arg("max_pending_chunks") = 4)
+        .def("stop_recording", &TrafficModel::stopRecording)
+        .def("get_car_count_in_node", &TrafficModel::getCarCountInNode)
+        .def("get_fastest_path", &TrafficModel::getFastestPath)
+        .def("get_delta_time", &TrafficModel::getDeltaTime)
+        .def("get_n_cars_in_simulation", &TrafficModel::getNCarsInSimulation)
+        .def("get_n_cars_per_edge", &TrafficModel::getNCarsPerEdge)
+        .def("get_travel_stats", &TrafficModel::getTravelStats)
+        .def("get_car_pool_stats", &TrafficModel::getCarPoolStats)
+        .def("get_bytes_per_car", &TrafficModel::getBytesPerCar)
+        .def("compact_cars", &TrafficModel::compactCars)
+        .def("set_car_compaction_interval", &TrafficModel::setCarCompactionInterval)
+        .def("clone", &TrafficModel::clone)
+        .def_static("step_concurrently", &TrafficModel::stepConcurrently, pybind11::arg("models"),
+                    pybind11::arg("n_steps"))
+        .def("set_edge_closed", &TrafficModel::setEdgeClosed)
+        .def("is_edge_closed", &TrafficModel::isEdgeClosed)
+        .def("set_edge_speed_limit", &TrafficModel::setEdgeSpeedLimit)
+        .def("update_routes", &TrafficModel::updateRoutes)
+        .def("set_decision_interval", &TrafficModel::setDecisionInterval)
+        .def("get_decision_interval", &TrafficModel::getDecisionInterval)
+        .def("set_edge_high_priority", &TrafficModel::setEdgeHighPriority)
+        .def("set_edge_split_threshold", &TrafficModel::setEdgeSplitThreshold)
+        .def("get_edge_split_threshold", &TrafficModel::getEdgeSplitThreshold)
+        .def("is_edge_high_priority", &TrafficModel::isEdgeHighPriority)
+        .def("add_probe", &TrafficModel::addProbe)
+        .def("remove_probe", &TrafficModel::removeProbe)
+        .def("get_routing_stats", &TrafficModel::getRoutingStats)
+        .def("get_network_topology", [](TrafficModel const& model) {
+            NetworkTopology topology = model.getNetworkTopology();
+            pybind11::dict result;
+            result["node_x"] = pybind11::array_t<float>(topology.nodeX.size(), topology.nodeX.data());
+            result["node_y"] = pybind11::array_t<float>(topology.nodeY.size(), topology.nodeY.data());
+            result["edge_start"] = pybind11::array_t<std::int32_t>(topology.edgeStart.size(), topology.edgeStart.data());
+            result["edge_end"] = pybind11::array_t<std::int32_t>(topology.edgeEnd.size(), topology.edgeEnd.data());
+            result["edge_length"] = pybind11::array_t<float>(topology.edgeLength.size(), topology.edgeLength.data());
+            result["edge_lanes"] = pybind11::array_t<std::int32_t>(topology.edgeLanes.size(), topology.edgeLanes.data());
+            result["edge_speed_limit"] = pybind11::array_t<float>(topology.edgeSpeedLimit.size(),
+                                                                  topology.edgeSpeedLimit.data());
+            return result;
+        })
+        .def("fill_network_snapshot", &TrafficModel::fillNetworkSnapshot)
+        .def("set_thread_count", &TrafficModel::setThreadCount)
+        .def("get_thread_count", &TrafficModel::getThreadCount)
+        .def("get_active_counts", &TrafficModel::getActiveCounts)
+        .def("seed", &TrafficModel::seed)
+        .def("enable_state_digest", &TrafficModel::enableStateDigest)
+        .def("get_state_digest", &TrafficModel::getStateDigest)
+        .def("get_edge_state_digests", &TrafficModel::getEdgeStateDigests)
+        .def("get_node_state_digests", &TrafficModel::getNodeStateDigests)
+        // Arrays with one entry per car, dx and dv are +inf for a missing car ahead and -inf for one behind
+        .def("get_edge_observations", [](TrafficModel const& model, int idx) {
+            ObservationBatch observations = model.getEdgeObservations(idx);
+            auto column = [](auto const& values) {
+                using T = typename std::decay_t<decltype(values)>::value_type;
+                return pybind11::array_t<T>(values.size(), values.data());
+            };
+            pybind11::dict result;
+            result["ego_x"] = column(observations.egoX);
+            result["ego_v"] = column(observations.egoV);
+            result["ego_lane"] = column(observations.egoLane);
+            result["left_lane_exists"] = column(observations.leftLaneExists);
+            result["right_lane_exists"] = column(observations.rightLaneExists);
+            result["front_dx"] = column(observations.frontDx);
+            result["front_dv"] = column(observations.frontDv);
+            result["back_dx"] = column(observations.backDx);
+            result["back_dv"] = column(observations.backDv);
+            result["left_front_dx"] = column(observations.leftFrontDx);
+            result["left_front_dv"] = column(observations.leftFrontDv);
+            result["left_back_dx"] = column(observations.leftBackDx);
+            result["left_back_dv"] = column(observations.leftBackDv);
+            result["right_front_dx"] = column(observations.rightFrontDx);
+            result["right_front_dv"] = column(observations.rightFrontDv);
+            result["right_back_dx"] = column(observations.rightBackDx);
+            result["right_back_dv"] = column(observations.rightBackDv);
+            return result;
+        })
+        // Action codes: 0 none, 1 cruise, 2 hard brake, 3 to left lane and cruise, 4 to right lane and cruise
+        .def("get_edge_actions", &TrafficModel::getEdgeActions)
+        .def("set_edge_actions", &TrafficModel::setEdgeActions)
+        .def("load_demand", &TrafficModel::loadDemand)
+        .def("warm_start", &TrafficModel::warmStart, pybind11::arg("target_time"),
+             pybind11::arg("relaxation_time") = 0.0, pybind11::arg("edge_travel_times") = std::vector<float>())
+        .def("get_edge_travel_times", &TrafficModel::getEdgeTravelTimes)
+        .def("load_od_matrix", &TrafficModel::loadOdMatrix)
+        .def("load_trip_list", &TrafficModel::loadTripList, pybind11::arg("fn"),
+             pybind11::arg("n_slots") = TripSchedule::defaultNSlots)
+        .def("get_trip_list_stats", &TrafficModel::getTripListStats)
+        .def("get_n_od_pairs", &TrafficModel::getNODPairs)
+        .def("get_label_from_node_id", &TrafficModel::getLabelFromNodeID)
+        .def("get_label_from_edge_id", &TrafficModel::getLabelFromEdgeID);
+
+    // The arrays are views on the snapshot, which fill_network_snapshot updates in place
+    auto view = [](auto member) {
+        return [member](pybind11::object self) {
+            auto& values = self.cast<NetworkSnapshot&>().*member;
+            using T = typename std::decay_t<decltype(values)>::value_type;
+            return pybind11::array_t<T>(values.size(), values.data(), self);
+        };
+    };
+    pybind11::class_<NetworkSnapshot>(m, "NetworkSnapshot")
+        .def(pybind11::init<>())
+        .def_readonly("global_time", &NetworkSnapshot::globalTime)
+        .def_readonly("n_cars", &NetworkSnapshot::nCars)
+        .def_property_readonly("edge_cars", view(&NetworkSnapshot::edgeCars))
+        .def_property_readonly("edge_mean_speed", view(&NetworkSnapshot::edgeMeanSpeed))
+        .def_property_readonly("edge_queue", view(&NetworkSnapshot::edgeQueue))
+        .def_property_readonly("node_cars", view(&NetworkSnapshot::nodeCars));
+
+    // Probes are written in C++, Python only attaches them and reads their results
+    pybind11::class_<Probe, std::shared_ptr<Probe>>(m, "Probe");
+    auto counts = [](std::vector<long> const& (EventCounter::*getter)() const) {
+        return [getter](EventCounter const& counter) {
+            auto const& values = (counter.*getter)();
+            return pybind11::array_t<long>(values.size(), values.data());
+        };
+    };
+    pybind11::class_<EventCounter, Probe, std::shared_ptr<EventCounter>>(m, "EventCounter")
+        .def(pybind11::init<int, int>(), pybind11::arg("n_nodes"), pybind11::arg("n_edges"))
+        .def("get_edge_entries", counts(&EventCounter::getEdgeEntries))
+        .def("get_edge_exits", counts(&EventCounter::getEdgeExits))
+        .def("get_lane_changes", counts(&EventCounter::getLaneChanges))
+        .def("get_spawns", counts(&EventCounter::getSpawns))
+        .def("get_arrivals", counts(&EventCounter::getArrivals));
+
+    pybind11::class_<AssignmentIteration>(m, "AssignmentIteration")
+        .def_readonly("iteration", &AssignmentIteration::iteration)
+        .def_readonly("relative_gap", &AssignmentIteration::relativeGap)
+        .def_readonly("mean_travel_time", &AssignmentIteration::meanTravelTime)
+        .def_readonly("n_trips", &AssignmentIteration::nTrips)
+        .def_readonly("n_routes", &AssignmentIteration::nRoutes)
+        .def_readonly("wall_time", &AssignmentIteration::wallTime);
+
+    // Keeps the model alive while the assignment routes its cars
+    pybind11::class_<TrafficAssignment>(m, "TrafficAssignment")
+        .def(pybind11::init<TrafficModel&, double, double, double, unsigned int>(), pybind11::keep_alive<1, 2>(),
+             pybind11::arg("model"), pybind11::arg("start_time"), pybind11::arg("end_time"),
+             pybind11::arg("interval_length") = 900.0, pybind11::arg("seed") = 1)
+        .def("iterate", &TrafficAssignment::iterate)
+        .def("run", &TrafficAssignment::run, pybind11::arg("max_iterations"), pybind11::arg("target_gap") = 0.0)
+        .def("get_edge_travel_times", &TrafficAssignment::getEdgeTravelTimes)
+        .def("get_n_intervals", &TrafficAssignment::getNIntervals);
+
+    pybind11::class_<PaceReport>(m, "PaceReport")
+        .def_readonly("n_steps", &PaceReport::nSteps)
+        .def_readonly("simulated_time", &PaceReport::simulatedTime)
+        .def_readonly("wall_time", &PaceReport::wallTime)
+        .def_readonly("mean_step_time", &PaceReport::meanStepTime)
+        .def_readonly("max_step_time", &PaceReport::maxStepTime)
+        .def_readonly("step_budget", &PaceReport::stepBudget)
+        .def_readonly("lag", &PaceReport::lag)
+        .def_readonly("max_lag", &PaceReport::maxLag)
+        .def_readonly("slipped_time", &PaceReport::slippedTime)
+        .def_readonly("n_slips", &PaceReport::nSlips)
+        .def_readonly("n_degraded_steps", &PaceReport::nDegradedSteps)
+        .def_readonly("degradation", &PaceReport::degradation);
+
+    // Keeps the model alive while the runner paces it
+    pybind11::class_<PacedRunner>(m, "PacedRunner")
+        .def(pybind11::init<TrafficModel&, double, double, int>(), pybind11::keep_alive<1, 2>(),
+             pybind11::arg("model"), pybind11::arg("speed_up"), pybind11::arg("max_lag") = 10.0,
+             pybind11::arg("max_degradation") = PacedRunner::defaultMaxDegradation)
+        .def("step", &PacedRunner::step)
+        .def("run", &PacedRunner::run, pybind11::return_value_policy::copy)
+        .def("restart", &PacedRunner::restart)
+        .def("set_speed_up", &PacedRunner::setSpeedUp)
+        .def("get_speed_up", &PacedRunner::getSpeedUp)
+        .def("get_degradation", &PacedRunner::getDegradation)
+        .def("get_report", &PacedRunner::getReport, pybind11::return_value_policy::copy);
+
+    pybind11::class_<TrajectoryReader>(m, "TrajectoryReader")
+        .def(pybind11::init<const std::string &>())
+        .def("get_n_chunks", &TrajectoryReader::getNChunks)
+        .def("get_n_edges", &TrajectoryReader::getNEdges)
+        .def("get_delta_time", &TrajectoryReader::getDeltaTime)
+        .def("get_chunk_time_range", &TrajectoryReader::getChunkTimeRange)
+        .def("find_chunk", &TrajectoryReader::findChunk)
+        // (tick_times, tick_offsets, ids, edges, x, v, lanes), the rows of tick i are [tick_offsets[i], tick_offsets[i + 1])
+        .def("read_chunk", [](TrajectoryReader const& reader, int idx) {
+            TrajectoryChunk chunk = reader.readChunk(idx);
+            return std::make_tuple(
+                pybind11::array_t<double>(chunk.tickTimes.size(), chunk.tickTimes.data()),
+                pybind11::array_t<std::int64_t>(chunk.tickOffsets.size(), chunk.tickOffsets.data()),
+                pybind11::array_t<std::int32_t>(chunk.ids.size(), chunk.ids.data()),
+                pybind11::array_t<std::int32_t>(chunk.edges.size(), chunk.edges.data()),
+                pybind11::array_t<float>(chunk.xs.size(), chunk.xs.data()),
+                pybind11::array_t<float>(chunk.vs.size(), chunk.vs.data()),
+                pybind11::array_t<std::int32_t>(chunk.lanes.size(), chunk.lanes.data()));
+        });
+
+    // Where models built afterwards cache their routes, see RouteCache
+    m.def("set_route_cache_directory", &RouteCache::setDirectory, pybind11::arg("directory"));
+    m.def("set_route_cache_enabled", &RouteCache::setEnabled, pybind11::arg("enabled"));
+}
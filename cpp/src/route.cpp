@@ -1,8 +1,16 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <string>
 #include <vector>
-#include <queue>
 #include "route.h"
 #include "node/node.h"
 #include "edge/edge.h"
+#include "state_digest.h"
+#include <unistd.h>
 
 // This is a custom comparator for the priority queue
 struct ComparePair {
@@ -11,79 +19,118 @@ struct ComparePair {
     }
 };
 
-std::vector<std::vector<int>> computeMapping(std::vector<std::shared_ptr<Node>>& nodes) {
-    int n = nodes.size();
-    std::vector<std::vector<int>> arr(n, std::vector<int>(n, -1));
-
-    for (auto startNode : nodes) {
-        std::priority_queue<std::pair<float, int>, std::vector<std::pair<float, int>>, ComparePair> pq;
-        std::vector<float> dist(n, std::numeric_limits<float>::infinity());
-        std::vector<int> prev(n, -1);
-
-        pq.emplace(0.0f, startNode->id);
-        dist[startNode->id] = 0.0f;
-
-        while (!pq.empty()) {
-            auto [currDist, currNodeID] = pq.top();
-            pq.pop();
-
-            auto currNode = nodes[currNodeID];
+namespace {
+    // Buffers of one worker, reused for all of its sources
+    struct DijkstraBuffers
+    {
+        std::vector<std::pair<float, int>> heap; // with the operations of std::priority_queue, for the same tie order
+        std::vector<float> dist;
+        std::vector<int> prev;
+        std::vector<int> settled; // in the order they were popped
+    };
+
+    // Fills firstHop[v] with the node after the source on the fastest path to v
+    void computeFirstHops(std::vector<std::shared_ptr<Node>> const& nodes, int startNodeID, DijkstraBuffers& buffers,
+                          std::vector<int>& firstHop) {
+        int n = nodes.size();
+        auto& heap = buffers.heap;
+        heap.clear();
+        buffers.dist.assign(n, std::numeric_limits<float>::infinity());
+        buffers.prev.assign(n, -1);
+        buffers.settled.clear();
+        auto& dist = buffers.dist;
+        auto& prev = buffers.prev;
+
+        heap.emplace_back(0.0f, startNodeID);
+        dist[startNodeID] = 0.0f;
+
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), ComparePair());
+            auto [currDist, currNodeID] = heap.back();
+            heap.pop_back();
+            if (currDist > dist[currNodeID]) {
+                continue;
+            }
+            buffers.settled.push_back(currNodeID);
 
-            for (Edge& edgeRef : currNode->outEdges) {
-                Edge& edge = edgeRef;
+            for (Edge& edge : nodes[currNodeID]->outEdges) {
+                if (edge.isClosed()) {
+                    continue;
+                }
                 float alt = currDist + edge.getExpectedCrossingTime();
                 int nextNodeID = edge.outNode.id;
 
                 if (alt < dist[nextNodeID]) {
                     dist[nextNodeID] = alt;
                     prev[nextNodeID] = currNodeID;
-                    pq.push({alt, nextNodeID});
-
-                    // Update the arr with this node as the "stepping stone" to nextNode
-                    int temp = nextNodeID;
-                    while (prev[temp] != startNode->id) {
-                        temp = prev[temp];
-                    }
-                    arr[nextNodeID][startNode->id] = temp;
+                    heap.emplace_back(alt, nextNodeID);
+                    std::push_heap(heap.begin(), heap.end(), ComparePair());
                 }
             }
         }
+
+        // A node is settled after its predecessor, so the "stepping stone" of the predecessor is known
+        firstHop.assign(n, -1);
+        for (int nodeID : buffers.settled) {
+            if (nodeID != startNodeID) {
+                firstHop[nodeID] = prev[nodeID] == startNodeID ? nodeID : firstHop[prev[nodeID]];
+            }
+        }
     }
 
-    return arr;
-}
+    struct RouteCacheHeader
+    {
+        static constexpr std::uint32_t magicValue = 0x43545254; // "TRTC"
+        static constexpr std::uint32_t currentVersion = 1;
+
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint64_t key;
+        std::uint64_t nNodes;
+    };
 
+    std::atomic<long> nCacheHits{0};
+    std::atomic<long> nCacheMisses{0};
+    std::atomic<long> nStores{0}; // tells apart the temporary files of one process
 
-std::vector<std::vector<float>> computeProbabilities(std::vector<int> populations) {
-    int n = populations.size();
-    std::vector<std::vector<float>> arr(n, std::vector<float>(n, 0.0f));
+    std::mutex settingsMutex;
+    std::string cacheDirectory;
+    bool cacheEnabled = true;
+}
 
-    float sum = 0;
-    for (int i = 0; i < n; ++i) {
-        arr[i][i] = 0.0f;
-        for (int j = i + 1; j < n; ++j) {
-            float p = (float) populations[i] * (float) populations[j];
-            arr[i][j] = p;
-            arr[j][i] = p;
-            sum += 2 * p;
+std::vector<std::vector<int>> computeMapping(std::vector<std::shared_ptr<Node>>& nodes, WorkerPool& workers) {
+    int n = nodes.size();
+    // Rows by source, written by one worker each, and turned into rows by destination at the end
+    std::vector<std::vector<int>> firstHops(n);
+    workers.parallelFor(n, [&nodes, &firstHops](int, int begin, int end) {
+        DijkstraBuffers buffers;
+        for (int startNodeID = begin; startNodeID < end; ++startNodeID) {
+            computeFirstHops(nodes, startNodeID, buffers, firstHops[startNodeID]);
         }
-    }
+    });
 
-    for (int i = 0; i < n; ++i) {
-        for (int j = 0; j < n; ++j) {
-            arr[i][j] /= sum;
+    std::vector<std::vector<int>> arr(n, std::vector<int>(n, -1));
+    for (int start = 0; start < n; ++start) {
+        for (int end = 0; end < n; ++end) {
+            arr[end][start] = firstHops[start][end];
         }
     }
-
     return arr;
 }
 
 
 std::vector<int> reconstructPath(const std::vector<std::vector<int>>& arr, int startNodeId, int endNodeId) {
     std::vector<int> path;
+    reconstructPath(arr, startNodeId, endNodeId, path);
+    return path;
+}
+
+
+void reconstructPath(const std::vector<std::vector<int>>& arr, int startNodeId, int endNodeId, std::vector<int>& path) {
+    path.clear();
     if (arr[endNodeId][startNodeId] == -1) {
         // No path exists from startNodeId to endNodeId.
-        return path;
+        return;
     }
 
     path.push_back(startNodeId);
@@ -91,7 +138,87 @@ std::vector<int> reconstructPath(const std::vector<std::vector<int>>& arr, int s
         startNodeId = arr[endNodeId][startNodeId];
         path.push_back(startNodeId);
     }
+}
+
+RouteCache::RouteCache(std::string fn, std::vector<std::shared_ptr<Node>> const& nodes)
+    : fn(std::move(fn))
+{
+    // Everything computeMapping depends on: the cost of every edge, in the order it is relaxed
+    key = StateDigest::combine(costVersion, nodes.size());
+    for (auto const& node : nodes) {
+        key = StateDigest::combine(key, node->id);
+        for (Edge const& edge : node->outEdges) {
+            key = StateDigest::combine(key, edge.getOutNode().getID());
+            key = StateDigest::combine(key, StateDigest::bits(edge.getExpectedCrossingTime()));
+        }
+    }
+}
 
-    return path;
+bool RouteCache::load(std::vector<std::vector<int>>& arr) const {
+    if (fn.empty()) {
+        return false;
+    }
+    std::ifstream file(fn, std::ios::binary);
+    RouteCacheHeader header{};
+    bool hit = file.read(reinterpret_cast<char*>(&header), sizeof(header))
+               && header.magic == RouteCacheHeader::magicValue && header.version == RouteCacheHeader::currentVersion
+               && header.key == key;
+    if (hit) {
+        arr.assign(header.nNodes, std::vector<int>(header.nNodes));
+        for (auto& row : arr) {
+            hit &= bool(file.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(int)));
+        }
+    }
+    (hit ? nCacheHits : nCacheMisses)++;
+    return hit;
+}
+
+void RouteCache::store(std::vector<std::vector<int>> const& arr) const {
+    if (fn.empty()) {
+        return;
+    }
+    // Unique per writer, so processes and models storing the same network at once do not write into one file
+    std::string tmp = fn + "." + std::to_string(getpid()) + "." + std::to_string(nStores++) + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        RouteCacheHeader header{RouteCacheHeader::magicValue, RouteCacheHeader::currentVersion, key, arr.size()};
+        file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        for (auto const& row : arr) {
+            file.write(reinterpret_cast<char const*>(row.data()), row.size() * sizeof(int));
+        }
+        if (!file.flush()) {
+            std::remove(tmp.c_str());
+            return;
+        }
+    }
+    if (std::rename(tmp.c_str(), fn.c_str()) != 0) {
+        std::remove(tmp.c_str());
+    }
+}
+
+std::tuple<long, long> RouteCache::getStats() {
+    return std::make_tuple(nCacheHits.load(), nCacheMisses.load());
+}
+
+std::string RouteCache::getPath(std::string const& networkFn) {
+    std::lock_guard<std::mutex> lock(settingsMutex);
+    if (!cacheEnabled) {
+        return "";
+    }
+    if (cacheDirectory.empty()) {
+        return networkFn + ".routes";
+    }
+    size_t slash = networkFn.find_last_of('/');
+    std::string name = slash == std::string::npos ? networkFn : networkFn.substr(slash + 1);
+    return cacheDirectory + "/" + name + ".routes";
 }
 
+void RouteCache::setDirectory(std::string directory) {
+    std::lock_guard<std::mutex> lock(settingsMutex);
+    cacheDirectory = std::move(directory);
+}
+
+void RouteCache::setEnabled(bool enabled) {
+    std::lock_guard<std::mutex> lock(settingsMutex);
+    cacheEnabled = enabled;
+}
@@ -0,0 +1,304 @@
+#include "traffic_assignment.h"
+#include "traffic_model.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+bool RouteChoice::choose(double time, int origin, int destination, double u, std::vector<int>& path)
+{
+    int interval = getInterval(time);
+    std::int64_t key = ((std::int64_t) interval * nNodes + origin) * nNodes + destination;
+    auto it = routes.find(key);
+    if (it == routes.end()) {
+        it = routes.emplace(key, OdRoutes{interval, origin, destination, {}, {}, 0}).first;
+    }
+    OdRoutes& od = it->second;
+    od.nDepartures++;
+    if (od.paths.empty()) {
+        return false;
+    }
+    size_t i = 0;
+    while (i + 1 < od.paths.size() && u >= od.shares[i]) {
+        u -= od.shares[i];
+        i++;
+    }
+    path.assign(od.paths[i].begin(), od.paths[i].end());
+    return true;
+}
+
+void RouteChoice::resetDepartures()
+{
+    for (auto& [key, od] : routes) {
+        od.nDepartures = 0;
+    }
+}
+
+int RouteChoice::getNRoutes() const
+{
+    int n = 0;
+    for (auto const& [key, od] : routes) {
+        n += od.paths.size();
+    }
+    return n;
+}
+
+TrafficAssignment::TrafficAssignment(TrafficModel& model, double startTime, double endTime, double intervalLength,
+                                     unsigned int seed)
+    : model(model), startTime(startTime), endTime(endTime), seed(seed),
+      routeChoice(intervalLength, model.getNNodes()), workers(model.getThreadCount())
+{
+    if (!(intervalLength > 0) || !(endTime > startTime)) {
+        throw std::invalid_argument("Expected a positive interval length and an end after the start.");
+    }
+    outEdges.resize(model.getNNodes());
+    for (int i = 0; i < model.getNEdges(); ++i) {
+        edgeStarts.push_back(model.getEdgeStartNodeID(i));
+        edgeEnds.push_back(model.getEdgeEndNodeID(i));
+        outEdges[edgeStarts.back()].push_back(i);
+        freeFlowTimes.push_back(model.getEdge(i).getExpectedCrossingTime() / model.getScale());
+    }
+    model.setRouteChoice(&routeChoice);
+}
+
+TrafficAssignment::~TrafficAssignment()
+{
+    model.setRouteChoice(nullptr);
+}
+
+void TrafficAssignment::simulate()
+{
+    model.clearTraffic(startTime);
+    model.seed(seed);
+    routeChoice.resetDepartures();
+
+    int nEdges = model.getNEdges();
+    int nIntervals = routeChoice.getInterval(endTime) + 1;
+    std::vector<std::vector<double>> occupancy(nIntervals, std::vector<double>(nEdges, 0)); // in car s
+    std::vector<std::vector<long>> exits(nIntervals, std::vector<long>(nEdges, 0));
+    std::vector<long> lastExits(nEdges, 0);
+    while (model.global_time < endTime) {
+        double time = model.global_time;
+        model.step();
+        double stepTime = model.global_time - time;
+        int interval = std::min(routeChoice.getInterval(time), nIntervals - 1);
+        for (int i = 0; i < nEdges; ++i) {
+            Edge const& edge = model.getEdge(i);
+            occupancy[interval][i] += edge.getNCars() * stepTime;
+            exits[interval][i] += edge.getNExitedCars() - lastExits[i];
+            lastExits[i] = edge.getNExitedCars();
+        }
+    }
+
+    // Little's law: the mean time on an edge is the time spent by all cars over the cars that passed
+    travelTimes.assign(nIntervals, std::vector<float>(nEdges));
+    for (int interval = 0; interval < nIntervals; ++interval) {
+        for (int i = 0; i < nEdges; ++i) {
+            double measured = occupancy[interval][i] / std::max(exits[interval][i], 1L);
+            travelTimes[interval][i] = std::max((float) measured, freeFlowTimes[i]);
+        }
+    }
+}
+
+float TrafficAssignment::getTravelTime(int edge, double time) const
+{
+    if (travelTimes.empty()) {
+        return freeFlowTimes[edge];
+    }
+    int interval = std::clamp(routeChoice.getInterval(time), 0, (int) travelTimes.size() - 1);
+    return travelTimes[interval][edge];
+}
+
+double TrafficAssignment::getPathTime(std::vector<int> const& path, double time) const
+{
+    double arrival = time;
+    for (size_t k = 0; k + 1 < path.size(); ++k) {
+        auto const& edges = outEdges[path[k]];
+        auto edge = std::find_if(edges.begin(), edges.end(), [&](int e) { return edgeEnds[e] == path[k + 1]; });
+        if (edge == edges.end()) {
+            return -1;
+        }
+        arrival += getTravelTime(*edge, arrival);
+    }
+    return arrival - time;
+}
+
+void TrafficAssignment::findFastestPaths(int origin, double time, std::vector<RouteChoice::OdRoutes*> const& pairs,
+                                         SearchBuffers& buffers, std::vector<std::vector<int>>& paths,
+                                         std::vector<double>& times) const
+{
+    // Time dependent Dijkstra: an edge is entered at the arrival time at its start
+    auto& heap = buffers.heap;
+    auto& arrival = buffers.arrival;
+    auto later = std::greater<std::pair<double, int>>();
+    heap.clear();
+    arrival.assign(outEdges.size(), std::numeric_limits<double>::infinity());
+    buffers.previousEdge.assign(outEdges.size(), -1);
+    arrival[origin] = time;
+    heap.emplace_back(time, origin);
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        auto [nodeTime, node] = heap.back();
+        heap.pop_back();
+        if (nodeTime > arrival[node]) {
+            continue;
+        }
+        for (int edge : outEdges[node]) {
+            double next = nodeTime + getTravelTime(edge, nodeTime);
+            if (next < arrival[edgeEnds[edge]]) {
+                arrival[edgeEnds[edge]] = next;
+                buffers.previousEdge[edgeEnds[edge]] = edge;
+                heap.emplace_back(next, edgeEnds[edge]);
+                std::push_heap(heap.begin(), heap.end(), later);
+            }
+        }
+    }
+
+    paths.resize(pairs.size());
+    times.resize(pairs.size());
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        int node = pairs[i]->destination;
+        auto& path = paths[i];
+        path.clear();
+        times[i] = arrival[node] - time;
+        if (buffers.previousEdge[node] == -1) {
+            continue;
+        }
+        while (node != origin) {
+            path.push_back(node);
+            node = edgeStarts[buffers.previousEdge[node]];
+        }
+        path.push_back(origin);
+        std::reverse(path.begin(), path.end());
+    }
+}
+
+AssignmentIteration TrafficAssignment::iterate()
+{
+    auto wallStart = std::chrono::steady_clock::now();
+    simulate();
+    iteration++;
+
+    // Pairs that had departures, grouped by interval and origin such that one search serves a group
+    std::map<std::pair<int, int>, std::vector<RouteChoice::OdRoutes*>> groupsByOrigin;
+    for (auto& [key, od] : routeChoice.getRoutes()) {
+        if (od.nDepartures == 0) {
+            continue;
+        }
+        if (od.paths.empty()) {
+            // These departures took the fastest free flow path
+            std::vector<int> path = model.getFastestPath(od.origin, od.destination);
+            if (path.empty()) {
+                continue;
+            }
+            od.paths.push_back(std::move(path));
+            od.shares.push_back(1);
+        }
+        groupsByOrigin[{od.interval, od.origin}].push_back(&od);
+    }
+    std::vector<std::pair<std::pair<int, int>, std::vector<RouteChoice::OdRoutes*>>> groups(
+        groupsByOrigin.begin(), groupsByOrigin.end());
+    std::vector<std::vector<std::vector<int>>> fastestPaths(groups.size());
+    std::vector<std::vector<double>> fastestTimes(groups.size());
+    auto departureOf = [this](int interval) {
+        double time = (interval + 0.5) * routeChoice.getIntervalLength();
+        return std::clamp(time, startTime, endTime);
+    };
+    workers.parallelFor(groups.size(), [&](int, int begin, int end) {
+        SearchBuffers buffers;
+        for (int i = begin; i < end; ++i) {
+            auto const& [interval, origin] = groups[i].first;
+            findFastestPaths(origin, departureOf(interval), groups[i].second, buffers, fastestPaths[i],
+                             fastestTimes[i]);
+        }
+    });
+
+    // Gap of the routes that were simulated, then the step towards the fastest paths
+    double experienced = 0;
+    double shortest = 0;
+    double stepSize = 1.0 / (iteration + 1);
+    for (size_t i = 0; i < groups.size(); ++i) {
+        double departure = departureOf(groups[i].first.first);
+        for (size_t j = 0; j < groups[i].second.size(); ++j) {
+            RouteChoice::OdRoutes& od = *groups[i].second[j];
+            std::vector<int> const& fastest = fastestPaths[i][j];
+            if (fastest.empty()) {
+                continue;
+            }
+            for (size_t p = 0; p < od.paths.size(); ++p) {
+                experienced += od.nDepartures * od.shares[p] * getPathTime(od.paths[p], departure);
+            }
+            shortest += od.nDepartures * fastestTimes[i][j];
+
+            for (double& share : od.shares) {
+                share *= 1 - stepSize;
+            }
+            auto known = std::find(od.paths.begin(), od.paths.end(), fastest);
+            if (known != od.paths.end()) {
+                od.shares[known - od.paths.begin()] += stepSize;
+            } else {
+                od.paths.push_back(fastest);
+                od.shares.push_back(stepSize);
+            }
+            double total = 0;
+            size_t kept = 0;
+            for (size_t p = 0; p < od.paths.size(); ++p) {
+                if (od.shares[p] < minShare) {
+                    continue;
+                }
+                if (kept != p) {
+                    od.paths[kept] = std::move(od.paths[p]);
+                    od.shares[kept] = od.shares[p];
+                }
+                total += od.shares[kept++];
+            }
+            od.paths.resize(kept);
+            od.shares.resize(kept);
+            for (double& share : od.shares) {
+                share /= total;
+            }
+        }
+    }
+
+    AssignmentIteration result{};
+    result.iteration = iteration;
+    result.relativeGap = experienced > 0 ? (experienced - shortest) / experienced : 0;
+    auto travelStats = model.getTravelStats();
+    double totalTravelTime = 0;
+    for (auto const& [from, to, travelTime, start] : travelStats) {
+        totalTravelTime += travelTime;
+    }
+    result.nTrips = travelStats.size();
+    result.meanTravelTime = travelStats.empty() ? 0 : totalTravelTime / travelStats.size();
+    result.nRoutes = routeChoice.getNRoutes();
+    result.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    return result;
+}
+
+std::vector<AssignmentIteration> TrafficAssignment::run(int maxIterations, double targetGap)
+{
+    std::vector<AssignmentIteration> results;
+    for (int i = 0; i < maxIterations; ++i) {
+        results.push_back(iterate());
+        AssignmentIteration const& last = results.back();
+        std::cout << "Iteration " << last.iteration << ": relative gap " << last.relativeGap << ", mean travel time "
+                  << last.meanTravelTime << " s over " << last.nTrips << " trips, " << last.nRoutes << " routes, "
+                  << last.wallTime << " s\n";
+        if (last.relativeGap < targetGap) {
+            break;
+        }
+    }
+    return results;
+}
+
+std::vector<float> TrafficAssignment::getEdgeTravelTimes(int interval) const
+{
+    if (travelTimes.empty()) {
+        return freeFlowTimes;
+    }
+    return travelTimes.at(interval);
+}
@@ -1,18 +1,47 @@
 #include "traffic_model.h"
-#include <pybind11/pybind11.h>
-#include <pybind11/stl.h>
 #include "edge/basic_road/basic_road.h"
 #include "node/basic_city.h"
+#include "node/intersection.h"
+#include "network_order.h"
 #include "route.h"
+#include "state_digest.h"
+#include "traffic_assignment.h"
 
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <vector>
 #include <chrono>
+#include <numeric>
+#include <thread>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    // Adds the ids woken by the workers to an active set, once each, and keeps the set in id order for locality
+    void schedule(std::vector<std::vector<int>>& woken, std::vector<char>& scheduled, std::vector<int>& active) {
+        size_t nActive = active.size();
+        for (auto& ids : woken) {
+            for (int id : ids) {
+                if (!scheduled[id]) {
+                    scheduled[id] = 1;
+                    active.push_back(id);
+                }
+            }
+            ids.clear();
+        }
+        if (active.size() > nActive) {
+            std::sort(active.begin(), active.end());
+        }
+    }
+}
 
 TrafficModel::TrafficModel(std::string fn, float delta_time, float scale)
-    : delta_time(delta_time), population(0), global_time(0), scale(scale)
+    : workers(std::make_unique<WorkerPool>()), delta_time(delta_time), population(0), global_time(0), scale(scale)
 {
     std::ifstream file(fn);
     std::string str(std::istreambuf_iterator<char>{file}, {});
@@ -21,12 +50,36 @@ TrafficModel::TrafficModel(std::string fn, float delta_time, float scale)
     std::cout << "TrafficModel built.\n";
     std::cout << "Nodes: " << nodes.size() << "\n";
     std::cout << "Edges: " << edges.size() << "\n";
-    setIDs();
-    shortestPathMapping = computeMapping(nodes);
-    std::vector<int> populations;
+    renumber();
+    carPool.setScale(scale);
+    probes.setFileIDs(fileNodeIDs, fileEdgeIDs);
+    for (auto& node : nodes) {
+        node->carPool = &carPool;
+        node->probes = &probes;
+        node->clock = &nodeClock;
+        node->prepare();
+    }
+    for (auto& edge : edges) {
+        edge->setProbes(&probes);
+    }
+    // Routes depend on the network only, so they are shared by every model of the same network through a cache file
+    auto routingStart = std::chrono::steady_clock::now();
+    RouteCache routeCache(RouteCache::getPath(fn), nodes);
+    auto mapping = std::make_shared<std::vector<std::vector<int>>>();
+    routesFromCache = routeCache.load(*mapping) && (int) mapping->size() == (int) nodes.size();
+    if (!routesFromCache) {
+        WorkerPool routingWorkers(std::max(1, (int) std::thread::hardware_concurrency()));
+        *mapping = computeMapping(nodes, routingWorkers);
+        routeCache.store(*mapping);
+    }
+    shortestPathMapping = std::move(mapping);
+    routingTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - routingStart).count();
+    std::cout << "Routes: " << (routesFromCache ? "loaded from cache" : "computed") << " in " << routingTime << " s\n";
     populations.reserve(nodes.size());
+    for (int i : internalNodeIDs) {
+        populations.push_back(nodes[i]->population * scale);
+    }
     for (auto& node : nodes) {
-        populations.push_back(node->population * scale);
         node->x *= scale;
         node->y *= scale;
     }
@@ -34,64 +87,610 @@ TrafficModel::TrafficModel(std::string fn, float delta_time, float scale)
         edge -> length *= scale;
     }
     population = std::accumulate(populations.begin(), populations.end(), 0);
-    mappingProbabilities = computeProbabilities(populations);
+    // Every city sends a tenth of its population on a trip per day
+    tripsPerDay = (double) population * 0.1 * scale;
     generator = std::default_random_engine(std::chrono::system_clock::now().time_since_epoch().count());
     distribution = std::uniform_real_distribution<float>(0.0f, 1.0f);
+    carPool.seed(generator());
+    useDefaultDemand();
+    wokenEdges.resize(workers->size());
+    wokenNodes.resize(workers->size());
+    scheduleAll();
+}
+
+TrafficModel::TrafficModel(TrafficModel const& other)
+    : carPool(other.carPool), carCompactionInterval(other.carCompactionInterval),
+      nStepsSinceCompaction(other.nStepsSinceCompaction), workers(std::make_unique<WorkerPool>(other.getThreadCount())),
+      shortestPathMapping(other.shortestPathMapping), routesStale(other.routesStale),
+      decisionInterval(other.decisionInterval), nodeClock(other.nodeClock), routesFromCache(other.routesFromCache),
+      routingTime(other.routingTime), delta_time(other.delta_time),
+      population(other.population), internalNodeIDs(other.internalNodeIDs), fileNodeIDs(other.fileNodeIDs),
+      internalEdgeIDs(other.internalEdgeIDs), fileEdgeIDs(other.fileEdgeIDs), scale(other.scale),
+      demand(other.demand), odMatrix(other.odMatrix), populations(other.populations), tripsPerDay(other.tripsPerDay),
+      stateDigestEnabled(other.stateDigestEnabled), stateDigest(other.stateDigest), edgeDigests(other.edgeDigests), nodeDigests(other.nodeDigests),
+      activeEdges(other.activeEdges), activeNodes(other.activeNodes), edgeScheduled(other.edgeScheduled),
+      splitThreshold(other.splitThreshold),
+      nodeScheduled(other.nodeScheduled), wokenEdges(other.wokenEdges.size()), wokenNodes(other.wokenNodes.size()),
+      generator(other.generator), distribution(other.distribution), global_time(other.global_time)
+{
+    // Nodes and edges keep their ids, and every car its id in the copied pool
+    for (auto const& node : other.nodes) {
+        nodes.push_back(node->clone(carPool));
+    }
+    for (auto const& edge : other.edges) {
+        edges.push_back(edge->clone(*nodes[edge->getInNode().getID()], *nodes[edge->getOutNode().getID()], carPool));
+    }
+    // Edges register with their nodes as they are made, the nodes get the order of the original instead
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        Node& node = *nodes[i];
+        node.inEdges.clear();
+        node.outEdges.clear();
+        for (Edge const& edge : other.nodes[i]->inEdges) {
+            node.inEdges.emplace_back(*edges[edge.getID()]);
+        }
+        for (Edge const& edge : other.nodes[i]->outEdges) {
+            node.outEdges.emplace_back(*edges[edge.getID()]);
+        }
+        node.carPool = &carPool;
+        node.probes = &probes;
+        node.clock = &nodeClock;
+        labelToNode[node.getLabel()] = nodes[i];
+    }
+    for (auto& edge : edges) {
+        edge->setProbes(&probes);
+        labelToEdge[edge->getLabel()] = edge;
+    }
+    probes.setFileIDs(fileNodeIDs, fileEdgeIDs);
+    probes.setNWorkers(workers->size());
+    carPool.setNWorkers(workers->size());
+    if (other.tripList) {
+        tripList = std::make_unique<TripSchedule>(*other.tripList, [this](std::string const& label) {
+            return getNodeIDFromLabel(label);
+        });
+    }
+    if (!other.histogramOffsets.empty()) {
+        setHistogramBinDistance(other.edges.front()->getHistogramBinDistance());
+    }
+}
+
+std::unique_ptr<TrafficModel> TrafficModel::clone() const {
+    return std::unique_ptr<TrafficModel>(new TrafficModel(*this));
+}
+
+void TrafficModel::stepConcurrently(std::vector<TrafficModel*> const& models, int nSteps) {
+    // Plain threads, as every model runs the phases of its steps on a worker pool of its own
+    int nThreads = std::min((int) models.size(), std::max(1, (int) std::thread::hardware_concurrency()));
+    std::atomic<int> next{0};
+    std::vector<std::exception_ptr> errors(models.size());
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nThreads; ++t) {
+        threads.emplace_back([&] {
+            for (int i = next++; i < (int) models.size(); i = next++) {
+                try {
+                    for (int step = 0; step < nSteps; ++step) {
+                        models[i]->step();
+                    }
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto const& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+void TrafficModel::setEdgeClosed(int idx, bool closed) {
+    Edge& edge = getEdge(idx);
+    if (edge.isClosed() != closed) {
+        edge.setClosed(closed);
+        routesStale = true;
+    }
+}
+
+void TrafficModel::setEdgeSpeedLimit(int idx, float speedLimit) {
+    if (!(speedLimit > 0)) {
+        throw std::invalid_argument("A speed limit has to be positive.");
+    }
+    getEdge(idx).setSpeedLimit(speedLimit);
+    routesStale = true;
+}
+
+void TrafficModel::updateRoutes() {
+    if (!routesStale) {
+        return;
+    }
+    routesStale = false;
+    // A mapping of this model alone, the one shared with other clones and the route cache are left as they are
+    shortestPathMapping = std::make_shared<std::vector<std::vector<int>> const>(computeMapping(nodes, *workers));
+    rerouteAroundClosures();
+}
+
+void TrafficModel::setDecisionInterval(int nSteps) {
+    if (nSteps < 1) {
+        throw std::invalid_argument("The decision interval has to be at least one step.");
+    }
+    decisionInterval = nSteps;
+    for (auto& edge : edges) {
+        edge->setDecisionInterval(edge->isHighPriority() ? 1 : nSteps);
+    }
+}
+
+void TrafficModel::setEdgeHighPriority(int idx, bool highPriority) {
+    Edge& edge = getEdge(idx);
+    edge.setHighPriority(highPriority);
+    edge.setDecisionInterval(highPriority ? 1 : decisionInterval);
+}
+
+void TrafficModel::rerouteAroundClosures() {
+    auto isClosed = [this](int from, int to) {
+        for (Edge const& edge : nodes[from]->outEdges) {
+            if (edge.getOutNode().getID() == to) {
+                return edge.isClosed();
+            }
+        }
+        return false;
+    };
+    std::vector<int> path;
+    // from is the next node the car decides at, the one it is heading to or the one it is held by
+    auto reroute = [&](Car& car, int from) {
+        auto const& trip = carPool.getTrip(car).path;
+        int heading = (int) trip.size() - car.getNRemainingNodes();
+        int start = heading < (int) trip.size() && trip[heading] == from ? heading : heading - 1;
+        bool crossesClosure = false;
+        for (int k = start; k + 1 < (int) trip.size() && !crossesClosure; ++k) {
+            crossesClosure = isClosed(trip[k], trip[k + 1]);
+        }
+        if (!crossesClosure) {
+            return;
+        }
+        reconstructPath(*shortestPathMapping, from, trip.back(), path);
+        if (!path.empty()) {
+            carPool.reroute(car, path);
+        }
+    };
+    for (auto& edge : edges) {
+        int outNode = edge->getOutNode().getID();
+        edge->getCars().forEach([&](Car const& car) {
+            reroute(carPool.get(car.getID()), outNode);
+        });
+    }
+    for (auto& node : nodes) {
+        int id = node->getID();
+        node->rerouteCars([&](Car& car) {
+            reroute(car, id);
+        });
+    }
+}
+
+void TrafficModel::useDefaultDemand() {
+    // One stream per origin with the rush hour profile, which averages to a multiplier of one over the day
+    demand = DemandSchedule();
+    tripList.reset();
+    int rushHours = demand.addProfile("rush_hours", DemandProfile::rushHours());
+    std::vector<double> rowTotals = odMatrix ? std::vector<double>()
+                                             : OdMatrix::gravityRowTotals(populations, tripsPerDay);
+    for (int i = 0; i < (int) nodes.size(); ++i) {
+        double rate = (odMatrix ? odMatrix->getRowTotal(i) : rowTotals[i]) / DemandProfile::secondsPerDay;
+        if (rate > 0) {
+            demand.addStream(i, -1, rate, rushHours, generator());
+        }
+    }
+    demand.start(global_time);
 }
 
 void TrafficModel::step()
 {
-    for (auto& edge : edges)
-    {
-        edge->step(delta_time);
+    // Network changes since the last step take effect before anything moves
+    updateRoutes();
+    // Edges that were left empty have nothing to do until their in-node sends them a car
+    auto kept = activeEdges.begin();
+    for (int id : activeEdges) {
+        if (edges[id]->getNCars() > 0) {
+            *kept++ = id;
+        } else {
+            edges[id]->idle();
+            edgeScheduled[id] = 0;
+        }
     }
-    for (auto& node : nodes)
-    {
-        node->step(delta_time);
+    activeEdges.erase(kept, activeEdges.end());
+    // A hot edge would keep the other workers waiting at the end of the phase, so it gets all of them afterwards
+    splitEdges.clear();
+    int threshold = splitThreshold > 0 && workers->size() > 1 ? splitThreshold : std::numeric_limits<int>::max();
+    for (int id : activeEdges) {
+        if (edges[id]->getNCars() >= threshold) {
+            splitEdges.push_back(id);
+        }
+    }
+    // Every edge is only touched by one worker per phase, cars cross between edges and nodes through
+    // single-producer single-consumer queues, so no locks are needed.
+    workers->parallelFor(activeEdges.size(), [this, threshold](int worker, int begin, int end) {
+        for (int i = begin; i < end; ++i)
+        {
+            Edge& edge = *edges[activeEdges[i]];
+            if (edge.getNCars() >= threshold) {
+                continue;
+            }
+            edge.step(delta_time);
+            edge.publishExitingCars();
+            edge.takeEntrySnapshot();
+            if (edge.hasExitingCars()) {
+                wokenNodes[worker].push_back(edge.getOutNode().getID());
+            }
+        }
+    });
+    for (int id : splitEdges) {
+        Edge& edge = *edges[id];
+        edge.stepSplit(delta_time, *workers);
+        edge.publishExitingCars();
+        edge.takeEntrySnapshot();
+        if (edge.hasExitingCars()) {
+            wokenNodes[0].push_back(edge.getOutNode().getID());
+        }
     }
     spawnCars();
     transferCars();
     global_time += delta_time / scale;
+    if (recorder) {
+        recorder->record(*this);
+    }
+    if (framePublisher) {
+        framePublisher->onStep(*this);
+    }
+    if (probes.has(ProbeHook::TickEnd)) {
+        probes.tickEnded(*this);
+    }
+    // Cars spread over the pool as they move between edges, this brings the cars of every edge together again
+    if (carCompactionInterval > 0 && ++nStepsSinceCompaction >= carCompactionInterval && canCompactCars()) {
+        compactCars();
+    }
+}
+
+void TrafficModel::compactCars()
+{
+    if (!canCompactCars()) {
+        throw std::logic_error("Cars cannot be renumbered while trajectories are recorded or probes observe cars.");
+    }
+    std::vector<CarPtr*> handles;
+    handles.reserve(getNCarsInSimulation());
+    for (auto& edge : edges) {
+        edge->collectCarHandles(handles);
+    }
+    for (auto& node : nodes) {
+        node->collectCarHandles(handles);
+    }
+    carPool.compact(handles);
+    nStepsSinceCompaction = 0;
+}
+
+void TrafficModel::setThreadCount(int nThreads)
+{
+    workers = std::make_unique<WorkerPool>(std::max(1, nThreads));
+    carPool.setNWorkers(workers->size());
+    probes.setNWorkers(workers->size());
+    wokenEdges.resize(workers->size());
+    wokenNodes.resize(workers->size());
+}
+
+void TrafficModel::setEdgeSplitThreshold(int nCars)
+{
+    if (nCars < 0) {
+        throw std::invalid_argument("The edge split threshold cannot be negative.");
+    }
+    splitThreshold = nCars;
+}
+
+void TrafficModel::scheduleAll()
+{
+    activeEdges.resize(edges.size());
+    std::iota(activeEdges.begin(), activeEdges.end(), 0);
+    edgeScheduled.assign(edges.size(), 1);
+    activeNodes.resize(nodes.size());
+    std::iota(activeNodes.begin(), activeNodes.end(), 0);
+    nodeScheduled.assign(nodes.size(), 1);
 }
 
 void TrafficModel::spawnCar() {
-    float p = distribution(generator);
-    for (int i = 0; i < mappingProbabilities.size(); i++) {
-        for (int j = 0; j < mappingProbabilities[i].size(); j++) {
-            p -= mappingProbabilities[i][j];
-            if (p < 0) {
-                auto path = getFastestPath(i, j);
-                nodes[i]->spawnCar(path, global_time, scale);
+    auto [i, j] = getOdMatrix().samplePair(distribution(generator));
+    if (j != -1) {
+        spawnCar(i, j);
+    }
+}
+
+void TrafficModel::spawnCar(int startNodeID, int endNodeID) {
+    // Demand and route choice are in file ids
+    int origin = internalNodeIDs[startNodeID];
+    if (routeChoice != nullptr
+        && routeChoice->choose(global_time, startNodeID, endNodeID, distribution(generator), spawnPath)) {
+        toInternalPath(spawnPath);
+    } else {
+        reconstructPath(*shortestPathMapping, origin, internalNodeIDs[endNodeID], spawnPath);
+        if (spawnPath.empty()) {
+            // The destination cannot be reached, e.g. behind a closed edge
+            return;
+        }
+    }
+    CarPtr car = carPool.acquire(spawnPath, global_time);
+    if (probes.has(ProbeHook::Spawn)) {
+        probes.carSpawned(*car, origin);
+    }
+    nodes[origin]->spawnCar(std::move(car));
+    // Spawning runs on the calling thread, which is worker 0
+    wokenNodes[0].push_back(origin);
+}
+
+void TrafficModel::toInternalPath(std::vector<int>& path) const {
+    for (int& node : path) {
+        node = internalNodeIDs[node];
+    }
+}
+
+void TrafficModel::toFilePath(std::vector<int>& path) const {
+    for (int& node : path) {
+        node = fileNodeIDs[node];
+    }
+}
+
+void TrafficModel::spawnCars() {
+    // Arrivals are released in the tick that contains them, their times do not depend on delta_time
+    double until = (double) global_time + delta_time / scale;
+    demand.release(until, [this](DemandStream& stream) {
+        int destination = stream.destination;
+        if (destination == -1) {
+            destination = getOdMatrix().sampleDestination(stream.origin, std::uniform_real_distribution<double>(0, 1)(stream.rng));
+        }
+        if (destination != -1 && destination != stream.origin) {
+            spawnCar(stream.origin, destination);
+        }
+    });
+    if (tripList) {
+        tripList->release(until, [this](int origin, int destination) {
+            if (origin != destination) {
+                spawnCar(origin, destination);
+            }
+        });
+    }
+}
+
+void TrafficModel::clearTraffic(double time) {
+    for (auto& edge : edges) {
+        edge->clearCars();
+    }
+    for (auto& node : nodes) {
+        node->clearCars();
+    }
+    carPool.flushCaches();
+    std::fill(histogramCounts.begin(), histogramCounts.end(), 0);
+    scheduleAll();
+    if (stateDigestEnabled) {
+        enableStateDigest();
+    }
+    global_time = time;
+    demand.start(time);
+    if (tripList) {
+        tripList->start(time);
+    }
+}
+
+void TrafficModel::warmStart(double targetTime, double relaxationTime, std::vector<float> const& edgeTravelTimes) {
+    if (getNCarsInSimulation() != 0) {
+        throw std::logic_error("A warm start needs an empty network.");
+    }
+    if (!edgeTravelTimes.empty() && edgeTravelTimes.size() != edges.size()) {
+        throw std::invalid_argument("Expected one travel time per edge.");
+    }
+    std::vector<double> crossingTimes(edges.size());
+    for (size_t i = 0; i < edges.size(); ++i) {
+        crossingTimes[i] = edgeTravelTimes.empty() ? edges[i]->getExpectedCrossingTime() / scale
+                                                   : edgeTravelTimes[fileEdgeIDs[i]];
+    }
+    auto edgeBetween = [this](int from, int to) -> Edge& {
+        for (Edge& edge : nodes[from]->outEdges) {
+            if (edge.getOutNode().getID() == to) {
+                return edge;
+            }
+        }
+        throw std::logic_error("The routes hold a step without an edge.");
+    };
+    // Trips that departed longer ago than the longest route have arrived already. The routes to one destination form
+    // a tree of next hops, so the time of every route to it follows from that of the next hop, one node at a time.
+    auto const& mapping = *shortestPathMapping;
+    int nNodes = (int) nodes.size();
+    std::vector<double> longestRoutes(workers->size(), 0);
+    workers->parallelFor(nNodes, [&](int worker, int begin, int end) {
+        std::vector<double> routeTimes(nNodes); // to the destination, -1 while unknown
+        std::vector<int> unknown;
+        for (int destination = begin; destination < end; ++destination) {
+            auto const& nextHops = mapping[destination];
+            std::fill(routeTimes.begin(), routeTimes.end(), -1);
+            routeTimes[destination] = 0;
+            for (int origin = 0; origin < nNodes; ++origin) {
+                // A node with a next hop reaches the destination through it
+                for (int node = origin; routeTimes[node] < 0 && nextHops[node] != -1; node = nextHops[node]) {
+                    unknown.push_back(node);
+                }
+                for (; !unknown.empty(); unknown.pop_back()) {
+                    int node = unknown.back();
+                    routeTimes[node] = crossingTimes[edgeBetween(node, nextHops[node]).getID()]
+                                       + routeTimes[nextHops[node]];
+                }
+                longestRoutes[worker] = std::max(longestRoutes[worker], routeTimes[origin]);
+            }
+        }
+    });
+    double horizon = *std::max_element(longestRoutes.begin(), longestRoutes.end());
+    std::vector<int> path;
+
+    // Every trip that departed within the horizon is put where it would be now, at the assumed crossing times
+    double startTime = targetTime - relaxationTime;
+    std::mt19937 rng(generator());
+    std::vector<int> nextLane(edges.size(), 0);
+    auto place = [&](int origin, int destination, double departure) {
+        if (destination == -1 || destination == origin) {
+            return;
+        }
+        reconstructPath(*shortestPathMapping, internalNodeIDs[origin], internalNodeIDs[destination], path);
+        double elapsed = startTime - departure;
+        for (size_t k = 0; k + 1 < path.size(); ++k) {
+            Edge& edge = edgeBetween(path[k], path[k + 1]);
+            double crossingTime = crossingTimes[edge.getID()];
+            if (elapsed < crossingTime) {
+                // Cars are spread over the lanes in turn, each at the nearest spot at or behind its estimate that
+                // keeps entryGap to the other cars of the lane, or the lane that has such a spot closest to it.
+                float x = elapsed / crossingTime * edge.getLength();
+                int lane = -1;
+                float position = -1;
+                for (int l = 0; l < edge.getNLanes(); ++l) {
+                    int candidate = (nextLane[edge.getID()] + l) % edge.getNLanes();
+                    float free = edge.findFreePosition(candidate, x, Edge::entryGap);
+                    if (free > position) {
+                        lane = candidate;
+                        position = free;
+                    }
+                    if (free == x) {
+                        break;
+                    }
+                }
+                if (lane == -1) {
+                    // The edge is queued up to its start, so the trip would still wait at its origin, like a spawned
+                    // car does when its first edge has no entry space
+                    return;
+                }
+                nextLane[edge.getID()] = lane + 1;
+                CarPtr car = carPool.acquire(path, departure);
+                car->setAge((startTime - departure) * scale);
+                // On an edge, the car has passed every node up to the start of the edge
+                for (size_t passed = 0; passed <= k; ++passed) {
+                    car->passNode();
+                }
+                float v = edge.getLength() / (crossingTime * scale);
+                edge.placeCar(std::move(car), position, lane, v);
                 return;
             }
+            elapsed -= crossingTime;
         }
+    };
+    demand.sample(startTime - horizon, startTime, rng, [&](DemandStream const& stream, double departure) {
+        int destination = stream.destination;
+        if (destination == -1) {
+            destination = getOdMatrix().sampleDestination(stream.origin, std::uniform_real_distribution<double>(0, 1)(rng));
+        }
+        place(stream.origin, destination, departure);
+    });
+    if (tripList) {
+        tripList->sample(startTime - horizon, startTime, place);
+    }
+    for (auto& edge : edges) {
+        edge->sortCars();
+    }
+    scheduleAll();
+    if (canCompactCars()) {
+        compactCars();
+    }
+    global_time = startTime;
+    demand.start(startTime);
+    if (tripList) {
+        tripList->start(startTime);
+    }
+    while (global_time < targetTime) {
+        step();
     }
 }
 
+std::vector<float> TrafficModel::getEdgeTravelTimes() const {
+    std::vector<float> travelTimes;
+    travelTimes.reserve(edges.size());
+    for (int i : internalEdgeIDs) {
+        auto const& edge = edges[i];
+        float speed = 0;
+        edge->getCars().forEach([&speed](Car const& car) {
+            speed += car.getV();
+        });
+        float crossingTime = edge->getExpectedCrossingTime();
+        if (edge->getNCars() > 0) {
+            // Standing traffic is counted as crawling, such that times stay finite
+            crossingTime = edge->getLength() / std::max(speed / edge->getNCars(), 1.0f);
+        }
+        travelTimes.push_back(crossingTime / scale);
+    }
+    return travelTimes;
+}
 
-void TrafficModel::spawnCars() {
-    // Calculate spawns
-    float spawn_prob = (float) population * 0.1f / 86400.0f * delta_time;
-//    if (global_time == 0) {
-//        spawn_prob = 1;
-//    } else {
-//        spawn_prob = 0;
-//    }
-    // Multiply spawn_prob by 6 if between 7 and 9 and 17 and 19
-    int hour = (int) global_time % 86400 / 3600;
-    if ((hour >= 7 && hour < 9) || (hour >= 17 && hour < 19)) {
-        spawn_prob *= 6;
+void TrafficModel::loadDemand(std::string fn) {
+    // Format, times in hours and rates in trips per hour at multiplier 1:
+    //   Profile:label,start,multiplier,start,multiplier,...
+    //   Origin:node,profile,rate        (destination sampled from the OD matrix)
+    //   OD:node,node,profile,rate
+    std::ifstream file(fn);
+    if (!file) {
+        throw std::runtime_error("Could not open demand file " + fn);
     }
-    else {
-        spawn_prob *= 0;
+    demand = DemandSchedule();
+    tripList.reset();
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        size_t colon = line.find(':');
+        std::string command = line.substr(0, colon);
+        std::vector<std::string> args;
+        std::stringstream stream(line.substr(colon + 1));
+        std::string arg;
+        while (std::getline(stream, arg, ',')) {
+            args.push_back(arg);
+        }
+        if (command == "Profile") {
+            std::vector<double> starts, multipliers;
+            for (size_t i = 1; i + 1 < args.size(); i += 2) {
+                starts.push_back(std::stod(args[i]) * 3600);
+                multipliers.push_back(std::stod(args[i + 1]));
+            }
+            demand.addProfile(args[0], DemandProfile(starts, multipliers));
+        } else if (command == "Origin") {
+            demand.addStream(getNodeIDFromLabel(args[0]), -1, std::stod(args[2]) / 3600,
+                             demand.getProfileID(args[1]), generator());
+        } else if (command == "OD") {
+            demand.addStream(getNodeIDFromLabel(args[0]), getNodeIDFromLabel(args[1]), std::stod(args[3]) / 3600,
+                             demand.getProfileID(args[2]), generator());
+        } else {
+            throw std::runtime_error("Unknown demand command " + command);
+        }
     }
-    while (spawn_prob > 1) {
-        spawnCar();
-        spawn_prob -= 1;
+    demand.start(global_time);
+}
+
+void TrafficModel::loadTripList(std::string fn, int nSlots) {
+    // One slot per tick, such that a release only looks at the slots the tick overlaps
+    tripList = std::make_unique<TripSchedule>(fn, delta_time / scale, nSlots, [this](std::string const& label) {
+        return getNodeIDFromLabel(label);
+    });
+    demand = DemandSchedule();
+    tripList->start(global_time);
+}
+
+OdMatrix const& TrafficModel::getOdMatrix() const {
+    if (!odMatrix) {
+        odMatrix = std::make_shared<OdMatrix const>(OdMatrix::gravity(populations, tripsPerDay));
     }
-    if (distribution(generator) < spawn_prob) {
-        spawnCar();
+    return *odMatrix;
+}
+
+void TrafficModel::loadOdMatrix(std::string fn) {
+    std::ifstream file(fn);
+    if (!file) {
+        throw std::runtime_error("Could not open OD matrix file " + fn);
     }
+    odMatrix = std::make_shared<OdMatrix const>(OdMatrix::load(file, nodes.size(), [this](std::string const& label) {
+        return getNodeIDFromLabel(label);
+    }));
+    useDefaultDemand();
 }
 
 void TrafficModel::setIDs() {
@@ -107,44 +706,222 @@ void TrafficModel::setIDs() {
     }
 }
 
-std::vector<int> TrafficModel::getEdgeIDs() {
-    std::vector<int> ids;
-    for (auto& edge : edges)
-    {
-        ids.push_back(edge->getID());
+void TrafficModel::renumber() {
+    // File ids first, to map from
+    setIDs();
+    std::vector<float> xs, ys;
+    for (auto const& node : nodes) {
+        xs.push_back(node->x);
+        ys.push_back(node->y);
     }
+    fileNodeIDs = NetworkOrder::hilbertOrder(xs, ys);
+    internalNodeIDs.resize(nodes.size());
+    for (int i = 0; i < (int) nodes.size(); ++i) {
+        internalNodeIDs[fileNodeIDs[i]] = i;
+    }
+    // Edges leaving the same node are handled together by the node, so they are kept together
+    fileEdgeIDs.resize(edges.size());
+    std::iota(fileEdgeIDs.begin(), fileEdgeIDs.end(), 0);
+    std::vector<std::tuple<int, int>> edgeRanks;
+    for (auto const& edge : edges) {
+        edgeRanks.emplace_back(internalNodeIDs[edge->getInNode().getID()], internalNodeIDs[edge->getOutNode().getID()]);
+    }
+    std::stable_sort(fileEdgeIDs.begin(), fileEdgeIDs.end(), [&edgeRanks](int a, int b) {
+        return edgeRanks[a] < edgeRanks[b];
+    });
+    internalEdgeIDs.resize(edges.size());
+    for (int i = 0; i < (int) edges.size(); ++i) {
+        internalEdgeIDs[fileEdgeIDs[i]] = i;
+    }
+
+    std::vector<std::shared_ptr<Node>> renumberedNodes;
+    for (int id : fileNodeIDs) {
+        renumberedNodes.push_back(nodes[id]);
+    }
+    nodes = std::move(renumberedNodes);
+    std::vector<std::shared_ptr<Edge>> renumberedEdges;
+    for (int id : fileEdgeIDs) {
+        renumberedEdges.push_back(edges[id]);
+    }
+    edges = std::move(renumberedEdges);
+    setIDs();
+}
+
+std::vector<int> TrafficModel::getEdgeIDs() {
+    std::vector<int> ids(edges.size());
+    std::iota(ids.begin(), ids.end(), 0);
     return ids;
 }
 
 std::vector<int> TrafficModel::getNodeIDs() {
-    std::vector<int> ids;
-    for (auto& node : nodes)
+    std::vector<int> ids(nodes.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    return ids;
+}
+
+void TrafficModel::setHistogramBinDistance(float binDistance) {
+    if (!(binDistance > 0)) {
+        throw std::invalid_argument("Car count histograms need a positive bin distance.");
+    }
+    histogramOffsets.clear();
+    histogramOffsets.reserve(edges.size() + 1);
+    int nBins = 0;
+    for (int i : internalEdgeIDs)
     {
-        ids.push_back(node->getID());
+        histogramOffsets.push_back(nBins);
+        nBins += edges[i]->getHistogramBinCount(binDistance);
+    }
+    histogramOffsets.push_back(nBins);
+    histogramCounts.assign(nBins, 0);
+    for (int i = 0; i < (int) edges.size(); ++i)
+    {
+        getEdge(i).attachHistogram(histogramCounts.data() + histogramOffsets[i], binDistance);
     }
-    return ids;
+}
+
+void TrafficModel::startFrameStream(std::string name, float binDistance, int stepsPerFrame, int nSlots, int maxCars) {
+    framePublisher.reset();
+    if (histogramOffsets.empty() || edges.empty()) {
+        setHistogramBinDistance(binDistance);
+    } else if (edges.front()->getHistogramBinDistance() != binDistance) {
+        // Replacing them would change the histograms under whoever registered them
+        throw std::invalid_argument("Car count histograms are registered at a bin distance of "
+                                    + std::to_string(edges.front()->getHistogramBinDistance()) + " m already.");
+    }
+    framePublisher = std::make_unique<FramePublisher>(*this, name, stepsPerFrame, nSlots, maxCars);
+    framePublisher->publish(*this);
+}
+
+void TrafficModel::startRecording(std::string fn, int ticksPerChunk, int maxPendingChunks) {
+    recorder.reset();
+    recorder = std::make_unique<TrajectoryRecorder>(fn, edges.size(), delta_time, ticksPerChunk, maxPendingChunks);
 }
 
 void TrafficModel::transferCars() {
-    for (auto& node : nodes)
-    {
-        node->collectCars();
-        node->distributeCars();
+    nodeClock += delta_time;
+    // Nodes woken by their in-edges or by spawned cars
+    schedule(wokenNodes, nodeScheduled, activeNodes);
+    workers->parallelFor(activeNodes.size(), [this](int worker, int begin, int end) {
+        for (int i = begin; i < end; ++i)
+        {
+            Node& node = *nodes[activeNodes[i]];
+            node.step(delta_time);
+            // An intersection holds cars at the end of its in-edges, whose in-nodes may run at the same time and
+            // therefore see the entry space of their out-edges as of the edge phase, see Edge::takeEntrySnapshot
+            node.collectCars();
+            node.distributeCars();
+            // An edge has a single in-node, so it is woken by one worker at most
+            for (Edge& edge : node.outEdges) {
+                if (!edgeScheduled[edge.getID()] && edge.hasEnteringCars()) {
+                    wokenEdges[worker].push_back(edge.getID());
+                }
+            }
+        }
+    });
+    // A node left without cars is idle until it is woken again
+    auto kept = activeNodes.begin();
+    for (int id : activeNodes) {
+        if (nodes[id]->getNCars() > 0) {
+            *kept++ = id;
+        } else {
+            nodeScheduled[id] = 0;
+        }
+    }
+    activeNodes.erase(kept, activeNodes.end());
+    schedule(wokenEdges, edgeScheduled, activeEdges);
+    workers->parallelFor(activeEdges.size(), [this](int, int begin, int end) {
+        for (int i = begin; i < end; ++i)
+        {
+            edges[activeEdges[i]]->receiveCars();
+        }
+    });
+    if (stateDigestEnabled) {
+        // Idle edges and nodes are digested as well, so digests do not depend on the scheduling, and by file id,
+        // so they do not depend on the numbering
+        workers->parallelFor(nodes.size(), [this](int, int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                nodeDigests[i] = StateDigest::combine(nodeDigests[i], nodes[internalNodeIDs[i]]->computeStateDigest());
+            }
+        });
+        workers->parallelFor(edges.size(), [this](int, int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                edgeDigests[i] = StateDigest::combine(edgeDigests[i], getEdge(i).computeStateDigest());
+            }
+        });
+    }
+    // Cars that arrived on worker threads become available for spawning again
+    carPool.flushCaches();
+    if (stateDigestEnabled) {
+        stateDigest = StateDigest::combine(stateDigest, StateDigest::bits(global_time));
+        for (std::uint64_t digest : edgeDigests) {
+            stateDigest = StateDigest::combine(stateDigest, digest);
+        }
+        for (std::uint64_t digest : nodeDigests) {
+            stateDigest = StateDigest::combine(stateDigest, digest);
+        }
     }
 }
 
+void TrafficModel::seed(unsigned int seed)
+{
+    carPool.seed(seed);
+    generator.seed(seed);
+    demand.seed(generator(), global_time);
+}
+
+ObservationBatch TrafficModel::getEdgeObservations(int idx) const
+{
+    ObservationBatch observations;
+    edges[internalEdgeIDs.at(idx)]->observe(observations);
+    return observations;
+}
+
+std::vector<int> TrafficModel::getEdgeActions(int idx) const
+{
+    ObservationBatch observations;
+    edges[internalEdgeIDs.at(idx)]->observe(observations);
+    edges[internalEdgeIDs.at(idx)]->decide(observations);
+    std::vector<int> actions;
+    actions.reserve(observations.size());
+    for (ActionCode action : observations.actions) {
+        actions.push_back((int) action);
+    }
+    return actions;
+}
+
+void TrafficModel::setEdgeActions(int idx, std::vector<int> const& actions)
+{
+    std::vector<ActionCode> codes;
+    codes.reserve(actions.size());
+    for (int action : actions) {
+        if (action < 0 || action > (int) ActionCode::ToRightLaneAndCruise) {
+            throw std::invalid_argument("Unknown action code " + std::to_string(action));
+        }
+        codes.push_back((ActionCode) action);
+    }
+    edges[internalEdgeIDs.at(idx)]->overrideActions(codes);
+}
+
+void TrafficModel::enableStateDigest()
+{
+    stateDigestEnabled = true;
+    stateDigest = 0;
+    edgeDigests.assign(edges.size(), 0);
+    nodeDigests.assign(nodes.size(), 0);
+}
+
 void TrafficModel::display() const
 {
     std::cout << "Nodes:\n";
-    for (auto& node : nodes)
+    for (int i : internalNodeIDs)
     {
-        std::cout << "-" << node->getLabel() << "\n";
+        std::cout << "-" << nodes[i]->getLabel() << "\n";
     }
 
     std::cout << "Edges:\n";
-    for (auto& edge : edges)
+    for (int i : internalEdgeIDs)
     {
-        std::cout << "-" << edge->getLabel() << "\n";
+        std::cout << "-" << edges[i]->getLabel() << "\n";
     }
 }
 
@@ -154,6 +931,12 @@ void TrafficModelBuilder::addBasicCity(std::string label, int population, float
     trafficModel.labelToNode[label] = node;
 }
 
+void TrafficModelBuilder::addIntersection(std::string label, float x, float y, float saturationFlow, int queueCapacity) {
+    std::shared_ptr<Node> node = std::make_shared<Intersection>(label, x, y, saturationFlow, queueCapacity);
+    trafficModel.nodes.emplace_back(node);
+    trafficModel.labelToNode[label] = node;
+}
+
 void TrafficModelBuilder::addBasicRoad(std::string label, std::string inNodeLabel, std::string outNodeLabel, float speedLimit, int nLanes)
 {
     std::shared_ptr<Node> inNode = trafficModel.labelToNode[inNodeLabel];
@@ -176,6 +959,15 @@ void BasicCityStringCommand::apply(std::vector<std::string>& args) const
     trafficModelBuilder.addBasicCity(args[0], std::stoi(args[1]), std::stof(args[2]), std::stof(args[3]));
 }
 
+IntersectionStringCommand::IntersectionStringCommand(TrafficModelBuilder& trafficModelBuilder)
+    : StringCommand(trafficModelBuilder) {}
+
+
+void IntersectionStringCommand::apply(std::vector<std::string>& args) const
+{
+    trafficModelBuilder.addIntersection(args[0], std::stof(args[1]), std::stof(args[2]), std::stof(args[3]), std::stoi(args[4]));
+}
+
 BasicRoadStringCommand::BasicRoadStringCommand(TrafficModelBuilder& trafficModelBuilder)
     : StringCommand(trafficModelBuilder) {}
 
@@ -189,6 +981,7 @@ TrafficModelBuilder::TrafficModelBuilder(TrafficModel& trafficModel)
 {
     commander.emplace("BasicRoad", std::unique_ptr<StringCommand>(new BasicRoadStringCommand(*this)));
     commander.emplace("BasicCity", std::unique_ptr<StringCommand>(new BasicCityStringCommand(*this)));
+    commander.emplace("Intersection", std::unique_ptr<StringCommand>(new IntersectionStringCommand(*this)));
 }
 
 void TrafficModelBuilder::build(std::string file_content)
@@ -224,37 +1017,36 @@ void TrafficModelBuilder::build(std::string file_content)
     }
 }
 
-int TrafficModel::getNCarsInSimulation() {
-    int n = 0;
-    for (auto& node : nodes) {
-        n += node->getNCars();
+NetworkTopology TrafficModel::getNetworkTopology() const {
+    NetworkTopology topology;
+    for (int i : internalNodeIDs) {
+        auto [x, y] = nodes[i]->getPosition();
+        topology.nodeX.push_back(x);
+        topology.nodeY.push_back(y);
     }
-    for (auto& edge : edges) {
-        n += edge->getNCars();
-    }
-    return n;
-}
-
-
-PYBIND11_MODULE(traffic_model, m) {
-    pybind11::class_<TrafficModel>(m, "TrafficModel")
-        .def(pybind11::init<const std::string &, float, float>())
-        .def("step_forward", &TrafficModel::step)
-        .def("display", &TrafficModel::display)
-        .def("get_edge_ids", &TrafficModel::getEdgeIDs)
-        .def("get_node_ids", &TrafficModel::getNodeIDs)
-        .def("get_edge_road_length", &TrafficModel::getEdgeRoadLength)
-        .def("get_edge_start_node_id", &TrafficModel::getEdgeStartNodeID)
-        .def("get_edge_end_node_id", &TrafficModel::getEdgeEndNodeID)
-        .def("get_node_pos", &TrafficModel::getNodePosition)
-        .def("get_car_count_histogram_in_edge", &TrafficModel::getCarCountHistInEdge)
-        .def("get_car_count_in_node", &TrafficModel::getCarCountInNode)
-        .def("get_fastest_path", &TrafficModel::getFastestPath)
-        .def("get_delta_time", &TrafficModel::getDeltaTime)
-        .def("get_n_cars_in_simulation", &TrafficModel::getNCarsInSimulation)
-        .def("get_n_cars_per_edge", &TrafficModel::getNCarsPerEdge)
-        .def("get_travel_stats", &TrafficModel::getTravelStats)
-        .def("get_label_from_node_id", &TrafficModel::getLabelFromNodeID)
-        .def("get_label_from_edge_id", &TrafficModel::getLabelFromEdgeID);
+    for (int i : internalEdgeIDs) {
+        auto const& edge = edges[i];
+        topology.edgeStart.push_back(fileNodeIDs[edge->getInNode().getID()]);
+        topology.edgeEnd.push_back(fileNodeIDs[edge->getOutNode().getID()]);
+        topology.edgeLength.push_back(edge->getLength());
+        topology.edgeLanes.push_back(edge->getNLanes());
+        topology.edgeSpeedLimit.push_back(edge->getSpeedLimit());
+    }
+    return topology;
 }
 
+void TrafficModel::fillNetworkSnapshot(NetworkSnapshot& snapshot) const {
+    snapshot.resize(nodes.size(), edges.size());
+    snapshot.globalTime = global_time;
+    snapshot.nCars = getNCarsInSimulation();
+    // Read in the order of the model, written by file id
+    for (size_t i = 0; i < edges.size(); ++i) {
+        int id = fileEdgeIDs[i];
+        snapshot.edgeCars[id] = edges[i]->getNCars();
+        snapshot.edgeMeanSpeed[id] = edges[i]->getMeanSpeed();
+        snapshot.edgeQueue[id] = edges[i]->getNQueuedCars();
+    }
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        snapshot.nodeCars[fileNodeIDs[i]] = nodes[i]->getNCars();
+    }
+}
@@ -0,0 +1,161 @@
+#include "trajectory_reader.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+    // Reads one value written by putVarint in trajectory_recorder.cpp
+    std::int64_t getVarint(std::uint8_t const*& in, std::uint8_t const* end) {
+        std::uint64_t zigzag = 0;
+        for (int shift = 0; in < end && shift < 64; shift += 7) {
+            std::uint8_t byte = *in++;
+            zigzag |= std::uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return std::int64_t(zigzag >> 1) ^ -std::int64_t(zigzag & 1);
+            }
+        }
+        throw std::runtime_error("Truncated trajectory column.");
+    }
+}
+
+TrajectoryReader::TrajectoryReader(std::string const& fn)
+    : file(fn, std::ios::binary)
+{
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || header.magic != TrajectoryFileHeader::magicValue) {
+        throw std::runtime_error(fn + " is not a trajectory file.");
+    }
+    if (header.version != TrajectoryFileHeader::currentVersion) {
+        throw std::runtime_error(fn + " has an unsupported trajectory file version.");
+    }
+
+    TrajectoryFileFooter footer{};
+    file.seekg(0, std::ios::end);
+    std::streamoff fileSize = file.tellg();
+    if (fileSize >= std::streamoff(sizeof(header) + sizeof(footer))) {
+        file.seekg(fileSize - std::streamoff(sizeof(footer)));
+        file.read(reinterpret_cast<char*>(&footer), sizeof(footer));
+    }
+    if (footer.magic == TrajectoryFileFooter::magicValue) {
+        index.resize(footer.nChunks);
+        file.seekg(footer.indexOffset);
+        file.read(reinterpret_cast<char*>(index.data()), index.size() * sizeof(TrajectoryIndexEntry));
+    } else {
+        file.clear();
+        scanChunks();
+    }
+}
+
+void TrajectoryReader::scanChunks()
+{
+    std::uint64_t offset = sizeof(header);
+    TrajectoryChunkHeader chunkHeader;
+    while (file.seekg(offset) && file.read(reinterpret_cast<char*>(&chunkHeader), sizeof(chunkHeader))
+           && chunkHeader.magic == TrajectoryChunkHeader::magicValue && chunkHeader.nTicks > 0) {
+        std::vector<double> tickTimes(chunkHeader.nTicks);
+        std::uint64_t size = 0;
+        for (std::uint64_t columnSize : chunkHeader.columnSizes) {
+            size += columnSize;
+        }
+        if (!file.read(reinterpret_cast<char*>(tickTimes.data()), tickTimes.size() * sizeof(double))) {
+            break;
+        }
+        std::uint64_t next = offset + sizeof(chunkHeader) + tickTimes.size() * sizeof(double) + size;
+        // A chunk cut off by the end of the file is dropped
+        if (!file.seekg(next - 1) || file.peek() == std::ifstream::traits_type::eof()) {
+            break;
+        }
+        index.push_back({tickTimes.front(), tickTimes.back(), offset, chunkHeader.nRows});
+        offset = next;
+    }
+    file.clear();
+}
+
+std::tuple<double, double> TrajectoryReader::getChunkTimeRange(int idx) const
+{
+    return {index.at(idx).startTime, index.at(idx).endTime};
+}
+
+int TrajectoryReader::findChunk(double time) const
+{
+    auto it = std::upper_bound(index.begin(), index.end(), time,
+                               [](double time, TrajectoryIndexEntry const& entry) { return time < entry.startTime; });
+    return std::max(0, int(it - index.begin()) - 1);
+}
+
+TrajectoryChunk TrajectoryReader::readChunk(int idx) const
+{
+    TrajectoryIndexEntry const& entry = index.at(idx);
+    TrajectoryChunkHeader chunkHeader;
+    file.seekg(entry.offset);
+    file.read(reinterpret_cast<char*>(&chunkHeader), sizeof(chunkHeader));
+
+    TrajectoryChunk chunk;
+    chunk.tickTimes.resize(chunkHeader.nTicks);
+    file.read(reinterpret_cast<char*>(chunk.tickTimes.data()), chunk.tickTimes.size() * sizeof(double));
+    std::uint64_t size = 0;
+    for (std::uint64_t columnSize : chunkHeader.columnSizes) {
+        size += columnSize;
+    }
+    std::vector<std::uint8_t> encoded(size);
+    if (!file.read(reinterpret_cast<char*>(encoded.data()), size)) {
+        file.clear();
+        throw std::runtime_error("Truncated trajectory chunk.");
+    }
+
+    std::uint8_t const* columns[TrajectoryChunkHeader::nColumns];
+    std::uint8_t const* ends[TrajectoryChunkHeader::nColumns];
+    std::uint8_t const* begin = encoded.data();
+    for (int i = 0; i < TrajectoryChunkHeader::nColumns; ++i) {
+        columns[i] = begin;
+        begin += chunkHeader.columnSizes[i];
+        ends[i] = begin;
+    }
+    auto next = [&](int column) { return getVarint(columns[column], ends[column]); };
+
+    chunk.tickOffsets.resize(chunkHeader.nTicks + 1);
+    chunk.tickOffsets[0] = 0;
+    chunk.ids.resize(chunkHeader.nRows);
+    chunk.edges.resize(chunkHeader.nRows);
+    chunk.xs.resize(chunkHeader.nRows);
+    chunk.vs.resize(chunkHeader.nRows);
+    chunk.lanes.resize(chunkHeader.nRows);
+    TrajectoryHistory history(header);
+    size_t row = 0;
+    for (std::uint32_t tick = 1; tick <= chunkHeader.nTicks; ++tick) {
+        std::int64_t nRows = next(0);
+        if (nRows < 0 || row + nRows > chunkHeader.nRows) {
+            throw std::runtime_error("Corrupt trajectory chunk.");
+        }
+        chunk.tickOffsets[tick] = row + nRows;
+        std::int32_t previousID = -1;
+        std::int32_t predictedID = history.firstID;
+        for (size_t end = row + nRows; row < end; ++row) {
+            std::int64_t id = predictedID + next(1);
+            if (id < 0 || id > std::numeric_limits<std::int32_t>::max()) {
+                throw std::runtime_error("Corrupt trajectory chunk.");
+            }
+            std::int64_t edge = next(2), dx = next(3), v = next(4), lane = next(5);
+            std::int64_t x;
+            bool known = history.knows(id, tick);
+            if (known) {
+                edge += history.edges[id];
+                v += history.vs[id];
+                x = history.predictX(id, v) + dx;
+                lane += history.lanes[id];
+            } else {
+                x = dx;
+            }
+            predictedID = history.predictNextID(id, known);
+            history.update(id, previousID, tick, edge, x, v, lane);
+            previousID = id;
+            chunk.ids[row] = id;
+            chunk.edges[row] = edge;
+            chunk.xs[row] = float(x) * header.positionResolution;
+            chunk.vs[row] = float(v) * header.speedResolution;
+            chunk.lanes[row] = lane;
+        }
+    }
+    return chunk;
+}
@@ -0,0 +1,169 @@
+#include "trajectory_recorder.h"
+#include "traffic_model.h"
+
+#include <stdexcept>
+
+namespace {
+    void putVarint(std::vector<std::uint8_t>& out, std::int64_t value) {
+        // Zigzag encoding keeps small negative values short
+        std::uint64_t zigzag = (std::uint64_t(value) << 1) ^ std::uint64_t(value >> 63);
+        while (zigzag >= 0x80) {
+            out.push_back(std::uint8_t(zigzag) | 0x80);
+            zigzag >>= 7;
+        }
+        out.push_back(std::uint8_t(zigzag));
+    }
+}
+
+void TrajectoryRecorder::Chunk::clear() {
+    tickTimes.clear();
+    tickRows.clear();
+    ids.clear();
+    edges.clear();
+    xs.clear();
+    vs.clear();
+    lanes.clear();
+}
+
+TrajectoryRecorder::TrajectoryRecorder(std::string const& fn, int nEdges, float deltaTime, int ticksPerChunk,
+                                       int maxPendingChunks)
+    : file(fn, std::ios::binary | std::ios::trunc), ticksPerChunk(std::max(1, ticksPerChunk)),
+      maxPendingChunks(std::max(1, maxPendingChunks))
+{
+    if (!file) {
+        throw std::runtime_error("Could not open trajectory file " + fn);
+    }
+    header = {TrajectoryFileHeader::magicValue, TrajectoryFileHeader::currentVersion, std::uint32_t(nEdges),
+              deltaTime, positionResolution, speedResolution};
+    file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    nBytes = sizeof(header);
+    history = TrajectoryHistory(header);
+    writer = std::thread(&TrajectoryRecorder::write, this);
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    if (!current.tickTimes.empty()) {
+        submit();
+    }
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    pendingCondition.notify_all();
+    writer.join();
+
+    TrajectoryFileFooter footer{nBytes, std::uint32_t(index.size()), TrajectoryFileFooter::magicValue};
+    file.write(reinterpret_cast<char const*>(index.data()), index.size() * sizeof(TrajectoryIndexEntry));
+    file.write(reinterpret_cast<char const*>(&footer), sizeof(footer));
+}
+
+void TrajectoryRecorder::record(TrafficModel& model)
+{
+    std::uint32_t nRows = 0;
+    for (int i = 0; i < model.getNEdges(); ++i) {
+        Edge const& edge = model.getEdge(i);
+        edge.getCars().forEach([&](Car const& car) {
+            current.ids.push_back(car.getID());
+            current.edges.push_back(i);
+            current.xs.push_back(car.getX());
+            current.vs.push_back(car.getV());
+            current.lanes.push_back(car.getLane());
+            nRows++;
+        });
+    }
+    current.tickTimes.push_back(model.global_time);
+    current.tickRows.push_back(nRows);
+    nTicks++;
+    if ((int) current.tickTimes.size() >= ticksPerChunk) {
+        submit();
+    }
+}
+
+void TrajectoryRecorder::submit()
+{
+    std::unique_lock lock(mutex);
+    pendingCondition.wait(lock, [this] { return pending.size() < maxPendingChunks; });
+    pending.push_back(std::move(current));
+    if (spare.empty()) {
+        current = Chunk();
+    } else {
+        current = std::move(spare.back());
+        spare.pop_back();
+    }
+    lock.unlock();
+    pendingCondition.notify_all();
+}
+
+void TrajectoryRecorder::write()
+{
+    std::unique_lock lock(mutex);
+    while (true) {
+        pendingCondition.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty()) {
+            return;
+        }
+        // The chunk stays queued while it is written, so the bound on pending chunks includes it
+        lock.unlock();
+        writeChunk(pending.front());
+        lock.lock();
+        spare.push_back(std::move(pending.front()));
+        spare.back().clear();
+        pending.pop_front();
+        pendingCondition.notify_all();
+    }
+}
+
+void TrajectoryRecorder::writeChunk(Chunk const& chunk)
+{
+    for (auto& column : columns) {
+        column.clear();
+    }
+    history.reset();
+    size_t begin = 0;
+    for (std::uint32_t tick = 1; tick <= chunk.tickRows.size(); ++tick) {
+        size_t end = begin + chunk.tickRows[tick - 1];
+        putVarint(columns[0], chunk.tickRows[tick - 1]);
+        std::int32_t previousID = -1;
+        std::int32_t predictedID = history.firstID;
+        for (size_t row = begin; row < end; ++row) {
+            std::int32_t id = chunk.ids[row];
+            std::int64_t edge = chunk.edges[row];
+            std::int64_t x = std::llround(chunk.xs[row] / positionResolution);
+            std::int64_t v = std::llround(chunk.vs[row] / speedResolution);
+            std::int64_t lane = chunk.lanes[row];
+            putVarint(columns[1], id - predictedID);
+            bool known = history.knows(id, tick);
+            if (known) {
+                putVarint(columns[2], edge - history.edges[id]);
+                putVarint(columns[3], x - history.predictX(id, v));
+                putVarint(columns[4], v - history.vs[id]);
+                putVarint(columns[5], lane - history.lanes[id]);
+            } else {
+                putVarint(columns[2], edge);
+                putVarint(columns[3], x);
+                putVarint(columns[4], v);
+                putVarint(columns[5], lane);
+            }
+            predictedID = history.predictNextID(id, known);
+            history.update(id, previousID, tick, edge, x, v, lane);
+            previousID = id;
+        }
+        begin = end;
+    }
+
+    TrajectoryChunkHeader chunkHeader{TrajectoryChunkHeader::magicValue, std::uint32_t(chunk.tickTimes.size()),
+                                      chunk.ids.size(), {}};
+    std::uint64_t size = sizeof(chunkHeader) + chunk.tickTimes.size() * sizeof(double);
+    for (int i = 0; i < TrajectoryChunkHeader::nColumns; ++i) {
+        chunkHeader.columnSizes[i] = columns[i].size();
+        size += columns[i].size();
+    }
+    index.push_back({chunk.tickTimes.front(), chunk.tickTimes.back(), nBytes, chunk.ids.size()});
+    file.write(reinterpret_cast<char const*>(&chunkHeader), sizeof(chunkHeader));
+    file.write(reinterpret_cast<char const*>(chunk.tickTimes.data()), chunk.tickTimes.size() * sizeof(double));
+    for (auto const& column : columns) {
+        file.write(reinterpret_cast<char const*>(column.data()), column.size());
+    }
+    nBytes += size;
+}
@@ -0,0 +1,112 @@
+#include "trip_list.h"
+
+#include <cstdlib>
+#include <stdexcept>
+#include <utility>
+
+TripReader::TripReader(std::string fn, std::function<int(std::string const&)> toNodeID)
+    : fn(std::move(fn)), file(this->fn), toNodeID(std::move(toNodeID))
+{
+    if (!file) {
+        throw std::runtime_error("Could not open trip list " + this->fn);
+    }
+}
+
+TripReader::TripReader(TripReader const& other, std::function<int(std::string const&)> toNodeID)
+    : TripReader(other.fn, std::move(toNodeID))
+{
+    if (other.file) {
+        file.seekg(other.file.tellg());
+    } else {
+        // At the end of the list
+        file.seekg(0, std::ios::end);
+        file.get();
+    }
+    lineNumber = other.lineNumber;
+    lastDeparture = other.lastDeparture;
+}
+
+void TripReader::rewind()
+{
+    file.clear();
+    file.seekg(0);
+    lineNumber = 0;
+    lastDeparture = 0;
+}
+
+bool TripReader::next(ScheduledTrip& trip)
+{
+    while (std::getline(file, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        size_t first = line.find(',');
+        size_t second = first == std::string::npos ? first : line.find(',', first + 1);
+        char* end = nullptr;
+        double departure = second == std::string::npos ? 0 : std::strtod(line.c_str() + second + 1, &end);
+        if (end == nullptr || end == line.c_str() + second + 1) {
+            throw std::runtime_error("Expected origin,destination,departure in " + fn + " line "
+                                     + std::to_string(lineNumber));
+        }
+        if (departure < lastDeparture) {
+            throw std::runtime_error("Trips in " + fn + " are not sorted by departure at line "
+                                     + std::to_string(lineNumber));
+        }
+        origin.assign(line, 0, first);
+        destination.assign(line, first + 1, second - first - 1);
+        try {
+            trip = {departure, toNodeID(origin), toNodeID(destination)};
+        } catch (std::out_of_range const&) {
+            throw std::runtime_error("Unknown node in " + fn + " line " + std::to_string(lineNumber));
+        }
+        lastDeparture = departure;
+        return true;
+    }
+    return false;
+}
+
+TripSchedule::TripSchedule(std::string fn, double slotLength, int nSlots,
+                           std::function<int(std::string const&)> toNodeID)
+    : reader(std::move(fn), std::move(toNodeID)), slotLength(slotLength), slots(nSlots)
+{
+    if (!(slotLength > 0) || nSlots < 1) {
+        throw std::invalid_argument("A trip schedule needs a positive slot length and at least one slot.");
+    }
+}
+
+TripSchedule::TripSchedule(TripSchedule const& other, std::function<int(std::string const&)> toNodeID)
+    : reader(other.reader, std::move(toNodeID)), slotLength(other.slotLength), slots(other.slots),
+      currentSlot(other.currentSlot), ahead(other.ahead), hasAhead(other.hasAhead), nReleased(other.nReleased),
+      nPending(other.nPending), maxPending(other.maxPending)
+{
+
+}
+
+void TripSchedule::fill()
+{
+    long endSlot = currentSlot + (long) slots.size();
+    while (hasAhead && slotOf(ahead.departure) < endSlot) {
+        long slot = std::max(slotOf(ahead.departure), currentSlot);
+        slots[slot % slots.size()].push_back(ahead);
+        nPending++;
+        hasAhead = reader.next(ahead);
+    }
+    maxPending = std::max(maxPending, nPending);
+}
+
+void TripSchedule::start(double time)
+{
+    for (auto& slot : slots) {
+        slot.clear();
+    }
+    nReleased = 0;
+    nPending = 0;
+    currentSlot = slotOf(time);
+    reader.rewind();
+    // Trips that departed before time are skipped, like the arrivals DemandSchedule::start discards
+    do {
+        hasAhead = reader.next(ahead);
+    } while (hasAhead && ahead.departure < time);
+    fill();
+}
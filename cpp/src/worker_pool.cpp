@@ -0,0 +1,102 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+
+namespace {
+    thread_local int workerIndex = -1;
+}
+
+WorkerPool::WorkerPool(int nThreads)
+    : errors(std::max(1, nThreads))
+{
+    for (int worker = 1; worker < nThreads; ++worker) {
+        threads.emplace_back(&WorkerPool::work, this, worker);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    startCondition.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+int WorkerPool::currentWorker()
+{
+    return workerIndex;
+}
+
+void WorkerPool::work(int worker)
+{
+    workerIndex = worker;
+    long seen = 0;
+    while (true) {
+        std::function<void(int)> const* f;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            startCondition.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            f = task;
+        }
+        // A throwing task still finishes its part of the barrier, run rethrows on the caller
+        try {
+            (*f)(worker);
+        } catch (...) {
+            errors[worker] = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            nBusy--;
+        }
+        doneCondition.notify_one();
+    }
+}
+
+void WorkerPool::run(std::function<void(int)> const& f)
+{
+    int previous = workerIndex;
+    workerIndex = 0;
+    if (threads.empty()) {
+        try {
+            f(0);
+        } catch (...) {
+            workerIndex = previous;
+            throw;
+        }
+        workerIndex = previous;
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &f;
+        nBusy = (int) threads.size();
+        generation++;
+    }
+    startCondition.notify_all();
+    try {
+        f(0);
+    } catch (...) {
+        errors[0] = std::current_exception();
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [&] { return nBusy == 0; });
+    }
+    workerIndex = previous;
+    // The error of the lowest worker, such that a failing run reports the same error every time
+    for (auto& error : errors) {
+        if (error) {
+            std::exception_ptr first = std::move(error);
+            std::fill(errors.begin(), errors.end(), nullptr);
+            std::rethrow_exception(first);
+        }
+    }
+}
@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "traffic_model.h"
+
+/*
+ * Golden-run regression harness: runs reference scenarios with fixed seeds and compares the state digest of every
+ * tick and summary statistics against golden files, to catch refactors that change simulation results.
+ *
+ * Usage: golden_run <golden directory> [--update] [--threads n] [--split-threshold n] [scenario...]
+ * Without scenarios all are run. --update rewrites the golden files from the current build.
+ * --split-threshold sets TrafficModel::setEdgeSplitThreshold, 1 steps every edge in windows.
+ * The golden files hold the digests of this compiler and flags, a different floating point setup needs --update.
+ */
+
+namespace {
+    struct Scenario
+    {
+        std::string name;
+        std::string network;
+        std::string demand;
+        float deltaTime;
+        float scale;
+        unsigned int seed;
+        int nTicks;
+    };
+
+    std::vector<Scenario> const scenarios = {
+        {"rush_hour", "rush_hour_network.txt", "rush_hour_demand.txt", 0.5f, 1, 1, 2400},
+        {"intersection", "intersection_network.txt", "intersection_demand.txt", 0.5f, 1, 2, 2400},
+        // Intersections on both ends of XY and YX, Y oversaturated such that its queue spills back onto XY and on
+        // through X, where X sends cars onto the edges Y holds cars on
+        {"chain", "chain_network.txt", "chain_spillback_demand.txt", 0.5f, 1, 5, 2400},
+    };
+
+    // Per-edge and per-node digests are stored at these ticks, to locate a divergence
+    int const checkpointInterval = 100;
+
+    struct Run
+    {
+        std::vector<std::uint64_t> tickDigests;
+        std::vector<int> checkpointTicks;
+        std::vector<std::vector<std::uint64_t>> edgeDigests;
+        std::vector<std::vector<std::uint64_t>> nodeDigests;
+        std::string summary;
+    };
+
+    std::string hex(std::uint64_t value) {
+        char buffer[17];
+        std::snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long) value);
+        return buffer;
+    }
+
+    std::string summarise(TrafficModel& model) {
+        double totalTravelTime = 0;
+        auto travelStats = model.getTravelStats();
+        for (auto const& [from, to, travelTime, startTime] : travelStats) {
+            totalTravelTime += travelTime;
+        }
+        char buffer[128];
+        std::snprintf(buffer, sizeof(buffer), "cars %d trips %zu mean_travel_time %.3f",
+                      model.getNCarsInSimulation(), travelStats.size(),
+                      travelStats.empty() ? 0.0 : totalTravelTime / travelStats.size());
+        return buffer;
+    }
+
+    Run run(Scenario const& scenario, std::string const& directory, int nThreads, int splitThreshold) {
+        TrafficModel model(directory + "/" + scenario.network, scenario.deltaTime, scenario.scale);
+        model.loadDemand(directory + "/" + scenario.demand);
+        model.seed(scenario.seed);
+        model.setThreadCount(nThreads);
+        if (splitThreshold >= 0) {
+            model.setEdgeSplitThreshold(splitThreshold);
+        }
+        model.enableStateDigest();
+        Run result;
+        for (int tick = 1; tick <= scenario.nTicks; ++tick) {
+            model.step();
+            result.tickDigests.push_back(model.getStateDigest());
+            if (tick % checkpointInterval == 0 || tick == scenario.nTicks) {
+                result.checkpointTicks.push_back(tick);
+                result.edgeDigests.push_back(model.getEdgeStateDigests());
+                result.nodeDigests.push_back(model.getNodeStateDigests());
+            }
+        }
+        result.summary = summarise(model);
+        return result;
+    }
+
+    void write(Run const& run, std::string const& fn) {
+        std::ofstream file(fn);
+        file << "# Written by golden_run --update\n";
+        for (size_t i = 0; i < run.tickDigests.size(); ++i) {
+            file << "tick " << i + 1 << " " << hex(run.tickDigests[i]) << "\n";
+        }
+        for (size_t i = 0; i < run.checkpointTicks.size(); ++i) {
+            file << "edges " << run.checkpointTicks[i];
+            for (std::uint64_t digest : run.edgeDigests[i]) {
+                file << " " << hex(digest);
+            }
+            file << "\nnodes " << run.checkpointTicks[i];
+            for (std::uint64_t digest : run.nodeDigests[i]) {
+                file << " " << hex(digest);
+            }
+            file << "\n";
+        }
+        file << "summary " << run.summary << "\n";
+    }
+
+    bool read(Run& run, std::string const& fn) {
+        std::ifstream file(fn);
+        if (!file) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream stream(line);
+            std::string kind;
+            int tick;
+            stream >> kind;
+            if (kind == "tick") {
+                std::string digest;
+                stream >> tick >> digest;
+                run.tickDigests.push_back(std::stoull(digest, nullptr, 16));
+            } else if (kind == "edges" || kind == "nodes") {
+                stream >> tick;
+                std::vector<std::uint64_t> digests;
+                std::string digest;
+                while (stream >> digest) {
+                    digests.push_back(std::stoull(digest, nullptr, 16));
+                }
+                if (kind == "edges") {
+                    run.checkpointTicks.push_back(tick);
+                    run.edgeDigests.push_back(digests);
+                } else {
+                    run.nodeDigests.push_back(digests);
+                }
+            } else if (kind == "summary") {
+                run.summary = line.substr(kind.size() + 1);
+            }
+        }
+        return true;
+    }
+
+    // Reports the first divergent tick, and the edges and nodes that diverged first
+    bool compare(Scenario const& scenario, Run const& golden, Run const& actual) {
+        size_t nTicks = std::min(golden.tickDigests.size(), actual.tickDigests.size());
+        size_t tick = 0;
+        while (tick < nTicks && golden.tickDigests[tick] == actual.tickDigests[tick]) {
+            tick++;
+        }
+        if (tick == nTicks && golden.tickDigests.size() == actual.tickDigests.size()) {
+            if (golden.summary != actual.summary) {
+                std::cout << scenario.name << ": digests match, but summary differs\n  golden: " << golden.summary
+                          << "\n  actual: " << actual.summary << "\n";
+                return false;
+            }
+            std::cout << scenario.name << ": ok, " << nTicks << " ticks\n";
+            return true;
+        }
+        std::cout << scenario.name << ": diverges at tick " << tick + 1 << "\n";
+        // The digests of an edge chain over ticks, so it differs at every checkpoint after its first divergence
+        for (size_t i = 0; i < golden.checkpointTicks.size() && i < actual.checkpointTicks.size(); ++i) {
+            if (golden.checkpointTicks[i] <= (int) tick) {
+                continue;
+            }
+            std::string edges, nodes;
+            for (size_t e = 0; e < golden.edgeDigests[i].size() && e < actual.edgeDigests[i].size(); ++e) {
+                if (golden.edgeDigests[i][e] != actual.edgeDigests[i][e]) {
+                    edges += " " + std::to_string(e);
+                }
+            }
+            for (size_t n = 0; n < golden.nodeDigests[i].size() && n < actual.nodeDigests[i].size(); ++n) {
+                if (golden.nodeDigests[i][n] != actual.nodeDigests[i][n]) {
+                    nodes += " " + std::to_string(n);
+                }
+            }
+            std::cout << "  diverged by tick " << golden.checkpointTicks[i] << ", edges:"
+                      << (edges.empty() ? " none" : edges) << ", nodes:" << (nodes.empty() ? " none" : nodes) << "\n";
+            break;
+        }
+        std::cout << "  golden: " << golden.summary << "\n  actual: " << actual.summary << "\n";
+        return false;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: golden_run <golden directory> [--update] [--threads n] [--split-threshold n] "
+                     "[scenario...]\n";
+        return 2;
+    }
+    std::string directory = argv[1];
+    bool update = false;
+    int nThreads = 1;
+    int splitThreshold = -1; // the default of TrafficModel
+    std::vector<std::string> names;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--update") {
+            update = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            nThreads = std::stoi(argv[++i]);
+        } else if (arg == "--split-threshold" && i + 1 < argc) {
+            splitThreshold = std::stoi(argv[++i]);
+        } else {
+            names.push_back(arg);
+        }
+    }
+
+    bool passed = true;
+    for (auto const& scenario : scenarios) {
+        if (!names.empty() && std::find(names.begin(), names.end(), scenario.name) == names.end()) {
+            continue;
+        }
+        std::string goldenFn = directory + "/" + scenario.name + ".golden";
+        Run actual = run(scenario, directory, nThreads, splitThreshold);
+        if (update) {
+            write(actual, goldenFn);
+            std::cout << scenario.name << ": written " << goldenFn << "\n";
+            continue;
+        }
+        Run golden;
+        if (!read(golden, goldenFn)) {
+            std::cout << scenario.name << ": missing " << goldenFn << ", run with --update\n";
+            passed = false;
+            continue;
+        }
+        passed &= compare(scenario, golden, actual);
+    }
+    return passed ? 0 : 1;
+}
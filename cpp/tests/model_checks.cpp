@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "od_matrix.h"
+#include "traffic_assignment.h"
+#include "traffic_model.h"
+#include "worker_pool.h"
+
+/*
+ * Checks of invariants of the model that the golden runs cannot see, each on one of the golden networks.
+ *
+ * Usage: model_checks <golden directory> [check...]
+ * Without checks all are run. A check throws a std::runtime_error describing the first violation.
+ */
+
+namespace {
+    void expect(bool condition, std::string const& message) {
+        if (!condition) {
+            throw std::runtime_error(message);
+        }
+    }
+
+    // Steps until the edge holds cars in every lane
+    void fillLanes(TrafficModel& model, int edgeID, int maxSteps) {
+        Edge const& edge = model.getEdge(edgeID);
+        for (int step = 0; step < maxSteps; ++step) {
+            bool filled = true;
+            for (int l = 0; l < edge.getNLanes(); ++l) {
+                filled &= !edge.getCars().getLane(l).empty();
+            }
+            if (filled) {
+                return;
+            }
+            model.step();
+        }
+        throw std::runtime_error("Edge " + edge.getLabel() + " did not fill every lane");
+    }
+
+    // Every car in the lane it is stored in, inside the lanes of the edge
+    void expectLanesValid(Edge const& edge) {
+        for (int l = 0; l < edge.getNLanes(); ++l) {
+            for (auto const& car : edge.getCars().getLane(l)) {
+                expect(car->getLane() == l, "Car in lane " + std::to_string(car->getLane()) + " stored in lane "
+                                            + std::to_string(l) + " of edge " + edge.getLabel());
+            }
+        }
+    }
+
+    // External controllers asking for lane changes off the road, on the outermost and the innermost lane
+    void checkLaneChangeOverride(std::string const& directory) {
+        TrafficModel model(directory + "/intersection_network.txt", 0.5f, 1);
+        model.loadDemand(directory + "/intersection_demand.txt");
+        model.seed(1);
+        model.clearTraffic(7 * 3600);
+        int edgeID = model.getEdgeIDFromLabel("AX");
+        Edge const& edge = model.getEdge(edgeID);
+        fillLanes(model, edgeID, 2000);
+        for (ActionCode action : {ActionCode::ToLeftLaneAndCruise, ActionCode::ToRightLaneAndCruise}) {
+            int boundary = action == ActionCode::ToLeftLaneAndCruise ? edge.getNLanes() - 1 : 0;
+            for (int step = 0; step < 20; ++step) {
+                model.setEdgeActions(edgeID, std::vector<int>(edge.getNCars(), (int) action));
+                for (auto const& car : edge.getCars().getLane(boundary)) {
+                    expect(car->getAction() == ActionCode::Cruise, "A lane change off lane "
+                                                                   + std::to_string(boundary) + " was kept");
+                }
+                model.step();
+                expectLanesValid(edge);
+            }
+        }
+    }
+
+    // Entries minus exits of every edge, counted by a probe, against the cars on it after every step. The
+    // intersection holds cars at the end of its in-edges while its queues are full, which must not count as exits.
+    // Its queues first fill up after some 80 minutes.
+    void checkEdgeEventCounts(std::string const& directory) {
+        TrafficModel model(directory + "/intersection_network.txt", 0.5f, 1);
+        model.loadDemand(directory + "/intersection_demand.txt");
+        model.seed(2);
+        model.clearTraffic(7 * 3600);
+        auto counter = std::make_shared<EventCounter>(model.getNNodes(), model.getNEdges());
+        model.addProbe(counter);
+        for (int step = 1; step <= 12000; ++step) {
+            model.step();
+            for (int i = 0; i < model.getNEdges(); ++i) {
+                long onEdge = counter->getEdgeEntries()[i] - counter->getEdgeExits()[i];
+                expect(onEdge == model.getEdge(i).getNCars(),
+                       "Edge " + model.getEdge(i).getLabel() + " counts " + std::to_string(onEdge) + " cars by its "
+                       + "events, but holds " + std::to_string(model.getEdge(i).getNCars()) + " at step "
+                       + std::to_string(step));
+                expect(counter->getEdgeExits()[i] == model.getEdge(i).getNExitedCars(),
+                       "Edge " + model.getEdge(i).getLabel() + " counts other exits than its probe");
+            }
+        }
+    }
+
+    // Time on every edge of every car that left it, measured per car
+    class EdgeTimeProbe : public Probe
+    {
+    private:
+        std::vector<long> entryStep; // by car id
+        long step = 0;
+
+    public:
+        std::vector<double> totalSteps; // by edge, of the cars that left
+        std::vector<long> nExits;
+
+        explicit EdgeTimeProbe(int nEdges) : totalSteps(nEdges), nExits(nEdges) {}
+        unsigned getHooks() const override {
+            return ProbeHook::EdgeEntry | ProbeHook::EdgeExit | ProbeHook::TickEnd;
+        }
+        void onEdgeEntry(int worker, Car const& car, int edge) override {
+            if (car.getID() >= (int) entryStep.size()) {
+                entryStep.resize(car.getID() + 1);
+            }
+            entryStep[car.getID()] = step;
+        }
+        void onEdgeExit(int worker, Car const& car, int edge) override {
+            totalSteps[edge] += step - entryStep[car.getID()];
+            nExits[edge]++;
+        }
+        void onTickEnd(TrafficModel const& model) override { step++; }
+        // Steps spent so far by a car still on an edge
+        long getStepsOnEdge(Car const& car) const { return step - entryStep[car.getID()]; }
+    };
+
+    // The edge times of an assignment by Little's law, occupancy over exits, against the time the cars spent on the
+    // edge, those still on it included. Both sides account for the same car seconds, also on the in-edges of the
+    // intersection, which are oversaturated and hold cars back for hours.
+    void checkAssignmentSpillback(std::string const& directory) {
+        TrafficModel model(directory + "/intersection_network.txt", 0.5f, 1);
+        model.loadDemand(directory + "/intersection_demand.txt");
+        auto probe = std::make_shared<EdgeTimeProbe>(model.getNEdges());
+        model.addProbe(probe);
+        // One interval, as intervals count from midnight
+        double start = 6 * 3600;
+        double end = 9 * 3600;
+        TrafficAssignment assignment(model, start, end, end - start, 2);
+        assignment.iterate();
+        std::vector<float> littleTimes = assignment.getEdgeTravelTimes((int) (start / (end - start)));
+        for (int i = 0; i < model.getNEdges(); ++i) {
+            Edge const& edge = model.getEdge(i);
+            expect(probe->nExits[i] > 0, "No car left edge " + edge.getLabel());
+            double carSteps = probe->totalSteps[i];
+            edge.getCars().forEach([&](Car const& car) {
+                carSteps += probe->getStepsOnEdge(car);
+            });
+            double carTime = carSteps * model.getDeltaTime() / probe->nExits[i];
+            expect(std::abs(littleTimes[i] - carTime) <= 1e-3 * carTime,
+                   "Edge " + edge.getLabel() + " takes " + std::to_string(littleTimes[i])
+                   + " s by Little's law, but its cars account for " + std::to_string(carTime) + " s per exit");
+        }
+    }
+
+    // A warm start without relaxation, at crossing times slow enough to queue up the in-edges, must leave entryGap
+    // between the cars of every lane
+    void checkWarmStartSpacing(std::string const& directory) {
+        TrafficModel model(directory + "/intersection_network.txt", 0.5f, 1);
+        model.loadDemand(directory + "/intersection_demand.txt");
+        model.seed(3);
+        model.clearTraffic(0);
+        model.warmStart(8 * 3600, 0, std::vector<float>(model.getNEdges(), 1800));
+        expect(model.getNCarsInSimulation() > 0, "The warm start placed no cars");
+        for (int i = 0; i < model.getNEdges(); ++i) {
+            Edge const& edge = model.getEdge(i);
+            expectLanesValid(edge);
+            for (int l = 0; l < edge.getNLanes(); ++l) {
+                auto const& lane = edge.getCars().getLane(l);
+                for (size_t k = 1; k < lane.size(); ++k) {
+                    float gap = lane[k]->getX() - lane[k - 1]->getX();
+                    expect(gap >= Edge::entryGap - 1e-3f, "Cars " + std::to_string(gap) + " m apart in lane "
+                                                         + std::to_string(l) + " of edge " + edge.getLabel());
+                }
+            }
+        }
+    }
+
+    // The gravity model samples destinations from the populations, which must follow its weights and row totals.
+    // The default demand takes its rates from the row totals without building the model.
+    void checkGravityModel(std::string const&) {
+        std::vector<int> populations = {120000, 0, 35000, 8000, 0, 640000, 1};
+        double tripsPerDay = 80400;
+        OdMatrix matrix = OdMatrix::gravity(populations, tripsPerDay);
+        std::vector<double> rowTotals = OdMatrix::gravityRowTotals(populations, tripsPerDay);
+        expect(matrix.getNNonZero() == 20, "The gravity model holds " + std::to_string(matrix.getNNonZero())
+                                           + " pairs instead of the 20 between populated nodes");
+        expect(std::abs(matrix.getTotal() - tripsPerDay) <= 1e-9 * tripsPerDay, "The gravity model does not add up");
+        int nSamples = 1000000;
+        for (int i = 0; i < (int) populations.size(); ++i) {
+            std::string row = "Row " + std::to_string(i);
+            expect(std::abs(matrix.getRowTotal(i) - rowTotals[i]) <= 1e-9 * tripsPerDay,
+                   row + " totals " + std::to_string(matrix.getRowTotal(i)) + " trips in the gravity model, but "
+                   + std::to_string(rowTotals[i]) + " without it");
+            if (populations[i] == 0) {
+                expect(matrix.sampleDestination(i, 0.5) == -1, row + " has no population, but sends trips");
+                continue;
+            }
+            std::vector<int> counts(populations.size());
+            for (int k = 0; k < nSamples; ++k) {
+                counts[matrix.sampleDestination(i, (k + 0.5) / nSamples)]++;
+            }
+            double weights = 0;
+            for (int j = 0; j < (int) populations.size(); ++j) {
+                double weight = matrix.getWeight(i, j);
+                weights += weight;
+                double share = (double) counts[j] / nSamples;
+                expect(std::abs(share - weight / rowTotals[i]) <= 1e-5, row + " sends " + std::to_string(share)
+                       + " of its trips to " + std::to_string(j) + " instead of "
+                       + std::to_string(weight / rowTotals[i]));
+            }
+            expect(std::abs(weights - rowTotals[i]) <= 1e-9 * tripsPerDay, row + " weights do not add up");
+        }
+        // Zones beyond the reach of a dense matrix and of int offsets, in memory linear in their number
+        OdMatrix zones = OdMatrix::gravity(std::vector<int>(50000, 1000), 1e7);
+        expect(zones.getNNonZero() == 50000ul * 49999ul, "50000 zones hold " + std::to_string(zones.getNNonZero())
+                                                         + " pairs");
+        expect(zones.getMemoryUsage() < 1000000, "The gravity model of 50000 zones takes "
+                                                 + std::to_string(zones.getMemoryUsage()) + " B");
+        expect(zones.sampleDestination(49999, 0.9999999) == 49998, "The last zone sends a trip to itself");
+    }
+
+    // A task throwing on some workers reaches the caller once every worker is done, and leaves the pool usable
+    void checkWorkerPoolErrors(std::string const&) {
+        WorkerPool pool(3);
+        for (int thrower : {0, 2}) {
+            std::vector<int> finished(pool.size(), 0);
+            std::string error;
+            try {
+                pool.run([&](int worker) {
+                    if (worker >= thrower) {
+                        throw std::runtime_error("worker " + std::to_string(worker));
+                    }
+                    finished[worker] = 1;
+                });
+            } catch (std::runtime_error const& e) {
+                error = e.what();
+            }
+            expect(error == "worker " + std::to_string(thrower), "The run threw '" + error + "' instead of the error "
+                                                                 + "of worker " + std::to_string(thrower));
+            for (int worker = 0; worker < thrower; ++worker) {
+                expect(finished[worker] == 1, "Worker " + std::to_string(worker) + " did not finish");
+            }
+        }
+        std::vector<int> ran(pool.size(), 0);
+        pool.run([&](int worker) { ran[worker] = 1; });
+        expect(std::count(ran.begin(), ran.end(), 1) == pool.size(), "The pool did not run after an error");
+    }
+
+    // A bin distance that is not positive would never cover an edge
+    void checkHistogramBinDistance(std::string const& directory) {
+        TrafficModel model(directory + "/intersection_network.txt", 0.5f, 1);
+        for (float binDistance : {0.0f, -10.0f, std::nanf("")}) {
+            bool rejected = false;
+            try {
+                model.setHistogramBinDistance(binDistance);
+            } catch (std::invalid_argument const&) {
+                rejected = true;
+            }
+            expect(rejected, "A bin distance of " + std::to_string(binDistance) + " m was accepted");
+        }
+        model.setHistogramBinDistance(50);
+        expect(model.getCarCountHistOffsets().size() == (size_t) model.getNEdges() + 1,
+               "No histograms registered at a valid bin distance");
+    }
+
+    // Ticks in which cars entered one edge
+    class EdgeEntryProbe : public Probe
+    {
+    private:
+        int edge;
+        long step = 0;
+
+    public:
+        std::vector<long> entrySteps;
+
+        explicit EdgeEntryProbe(int edge) : edge(edge) {}
+        unsigned getHooks() const override { return ProbeHook::EdgeEntry | ProbeHook::TickEnd; }
+        void onEdgeEntry(int worker, Car const& car, int edge) override {
+            if (edge == this->edge) {
+                entrySteps.push_back(step);
+            }
+        }
+        void onTickEnd(TrafficModel const& model) override { step++; }
+    };
+
+    // Y discharges 0.05 cars/s onto YB, which the cars from A reach at about 0.03/s, so its queue drains over and
+    // over. A car arriving at the drained queue must still wait for the saturation flow, so the cars enter YB at
+    // least 1 / 0.05 s apart, up to one step.
+    void checkSaturationFlow(std::string const& directory) {
+        float deltaTime = 0.5f;
+        float saturationFlow = 0.05f;
+        TrafficModel model(directory + "/chain_network.txt", deltaTime, 1);
+        model.loadDemand(directory + "/chain_demand.txt");
+        model.seed(4);
+        model.clearTraffic(0);
+        auto probe = std::make_shared<EdgeEntryProbe>(model.getEdgeIDFromLabel("YB"));
+        model.addProbe(probe);
+        int nSteps = 6000;
+        for (int step = 0; step < nSteps; ++step) {
+            model.step();
+        }
+        auto const& entries = probe->entrySteps;
+        expect(entries.size() > 20, "Only " + std::to_string(entries.size()) + " cars entered YB");
+        expect(entries.size() <= saturationFlow * nSteps * deltaTime + 1,
+               std::to_string(entries.size()) + " cars entered YB in " + std::to_string(nSteps * deltaTime)
+               + " s, more than the saturation flow allows");
+        for (size_t i = 1; i < entries.size(); ++i) {
+            double headway = (entries[i] - entries[i - 1]) * deltaTime;
+            expect(headway >= 1 / saturationFlow - deltaTime,
+                   "Cars entered YB " + std::to_string(headway) + " s apart at step " + std::to_string(entries[i]));
+        }
+    }
+
+    struct Check
+    {
+        std::string name;
+        std::function<void(std::string const&)> run;
+    };
+
+    std::vector<Check> const checks = {
+        {"lane_change_override", checkLaneChangeOverride},
+        {"edge_event_counts", checkEdgeEventCounts},
+        {"assignment_spillback", checkAssignmentSpillback},
+        {"warm_start_spacing", checkWarmStartSpacing},
+        {"gravity_model", checkGravityModel},
+        {"worker_pool_errors", checkWorkerPoolErrors},
+        {"histogram_bin_distance", checkHistogramBinDistance},
+        {"saturation_flow", checkSaturationFlow},
+    };
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: model_checks <golden directory> [check...]\n";
+        return 2;
+    }
+    std::string directory = argv[1];
+    std::vector<std::string> names(argv + 2, argv + argc);
+    bool passed = true;
+    for (auto const& check : checks) {
+        if (!names.empty() && std::find(names.begin(), names.end(), check.name) == names.end()) {
+            continue;
+        }
+        try {
+            check.run(directory);
+            std::cout << check.name << ": ok\n";
+        } catch (std::exception const& e) {
+            std::cout << check.name << ": " << e.what() << "\n";
+            passed = false;
+        }
+    }
+    return passed ? 0 : 1;
+}
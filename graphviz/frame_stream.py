@@ -0,0 +1,185 @@
+import struct
+from dataclasses import dataclass
+from multiprocessing import resource_tracker, shared_memory
+
+import numpy as np
+
+# Mirrors FrameStreamHeader and FrameSlotHeader in cpp/include/frame_publisher.h
+HEADER_FORMAT = '<7Iff4xQQQQ'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+SLOT_HEADER_FORMAT = '<QQdI4x'
+SLOT_HEADER_SIZE = struct.calcsize(SLOT_HEADER_FORMAT)
+MAGIC = 0x534a4654
+VERSION = 1
+
+
+def align8(size: int) -> int:
+    return (size + 7) & ~7
+
+
+@dataclass(kw_only=True)
+class Frame:
+    frame: int
+    global_time: float
+    cars_per_edge: np.ndarray
+    cars_per_node: np.ndarray
+    histograms: np.ndarray
+    car_edge: np.ndarray
+    car_x: np.ndarray
+    car_lane: np.ndarray
+
+
+class FrameReader:
+    """
+    Attaches to the shared memory frame stream of a TrafficModel, see TrafficModel.start_frame_stream.
+    Reading never blocks the simulation: a frame that is overwritten while being copied is dropped.
+    """
+
+    def __init__(self, name: str):
+        self.shm = shared_memory.SharedMemory(name=name.lstrip('/'))
+        # The publisher owns the segment, so this process must not unlink it on exit
+        resource_tracker.unregister(self.shm._name, 'shared_memory')
+        self.buffer = self.shm.buf
+
+        (magic, version, self.n_nodes, self.n_edges, self.n_bins, self.max_cars, self.n_slots,
+         self.bin_distance, self.delta_time, static_offset, self.slot_offset, self.slot_size,
+         _latest_frame) = struct.unpack_from(HEADER_FORMAT, self.buffer)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError(f'{name} is not a frame stream of version {VERSION}')
+
+        offset = static_offset
+        node_pos = self.__view(np.float32, offset, 2 * self.n_nodes)
+        offset += align8(2 * self.n_nodes * 4)
+        edge_nodes = self.__view(np.int32, offset, 2 * self.n_edges)
+        offset += align8(2 * self.n_edges * 4)
+        edge_lengths = self.__view(np.float32, offset, self.n_edges)
+        offset += align8(self.n_edges * 4)
+        bin_offsets = self.__view(np.int32, offset, self.n_edges + 1)
+
+        self.node_x = node_pos[:self.n_nodes].copy()
+        self.node_y = node_pos[self.n_nodes:].copy()
+        self.edge_start = edge_nodes[:self.n_edges].copy()
+        self.edge_end = edge_nodes[self.n_edges:].copy()
+        self.edge_lengths = edge_lengths.copy()
+        self.bin_offsets = bin_offsets.copy()
+        del node_pos, edge_nodes, edge_lengths, bin_offsets
+
+        self.last_frame = 0
+
+    def __view(self, dtype, offset: int, count: int) -> np.ndarray:
+        return np.frombuffer(self.buffer, dtype=dtype, count=count, offset=offset)
+
+    def __sequence(self, slot_offset: int) -> int:
+        return struct.unpack_from('<Q', self.buffer, slot_offset)[0]
+
+    def get_latest_frame_number(self) -> int:
+        return struct.unpack_from('<Q', self.buffer, HEADER_SIZE - 8)[0]
+
+    def read_latest(self) -> Frame | None:
+        """Returns the newest complete frame, or None if there is no frame newer than the last one read."""
+        latest = self.get_latest_frame_number()
+        if latest <= self.last_frame:
+            return None
+        slot_offset = self.slot_offset + (latest % self.n_slots) * self.slot_size
+        sequence = self.__sequence(slot_offset)
+        if sequence % 2 == 1:
+            return None
+
+        _sequence, frame, global_time, n_cars = struct.unpack_from(SLOT_HEADER_FORMAT, self.buffer, slot_offset)
+        offset = slot_offset + align8(SLOT_HEADER_SIZE)
+        counts = self.__view(np.int32, offset, self.n_edges + self.n_nodes + self.n_bins).copy()
+        offset += align8((self.n_edges + self.n_nodes + self.n_bins) * 4)
+        n_cars = min(n_cars, self.max_cars)
+        car_edge = self.__view(np.int32, offset, n_cars).copy()
+        offset += align8(self.max_cars * 4)
+        car_x = self.__view(np.float32, offset, n_cars).copy()
+        offset += align8(self.max_cars * 4)
+        car_lane = self.__view(np.int32, offset, n_cars).copy()
+
+        # The publisher lapped this slot during the copy
+        if self.__sequence(slot_offset) != sequence or frame != latest:
+            return None
+        self.last_frame = frame
+        return Frame(frame=frame, global_time=global_time,
+                     cars_per_edge=counts[:self.n_edges],
+                     cars_per_node=counts[self.n_edges:self.n_edges + self.n_nodes],
+                     histograms=counts[self.n_edges + self.n_nodes:],
+                     car_edge=car_edge, car_x=car_x, car_lane=car_lane)
+
+    def close(self):
+        self.buffer = None
+        self.shm.close()
+
+
+class FrameStreamSimulation:
+    """
+    Presents a frame stream through the part of the simulation interface used by GameGraphView,
+    such that a viewer can follow a simulation running in another process.
+    """
+
+    def __init__(self, name: str):
+        self.reader = FrameReader(name)
+        self.frame = None
+        self.bin_distance = self.reader.bin_distance
+        while self.frame is None:
+            self.frame = self.reader.read_latest()
+
+    def get_delta_time(self) -> float:
+        return self.reader.delta_time
+
+    def step_forward(self):
+        # Skips every frame published since the last call
+        frame = self.reader.read_latest()
+        if frame is not None:
+            self.frame = frame
+
+    def get_global_time(self) -> float:
+        return self.frame.global_time
+
+    def get_node_ids(self) -> list[int]:
+        return list(range(self.reader.n_nodes))
+
+    def get_edge_ids(self) -> list[int]:
+        return list(range(self.reader.n_edges))
+
+    def get_node_pos(self, node_id: int) -> tuple[float, float]:
+        return float(self.reader.node_x[node_id]), float(self.reader.node_y[node_id])
+
+    def get_edge_start_node_id(self, edge_id: int) -> int:
+        return int(self.reader.edge_start[edge_id])
+
+    def get_edge_end_node_id(self, edge_id: int) -> int:
+        return int(self.reader.edge_end[edge_id])
+
+    def get_edge_road_length(self, edge_id: int) -> float:
+        return float(self.reader.edge_lengths[edge_id])
+
+    def get_car_count_in_node(self, node_id: int) -> int:
+        return int(self.frame.cars_per_node[node_id])
+
+    def get_n_cars_per_edge(self) -> list[int]:
+        return self.frame.cars_per_edge.tolist()
+
+    def set_car_count_histogram_bin_distance(self, bin_distance: float):
+        # The stream has a fixed bin distance, its bins are merged into the requested ones on read
+        self.bin_distance = bin_distance
+
+    def get_car_count_histograms(self) -> np.ndarray:
+        if self.bin_distance == self.reader.bin_distance:
+            return self.frame.histograms
+        offsets = self.get_car_count_histogram_offsets()
+        hists = np.zeros(offsets[-1], dtype=np.int32)
+        bin_offsets = self.reader.bin_offsets
+        for edge_id in self.get_edge_ids():
+            stream_hist = self.frame.histograms[bin_offsets[edge_id]:bin_offsets[edge_id + 1]]
+            centers = (np.arange(len(stream_hist)) + .5) * self.reader.bin_distance
+            bins = np.minimum(centers // self.bin_distance, offsets[edge_id + 1] - offsets[edge_id] - 1)
+            np.add.at(hists, offsets[edge_id] + bins.astype(np.int64), stream_hist)
+        return hists
+
+    def get_car_count_histogram_offsets(self) -> list[int]:
+        bin_counts = np.ceil(self.reader.edge_lengths / self.bin_distance).astype(np.int64)
+        return [0] + np.cumsum(bin_counts).tolist()
+
+    def close(self):
+        self.reader.close()
@@ -149,6 +149,25 @@ class Simulation:
         # edges should be about equal to bins
         return hist, edges
 
+    def set_car_count_histogram_bin_distance(self, bin_distance: float):
+        self.__bin_distance = bin_distance
+
+    def get_car_count_histograms(self):
+        return np.concatenate([
+            np.histogram([self.__cars[car_id].x for car_id in edge.car_ids],
+                         np.arange(self.__get_bin_count(edge) + 1) * self.__bin_distance)[0]
+            for edge in self.__edges.values()
+        ])
+
+    def get_car_count_histogram_offsets(self) -> list[int]:
+        offsets = [0]
+        for edge in self.__edges.values():
+            offsets.append(offsets[-1] + self.__get_bin_count(edge))
+        return offsets
+
+    def __get_bin_count(self, edge: SimEdge) -> int:
+        return int(np.ceil(edge.length / self.__bin_distance))
+
     def get_car_count_in_node(self, node_id: int) -> int:
         return len(self.__nodes[node_id].car_ids)
 
@@ -0,0 +1,22 @@
+from collections.abc import Iterator
+
+import numpy as np
+
+from traffic_model import TrajectoryReader
+
+# time, ids, edges, x, v, lanes of all cars on edges in one tick
+Tick = tuple[float, np.ndarray, np.ndarray, np.ndarray, np.ndarray, np.ndarray]
+
+
+def replay_ticks(fn: str, start_time: float = 0, end_time: float = float('inf')) -> Iterator[Tick]:
+    """Streams the ticks of a recorded trajectory file, decoding one chunk at a time."""
+    reader = TrajectoryReader(fn)
+    for chunk_id in range(reader.find_chunk(start_time), reader.get_n_chunks()):
+        tick_times, tick_offsets, ids, edges, xs, vs, lanes = reader.read_chunk(chunk_id)
+        for tick, time in enumerate(tick_times):
+            if time < start_time:
+                continue
+            if time > end_time:
+                return
+            rows = slice(tick_offsets[tick], tick_offsets[tick + 1])
+            yield time, ids[rows], edges[rows], xs[rows], vs[rows], lanes[rows]
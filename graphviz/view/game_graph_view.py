@@ -75,6 +75,7 @@ class GameGraphView(GameView):
 
         self.pixels_per_density_interval = 5
         self.density_interval_pixel_padding = 5
+        self.bin_distance = None
 
         self.load_viz_graph()
 
@@ -189,13 +190,21 @@ class GameGraphView(GameView):
 
     def render(self):
         self.screen.fill('gray')
+        sim = self.simulation
+        # Every edge has the same meters per pixel, so one registered bin distance serves the whole network
+        bin_distance = self.pixels_per_density_interval / self.scale
+        if bin_distance != self.bin_distance:
+            sim.set_car_count_histogram_bin_distance(bin_distance)
+            self.bin_distance = bin_distance
+        hists = sim.get_car_count_histograms()
+        offsets = sim.get_car_count_histogram_offsets()
         for edge in self.edges.values():
-            self.draw_edge(edge)
+            self.draw_edge(edge, hists[offsets[edge.id]:offsets[edge.id + 1]])
         for node in self.nodes.values():
             self.draw_node(node)
         self.draw_info()
 
-    def draw_edge(self, edge: VizEdge):
+    def draw_edge(self, edge: VizEdge, hist):
         sim = self.simulation
         offset = self.get_offset()
         real_offset = offset + edge.offset
@@ -203,9 +212,7 @@ class GameGraphView(GameView):
         dist_in_meters = sim.get_edge_road_length(edge.id)
         dist_in_pixels = (edge.pos0 - edge.pos1).length() * self.scale
         meter_per_pixel = dist_in_meters / dist_in_pixels
-        bin_distance = meter_per_pixel * self.pixels_per_density_interval
-
-        hist, edges = sim.get_car_count_histogram_in_edge(edge.id, bin_distance)
+        bin_distance = self.bin_distance
 
         pygame.draw.line(self.screen, 'black',
                          real_offset + self.scale_and_round(edge.pos0),
@@ -228,8 +235,8 @@ class GameGraphView(GameView):
 
         for color in sorted_colors:
             for i in indices_per_color[color]:
-                dist_start = max(0, edges[i] - density_interval_dist_padding)
-                dist_end = min(edges[i+1] + density_interval_dist_padding, dist_in_meters)
+                dist_start = max(0, i * bin_distance - density_interval_dist_padding)
+                dist_end = min((i + 1) * bin_distance + density_interval_dist_padding, dist_in_meters)
 
                 pos_start = edge.pos0 + (dist_start / dist_in_meters) * (edge.pos1 - edge.pos0)
                 pos_end = edge.pos0 + (dist_end / dist_in_meters) * (edge.pos1 - edge.pos0)
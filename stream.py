@@ -0,0 +1,36 @@
+import os
+import sys
+os.system("./build.sh")
+
+from graphviz.frame_stream import FrameStreamSimulation
+from graphviz.game import Game
+from graphviz.view.game_graph_view import GameGraphView
+
+
+DELTA_TIME = 0.5
+SCALE = 1
+STREAM_NAME = "/trafficjelly"
+STREAM_BIN_DISTANCE = 10  # m
+STEPS_PER_FRAME = 4
+
+
+def publish():
+    from traffic_model import TrafficModel
+
+    simulation = TrafficModel("graph.txt", DELTA_TIME, SCALE)
+    simulation.start_frame_stream(STREAM_NAME, STREAM_BIN_DISTANCE, STEPS_PER_FRAME, max_cars=100000)
+    print(f"Publishing frames to {STREAM_NAME}, attach with: python stream.py view")
+    while True:
+        simulation.step_forward()
+
+
+def view():
+    simulation = FrameStreamSimulation(STREAM_NAME)
+    game = Game(simulation=simulation)
+    game.push_view(GameGraphView(game=game))
+    game.main()
+    simulation.close()
+
+
+if __name__ == '__main__':
+    view() if sys.argv[1:] == ["view"] else publish()